@@ -6,59 +6,89 @@
 
 
 #include <math.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
 #include <QApplication>
 #include <QComboBox>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QDockWidget>
 #include <QFileDialog>
+#include <QFontDatabase>
 #include <QGraphicsPixmapItem>
 #include <QGraphicsSceneMouseEvent>
+#include <QImageReader>
+#include <QInputDialog>
 #include <QKeyEvent>
 #include <QLabel>
 #include <QLineEdit>
+#include <QListView>
 #include <QMenuBar>
 #include <QMessageBox>
+#include <QPlainTextEdit>
+#include <QProcess>
+#include <QPushButton>
 #include <QScrollBar>
+#include <QSet>
 #include <QSettings>
 #include <QSpinBox>
+#include <QStatusBar>
 #include <QStyle>
+#include <QThread>
+#include <QTimer>
 #include <QToolBar>
+#include <QVBoxLayout>
 #include "AWindow.h"
+#include "AtlasOps.h"
 #include "CanvasDialog.h"
+#include "DataExport.h"
 #include "IOWidget.h"
+#include "ImageCache.h"
+#include "ImageOps.h"
+#include "Profiler.h"
 #include "Atlush.h"
 #include "ItemValues.h"
+#include "RegionLayer.h"
+#include "SliceDialog.h"
 
 
-#define ITEM_PIXMAP(gi) static_cast<const QGraphicsPixmapItem*>(gi)->pixmap()
+#define ITEM_PIXMAP(gi) static_cast<const ResidentImage*>(gi)->pixels()
 
 enum UndoOpcodes {
     UNDO_POS = 1,
-    UNDO_RECT
+    UNDO_RECT,
+    UNDO_GRID,      // Regions created by gridSlice() (see GridUndo).
+    UNDO_REMOVE,    // Serial numbers of images removed by applyWatch().
+    UNDO_SLICE      // Regions created by autoSlice() (see SliceUndo).
 };
 
-#define EXT_COUNT   4
-static const char* imageExt[EXT_COUNT] = { ".png", ".jpeg", ".jpg", ".ppm" };
+// Values of each image in an UNDO_GRID step.
+enum GridUndo {
+    GU_IMAGE,       // u: Image serial number.
+    GU_SERIAL,      // u: Serial number of the first region.
+    GU_COUNT,       // u: Regions created.
+    GU_CELL,        // s: Cell width & height.
+    GU_SPACE,       // s: Spacing & margin.
+    GU_DIM,         // h: Columns & rows.
+    GU_RUNS         // u pairs: First cell id & cell count of each run.
+};
 
-QStringList imageFilters()
-{
-    QStringList list;
-    char wild[8];
+// Values of each image in an UNDO_SLICE step.
+enum SliceUndo {
+    SU_IMAGE,       // u: Image serial number.
+    SU_SERIAL,      // u: Serial number of the first region.
+    SU_INDEX,       // u: Name suffix of the first region.
+    SU_RECTS        // h pairs: Position & size of each region.
+};
 
-    wild[0] = '*';
-    for (int i = 0; i < EXT_COUNT; ++i) {
-        strcpy(wild + 1, imageExt[i]);
-        list << QString(wild);
-    }
-    return list;
-}
+#define BULK_UNDO_VALUES    64  // Larger undo steps are applied in bulk.
 
-bool hasImageExt(const QString& path)
-{
-    for (int i = 0; i < EXT_COUNT; ++i) {
-        if (path.endsWith(QLatin1String(imageExt[i]), Qt::CaseInsensitive))
-            return true;
-    }
-    return false;
-}
+// Opcode flag of a step which is undone & redone together with the step
+// before it.  Used when a change needs more than one step.
+#define UNDO_JOIN           0x4000
 
 void itemValues(ItemValues& iv, const QGraphicsItem* item)
 {
@@ -92,8 +122,11 @@ static inline QPointF& pixelSnap(QPointF& pnt)
     return pnt;
 }
 
-class AImage : public QGraphicsPixmapItem
+class AImage : public ResidentImage
 {
+public:
+    AImage(Residency* res) : ResidentImage(res) {}
+
 protected:
      QVariant itemChange(GraphicsItemChange change, const QVariant& value)
      {
@@ -105,6 +138,31 @@ protected:
      }
 };
 
+/*
+ * Return the resize handle of region rectangle br at pos (1-4), or zero if
+ * pos is not over a handle.
+ */
+int regionHandleAt(const QRectF& br, const QPointF& pos)
+{
+    int h;
+
+    if (br.width() <= HANDLE_SIZE || br.height() <= HANDLE_SIZE)
+        return 4;
+
+    if (pos.y() < br.top() + HANDLE_SIZE)
+        h = 1;
+    else if (pos.y() > br.bottom() - HANDLE_SIZE)
+        h = 3;
+    else
+        return 0;
+
+    if (pos.x() < br.left() + HANDLE_SIZE)      // 1---2
+        return h;                               // |   |
+    if (pos.x() > br.right() - HANDLE_SIZE)     // 3---4
+        return h + 1;
+    return 0;
+}
+
 class ARegion : public QGraphicsRectItem
 {
 public:
@@ -225,24 +283,7 @@ private:
 
     int handleAt(const QPointF& pos)
     {
-        QRectF br = rect();
-        int h;
-
-        if (br.width() <= HANDLE_SIZE || br.height() <= HANDLE_SIZE)
-            return 4;
-
-        if (pos.y() < br.top() + HANDLE_SIZE)
-            h = 1;
-        else if (pos.y() > br.bottom() - HANDLE_SIZE)
-            h = 3;
-        else
-            return 0;
-
-        if (pos.x() < br.left() + HANDLE_SIZE)      // 1---2
-            return h;                               // |   |
-        if (pos.x() > br.right() - HANDLE_SIZE)     // 3---4
-            return h + 1;
-        return 0;
+        return regionHandleAt(rect(), pos);
     }
 
     QPointF _resizePos;
@@ -259,23 +300,43 @@ AUndoSystem::ItemShapshot::ItemShapshot(QGraphicsItem* gi) {
     y = gi->y();
 }
 
+/*
+ * Push a step of at most UNDO_VAL_LIMIT values onto the stack.  Inside a
+ * group each step after the first is joined to the one before it.
+ */
+void AUndoSystem::recordStep(int opcode, const UndoValue* vals, int count)
+{
+    if (grouping) {
+        if (groupStarted)
+            opcode |= UNDO_JOIN;
+        groupStarted = true;
+    }
+    undo_record(&stack, opcode, vals, count);
+    journal->step(opcode, vals, count);
+    act->setEnabled(true);
+}
+
 void AUndoSystem::undoRecord(int opcode, int stride)
 {
     if (! values.empty()) {
         int len = values.size();
         int partSize = (UNDO_VAL_LIMIT / stride) * stride;
 
-        // Break large change sets into smaller steps.
+        // Break large change sets into smaller steps which are joined so
+        // that they are undone together.
+        bool group = ! grouping;
+        if (group)
+            beginGroup();
         while (len > partSize) {
             len -= partSize;
-            undo_record(&stack, opcode, values.data() + len, partSize);
+            recordStep(opcode, values.data() + len, partSize);
         }
-
         if (len)
-            undo_record(&stack, opcode, values.data(), len);
+            recordStep(opcode, values.data(), len);
+        if (group)
+            endGroup();
 
         values.clear();
-        act->setEnabled(true);
         //emit undoStackChanged(stack.used);
     }
 }
@@ -300,6 +361,42 @@ void AUndoSystem::snapshot(const QList<QGraphicsItem*>& items)
         snap.emplace_back(items.at(i));
 }
 
+/*
+ * Record changes made outside of snapshot() & commit().  The vals are moved
+ * into the undo stack in groups of stride values (serial number followed by
+ * the deltas).
+ */
+void AUndoSystem::recordValues(int opcode, int stride,
+                               std::vector<UndoValue>& vals)
+{
+    values.swap(vals);
+    undoRecord(opcode, stride);
+    vals.clear();
+}
+
+/*
+ * Record a change to a region which is not an item (see RegionLayer).
+ */
+void AUndoSystem::recordRect(uint32_t serial, int dx, int dy, int dw, int dh)
+{
+    UndoValue uval;
+
+    uval.u = serial;
+    values.push_back(uval);
+
+    uval.s[0] = int16_t(dx);
+    uval.s[1] = int16_t(dy);
+    values.push_back(uval);
+
+    if (dw || dh) {
+        uval.s[0] = int16_t(dw);
+        uval.s[1] = int16_t(dh);
+        values.push_back(uval);
+        undoRecord(UNDO_RECT, 3);
+    } else
+        undoRecord(UNDO_POS, 2);
+}
+
 /*
  * Commit changes since last snapshot() call to the undo stack.
  *
@@ -463,17 +560,28 @@ void AView::wheelEvent(QWheelEvent* event)
 //----------------------------------------------------------------------------
 
 AWindow::AWindow()
-    : _modifiedStr(NULL), _canvasDialog(NULL), _ioDialog(NULL), _selItem(NULL)
+    : _modifiedStr(NULL), _canvasDialog(NULL), _ioDialog(NULL),
+      _ioProc(NULL), _saveThread(NULL), _cacheThread(NULL),
+      _ioReader(NULL), _selItem(NULL)
 {
     _serialNo = 0;
+    _savedChanges = 0;
+    _searchHit = -1;
+    _bulkDepth = 0;
     setWindowTitle(APP_NAME);
 
     createActions();
-    createMenus();
     createTools();
+    createMenus();
 
     undo_init(&_undo.stack, 1024*16);
     _undo.act = _actUndo;
+    _undo.journal = &_journal;
+    _journal.setTarget(QString());
+
+    _journalTimer = new QTimer(this);
+    connect(_journalTimer, SIGNAL(timeout()), SLOT(journalTick()));
+    _journalTimer->start(2000);
 
     _scene = new QGraphicsScene;
     connect(_scene, SIGNAL(selectionChanged()), SLOT(syncSelection()));
@@ -487,6 +595,15 @@ AWindow::AWindow()
 
     _bgPix = QPixmap(":/icons/transparent.png");
 
+    Profiler::instance().setNotify(profileNotify, this);
+    _watcher = new FileWatcher(watchNotify, this, 150);
+
+    _residency = new Residency(_view, residencyLoad, this);
+    QLabel* resident = new QLabel;
+    statusBar()->addPermanentWidget(resident);
+    connect(_residency, SIGNAL(readout(const QString&)),
+            resident, SLOT(setText(const QString&)));
+
     QSettings settings;
     resize(settings.value("window-size", QSize(480, 480)).toSize());
     restoreState(settings.value("window-state").toByteArray());
@@ -496,15 +613,68 @@ AWindow::AWindow()
     _recent.setFiles(settings.value("recent-files").toStringList());
     _actShowHot->setChecked(settings.value("show-hotspots", false).toBool());
     _packPad->setValue( settings.value("pack-padding").toInt() );
+    ImageCache& cache = ImageCache::instance();
+    cache.setBudget(settings.value("image-cache-mb", cache.budget()).toInt());
+    _actPixelCache->setChecked(settings.value("pixel-cache", false).toBool());
+    _residency->setLimit(settings.value("image-memory-mb", 2048).toInt());
+    _actWatch->setChecked(settings.value("watch-files", false).toBool());
 
     _io->setSpec(_ioSpec);
 }
 
 AWindow::~AWindow()
 {
+    Profiler::instance().setNotify(NULL, NULL);
+    delete _watcher;
     undo_free(&_undo.stack);
 }
 
+#if ! defined(_WIN32) && QT_VERSION < 0x060000
+// Qt 5 calls setupChildProcess() in the child before it runs the program.
+class SessionProcess : public QProcess
+{
+public:
+    SessionProcess(QObject* parent) : QProcess(parent) {}
+protected:
+    void setupChildProcess() { setsid(); }
+};
+#endif
+
+/*
+ * Create a process for a shell command.  On Unix the shell leads a new
+ * session & process group so that killCommand() also stops the programs it
+ * starts.
+ */
+static QProcess* newCommandProcess(QObject* parent)
+{
+#if defined(_WIN32)
+    return new QProcess(parent);
+#elif QT_VERSION >= 0x060000
+    QProcess* proc = new QProcess(parent);
+    proc->setChildProcessModifier([]() { setsid(); });
+    return proc;
+#else
+    return new SessionProcess(parent);
+#endif
+}
+
+/*
+ * Kill a shell command and every process it started.
+ */
+static void killCommand(QProcess* proc)
+{
+    qint64 pid = proc->processId();
+    if (pid > 0) {
+#ifdef _WIN32
+        QProcess::execute("taskkill", QStringList() << "/T" << "/F"
+                                      << "/PID" << QString::number(pid));
+#else
+        ::kill(-pid_t(pid), SIGKILL);
+#endif
+    }
+    proc->kill();
+}
+
 void AWindow::closeEvent( QCloseEvent* ev )
 {
     QSettings settings;
@@ -516,10 +686,77 @@ void AWindow::closeEvent( QCloseEvent* ev )
     settings.setValue("recent-files", _recent.files);
     settings.setValue("show-hotspots", _actShowHot->isChecked());
     settings.setValue("pack-padding", _packPad->value());
+    settings.setValue("image-cache-mb", ImageCache::instance().budget());
+    settings.setValue("pixel-cache", _actPixelCache->isChecked());
+    settings.setValue("image-memory-mb", _residency->limit());
+    settings.setValue("watch-files", _actWatch->isChecked());
+
+    if (_ioProc) {
+        killCommand(_ioProc);
+        _ioProc->waitForFinished(1000);
+    }
+    waitForSave();
+    waitForCache();
+
+    // Unsaved changes stay in the journal to be offered for recovery when
+    // the project is next opened.
+    if (_journal.changes() == _savedChanges)
+        _journal.discard();
+    else
+        journalTick();
 
     QMainWindow::closeEvent( ev );
 }
 
+void AWindow::profileNotify(const QString& summary, void* user)
+{
+    static_cast<AWindow*>(user)->statusBar()->showMessage(summary, 8000);
+}
+
+/*
+ * Show the time spent in each profiled operation.
+ */
+void AWindow::showProfile()
+{
+    Profiler& prof = Profiler::instance();
+
+    QDialog dlg(this);
+    dlg.setWindowTitle("Profile");
+
+    QPlainTextEdit* text = new QPlainTextEdit;
+    text->setReadOnly(true);
+    text->setLineWrapMode(QPlainTextEdit::NoWrap);
+    text->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    text->setPlainText(prof.lastSummary() + "\n\n" + prof.report());
+    text->setMinimumSize(560, 320);
+
+    QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Close);
+    QPushButton* clear = buttons->addButton("Clear",
+                                            QDialogButtonBox::ResetRole);
+    QPushButton* trace = NULL;
+    if (! prof.traceFile().isEmpty())
+        trace = buttons->addButton("Write Trace",
+                                   QDialogButtonBox::ActionRole);
+    connect(buttons, SIGNAL(rejected()), &dlg, SLOT(reject()));
+
+    QVBoxLayout* lo = new QVBoxLayout(&dlg);
+    lo->addWidget(text);
+    lo->addWidget(buttons);
+
+    connect(clear, &QPushButton::clicked, [&prof, text]() {
+        prof.clear();
+        text->setPlainText(prof.report());
+    });
+    if (trace) {
+        connect(trace, &QPushButton::clicked, [this, &prof]() {
+            QString msg = prof.writeTrace() ? "Trace written to "
+                                            : "Could not write trace ";
+            statusBar()->showMessage(msg + prof.traceFile(), 5000);
+        });
+    }
+    dlg.exec();
+}
+
 void AWindow::showAbout()
 {
     QString str(
@@ -633,6 +870,10 @@ void AWindow::createActions()
     _actShowHot = new QAction("Show &Hotspots", this);
     _actShowHot->setCheckable(true);
 
+    _actBatchRegions = new QAction("&Batch Regions", this);
+    _actBatchRegions->setCheckable(true);
+    connect(_actBatchRegions, SIGNAL(toggled(bool)), SLOT(batchRegions(bool)));
+
     _actPack = new QAction(QIcon(":/icons/pack.png"),
                            "&Pack Images", this );
     connect(_actPack, SIGNAL(triggered()), SLOT(packImages()));
@@ -648,7 +889,7 @@ void AWindow::hideRegions(bool hide)
 {
     bool visible = ! hide;
     each_item_mod(it) {
-        if (IS_REGION(it))
+        if (IS_REGION(it) || IS_LAYER(it))
             it->setVisible(visible);
     }
 }
@@ -662,9 +903,115 @@ void AWindow::lockRegions(bool lock)
     each_item_mod(it) {
         if (IS_REGION(it))
             it->setFlags(flags);
+        else if (IS_LAYER(it))
+            it->setAcceptedMouseButtons(lock ? Qt::NoButton : Qt::LeftButton);
+    }
+}
+
+/*
+ * Move the regions of an image from ARegion items into a RegionLayer.
+ */
+void AWindow::layerFromRegions(QGraphicsItem* image)
+{
+    RegionLayer* layer = NULL;
+    LayerRegion lr;
+
+    for (QGraphicsItem* ch : image->childItems()) {
+        if (! IS_REGION(ch))
+            continue;
+        if (! layer)
+            layer = newLayer(image);
+
+        ARegion* region = static_cast<ARegion*>(ch);
+        QPointF pos = region->pos();
+        QRectF rect = region->rect();
+        lr.x = int(pos.x());
+        lr.y = int(pos.y());
+        lr.w = int(rect.width());
+        lr.h = int(rect.height());
+        lr.hotx = region->hotspot[0];
+        lr.hoty = region->hotspot[1];
+        lr.serial = region->data(ID_SERIAL).toUInt();
+
+        QString name(region->data(ID_NAME).toString());
+        layer->append(lr, name);
+        _names.insert(layer, lr.serial, name);
+        delete region;
+    }
+}
+
+/*
+ * Move the regions of an image out of any RegionLayer and into ARegion items.
+ */
+void AWindow::regionsFromLayer(QGraphicsItem* image)
+{
+    uint32_t serialNo = _serialNo;
+
+    for (QGraphicsItem* ch : image->childItems()) {
+        if (! IS_LAYER(ch))
+            continue;
+        RegionLayer* layer = static_cast<RegionLayer*>(ch);
+        QPointF lpos = layer->pos();
+        for (int i = 0; i < layer->count(); ++i) {
+            const LayerRegion& lr = layer->region(i);
+            _serialNo = lr.serial - 1;
+            QGraphicsItem* region =
+                makeRegion(image, int(lpos.x()) + lr.x, int(lpos.y()) + lr.y,
+                           lr.w, lr.h, lr.hotx, lr.hoty);
+            setItemName(region, layer->name(i));
+        }
+        delete layer;
+    }
+    _serialNo = serialNo;
+}
+
+RegionLayer* AWindow::newLayer(QGraphicsItem* image)
+{
+    RegionLayer* layer = new RegionLayer(image, &_undo);
+    layer->setVisible(! _actHideRegions->isChecked());
+    if (_actLockRegions->isChecked())
+        layer->setAcceptedMouseButtons(Qt::NoButton);
+    return layer;
+}
+
+/*
+ * Switch between one ARegion item per region & one RegionLayer per image.
+ */
+void AWindow::batchRegions(bool on)
+{
+    ItemList images;
+    each_item_mod(it) {
+        if (IS_IMAGE(it))
+            images.append(it);
+    }
+
+    _scene->clearSelection();
+    highlightHit(-1);
+
+    for (QGraphicsItem* gi : images) {
+        if (on)
+            layerFromRegions(gi);
+        else
+            regionsFromLayer(gi);
+    }
+
+    if (! on) {
+        if (_actHideRegions->isChecked())
+            hideRegions(true);
+        if (_actLockRegions->isChecked())
+            lockRegions(true);
     }
 }
 
+/*
+ * Operations which work on region items call this to leave batch mode.
+ */
+void AWindow::requireRegionItems()
+{
+    if (_actBatchRegions->isChecked())
+        _actBatchRegions->setChecked(false);
+}
+
 void AWindow::lockImages(bool lock)
 {
     QGraphicsItem::GraphicsItemFlags flags;
@@ -687,7 +1034,8 @@ void AWindow::createMenus()
     file->addAction( _actOpen );
     file->addAction( _actSave );
     file->addAction( _actSaveAs );
-    file->addAction("Import &Directory...", this, SLOT(importDir()));
+    act = file->addAction("Import &Directory...", this, SLOT(importDir()));
+    _editActs << _actNew << _actOpen << act;
     file->addAction("Export &Image...", this, SLOT(exportImage()));
     file->addSeparator();
     _recent.install(file, this, SLOT(openRecent()));
@@ -710,8 +1058,11 @@ void AWindow::createMenus()
     act = edit->addAction("Regions to Images...", this, SLOT(convertToImage()));
     act->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_I));
     edit->addAction("Crop Images...", this, SLOT(cropImages()));
+    edit->addAction("Auto Slice...", this, SLOT(autoSlice()));
+    edit->addAction("Grid Slice...", this, SLOT(gridSlice()));
     edit->addSeparator();
     edit->addAction("Canvas &Size...", this, SLOT(editDocSize()));
+    _editActs << edit->actions();
 
     QMenu* view = bar->addMenu( "&View" );
     view->addAction( _actViewReset );
@@ -721,9 +1072,22 @@ void AWindow::createMenus()
     view->addAction( _actLockRegions );
     view->addAction( _actLockImages );
     view->addAction( _actShowHot );
+    view->addAction( _actBatchRegions );
+    view->addAction( _resultDock->toggleViewAction() );
+    view->addAction( _ioDock->toggleViewAction() );
+    view->addSeparator();
+    view->addAction("&Profile...", this, SLOT(showProfile()));
 
     QMenu* sett = bar->addMenu( "&Settings" );
     sett->addAction("Configure &Pipelines...", this, SLOT(editPipelines()));
+    sett->addAction("Image &Cache Size...", this, SLOT(editCacheSize()));
+    sett->addAction("Image &Memory Limit...", this, SLOT(editMemoryLimit()));
+    _actPixelCache = sett->addAction("Pixel Cache &Files");
+    _actPixelCache->setCheckable(true);
+    connect(_actPixelCache, SIGNAL(toggled(bool)), SLOT(usePixelCache(bool)));
+    _actWatch = sett->addAction("&Watch Files");
+    _actWatch->setCheckable(true);
+    connect(_actWatch, SIGNAL(toggled(bool)), SLOT(watchFiles(bool)));
 
     bar->addSeparator();
 
@@ -813,21 +1177,62 @@ void AWindow::createTools()
 
     _io = new IOWidget;
     connect(_io, SIGNAL(execute(int,int)), SLOT(execute(int,int)));
+    connect(_io, SIGNAL(cancel()), SLOT(ioCancel()));
 
     _ioBar = new QToolBar;
     _ioBar->setObjectName("ioBar");
     _ioBar->addWidget(_io);
     addToolBar(Qt::BottomToolBarArea, _ioBar);
 
+    _ioLog = new QPlainTextEdit;
+    _ioLog->setReadOnly(true);
+    _ioLog->setMaximumBlockCount(5000);
+    _ioLog->setLineWrapMode(QPlainTextEdit::NoWrap);
+
+    _ioDock = new QDockWidget("I/O Log", this);
+    _ioDock->setObjectName("ioLog");
+    _ioDock->setWidget(_ioLog);
+    _ioDock->hide();
+    addDockWidget(Qt::BottomDockWidgetArea, _ioDock);
+
+
+    _searchTimer = new QTimer(this);
+    _searchTimer->setSingleShot(true);
+    _searchTimer->setInterval(150);
+    connect(_searchTimer, SIGNAL(timeout()), SLOT(modSearch()));
 
     _search = new QLineEdit;
     _search->setPlaceholderText("search");
-    connect(_search, SIGNAL(editingFinished()), SLOT(modSearch()));
+    connect(_search, SIGNAL(textEdited(const QString&)),
+            _searchTimer, SLOT(start()));
+    connect(_search, SIGNAL(returnPressed()), SLOT(searchJump()));
+
+    _searchMode = new QComboBox;
+    _searchMode->addItem("Text");
+    _searchMode->addItem("Glob");
+    _searchMode->addItem("Regex");
+    connect(_searchMode, SIGNAL(currentIndexChanged(int)), SLOT(modSearch()));
 
     _searchBar = new QToolBar;
     _searchBar->setObjectName("searchBar");
     _searchBar->addWidget(_search);
+    _searchBar->addWidget(_searchMode);
     addToolBar(Qt::BottomToolBarArea, _searchBar);
+
+    _results = new SearchResults(&_names, this);
+
+    _resultList = new QListView;
+    _resultList->setUniformItemSizes(true);
+    _resultList->setModel(_results);
+    connect(_resultList->selectionModel(),
+            SIGNAL(currentChanged(const QModelIndex&, const QModelIndex&)),
+            SLOT(jumpToResult(const QModelIndex&)));
+
+    _resultDock = new QDockWidget("Search Results", this);
+    _resultDock->setObjectName("searchResults");
+    _resultDock->setWidget(_resultList);
+    _resultDock->hide();
+    addDockWidget(Qt::RightDockWidgetArea, _resultDock);
 }
 
 void AWindow::showHotspots(bool shown)
@@ -857,6 +1262,12 @@ static void setupBackground(QGraphicsScene* scene, const QSize& size,
 
 bool AWindow::openFile(const QString& file)
 {
+    waitForSave();
+    if (offerRecovery(file)) {
+        updateWatch();
+        return true;
+    }
+
     newProject();
 
     // Reset lock/hide to match the default state of newly loaded items.
@@ -864,9 +1275,16 @@ bool AWindow::openFile(const QString& file)
     _actLockRegions->setChecked(false);
     _actLockImages->setChecked(false);
 
+    if (_actPixelCache->isChecked())
+        _pixelCache.open(PixelCache::pathFor(file));
+
     int line;
     if (loadProject(file, &line)) {
         updateProjectName(file);
+        _journal.setTarget(file);
+        _savedChanges = _journal.changes();
+        updatePixelCache(file);
+        updateWatch();
         if (! _docSize.isEmpty())
             setupBackground(_scene, _docSize, QBrush(_bgPix));
         return true;
@@ -898,6 +1316,9 @@ void AWindow::open()
 
 void AWindow::openRecent()
 {
+    if (_ioProc)
+        return;     // Project is read-only.
+
     QString fn = _recent.fileOpened(sender());
     if (! fn.isEmpty())
         openFile(fn);
@@ -911,14 +1332,10 @@ static void saveFailed(QWidget* parent, const QString& fn) {
 
 void AWindow::save()
 {
-    if (_prevProjPath.isEmpty()) {
+    if (_prevProjPath.isEmpty())
         saveAs();
-    } else {
-        if (saveProject(_prevProjPath))
-            _recent.addFile(&_prevProjPath);
-        else
-            saveFailed(this, _prevProjPath);
-    }
+    else
+        startSave(_prevProjPath, false);
 }
 
 
@@ -927,23 +1344,99 @@ void AWindow::saveAs()
     QString fn;
 
     fn = QFileDialog::getSaveFileName(this, "Save Project As", _prevProjPath);
-    if (! fn.isEmpty()) {
-        if (saveProject(fn)) {
-            updateProjectName(fn);
-            _recent.addFile(&fn);
-        } else
-            saveFailed(this, fn);
+    if (! fn.isEmpty())
+        startSave(fn, true);
+}
+
+/*
+ * Writes a copy of the project on a worker thread.
+ */
+class SaveThread : public QThread
+{
+public:
+    AtlasModel model;
+    QString path;
+    bool saveAs;
+    bool ok;
+    int64_t startTime;      // Profiler::now()
+    uint32_t changes;       // Journal::changes() when model was captured.
+
+protected:
+    void run() { ok = model.save(UTF8(path)); }
+};
+
+/*
+ * Begin saving the project.  The scene is copied to a model which is written
+ * in the background so that editing can continue.
+ */
+void AWindow::startSave(const QString& path, bool saveAs)
+{
+    waitForSave();      // Saves must replace the file in order.
+
+    SaveThread* st = new SaveThread;
+    {
+    PROFILE(prof, "Save");
+    PROFILE(capture, "Capture");
+    captureModel(st->model);
+    }
+    st->path = path;
+    st->saveAs = saveAs;
+    st->ok = false;
+    st->startTime = Profiler::instance().now();
+    st->changes = _journal.changes();
+    connect(st, SIGNAL(finished()), SLOT(saveFinished()));
+
+    _saveThread = st;
+    statusBar()->showMessage(QString("Saving ") + path);
+    st->start();
+}
+
+/*
+ * Block until any background save is done.
+ */
+void AWindow::waitForSave()
+{
+    if (_saveThread) {
+        _saveThread->wait();
+        saveFinished();
     }
 }
 
+void AWindow::saveFinished()
+{
+    SaveThread* st = _saveThread;
+    if (! st || ! st->isFinished())
+        return;     // Already handled by waitForSave().
+    _saveThread = NULL;
+
+    Profiler::instance().record("Save Write", st->startTime,
+                    st->model.imageCount() + st->model.regionCount(),
+                    QFileInfo(st->path).size());
+
+    if (st->ok) {
+        if (st->saveAs)
+            updateProjectName(st->path);
+        _journal.setTarget(st->path);
+        _savedChanges = st->changes;
+        if (_journal.changes() != st->changes)
+            _journal.touch();   // Keep edits made during the save.
+        updatePixelCache(st->path);
+        _recent.addFile(&st->path);
+        statusBar()->showMessage(QString("Saved ") + st->path, 3000);
+    } else
+        saveFailed(this, st->path);
+
+    delete st;
+}
+
 QGraphicsPixmapItem* AWindow::importImage(const QString& file)
 {
-    QPixmap pix(file);
+    QPixmap pix = QPixmap::fromImage(ImageCache::instance().load(file));
     if (pix.isNull())
         return NULL;
 
-    QGraphicsPixmapItem* item = makeImage(pix, 0, 0);
-    item->setData(ID_NAME, file);
+    QGraphicsPixmapItem* item = makeImage(pix, 0, 0, file);
+    setItemName(item, file);
     return item;
 }
 
@@ -952,12 +1445,20 @@ bool AWindow::directoryImport(const QString& path)
     QDir dir(path);
     dir.setNameFilters(imageFilters());
     const QStringList list = dir.entryList();
+    QSet<QString> listing;
     bool ok = true;
 
     for (const QString& s: list) {
+        listing.insert(s);
         if (! importImage(dir.filePath(s)))
             ok = false;
     }
+
+    QString apath(dir.absolutePath());
+    if (! _watchDirs.contains(apath))
+        _watchDirs << apath;
+    _watchListing[apath] = listing;
+    updateWatch();
     return ok;
 }
 
@@ -975,37 +1476,54 @@ void AWindow::importDir()
 
 bool AWindow::exportAtlasImage(const QString& path, int w, int h)
 {
+    PROFILE(prof, "Export");
     QPixmap newPix(w, h);
     QPainter ip;
 
+    {
+    PROFILE(comp, "Composite");
     newPix.fill(QColor(0,0,0,0));
     ip.begin(&newPix);
-    each_item(gi) {
+    each_item_mod(gi) {
         if (IS_IMAGE(gi)) {
+            comp.addItems(1);
+            // Evicted images are dropped again after drawing so that
+            // exporting does not load the whole project into memory.
+            ResidentImage* img = static_cast<ResidentImage*>(gi);
+            bool resident = img->isResident();
             QPointF pos = gi->pos();
-            ip.drawPixmap(pos.x(), pos.y(), ITEM_PIXMAP(gi));
+            ip.drawPixmap(pos.x(), pos.y(), img->pixels());
+            if (! resident)
+                img->evict();
         }
     }
     ip.end();
+    comp.addBytes(qint64(w) * h * 4);
+    }
 
-    if (! newPix.save(path)) {
+    bool saved;
+    {
+    PROFILE(enc, "Encode");
+    saved = newPix.save(path);
+    }
+    if (! saved) {
         QString error("Could not save image to file ");
         QMessageBox::critical(this, "Export Image", error + path);
         return false;
     }
 
+    prof.addBytes(QFileInfo(path).size());
     return true;
 }
 
-void AWindow::exportImage()
+/*
+ * Get the size of the exported image.  Return false if there are no items.
+ */
+bool AWindow::exportSize(int& w, int& h) const
 {
-    int w, h;
     QRectF rect = _scene->itemsBoundingRect();
-    if (rect.isEmpty()) {
-        QMessageBox::warning(this, "Export Image",
-                         "No Images found; nothing to export.");
-        return;
-    }
+    if (rect.isEmpty())
+        return false;
 
     if (_docSize.isEmpty()) {
         w = rect.width() - 1;
@@ -1014,12 +1532,24 @@ void AWindow::exportImage()
         w = _docSize.width();
         h = _docSize.height();
     }
+    return true;
+}
+
+void AWindow::exportImage()
+{
+    int w, h;
+    if (! exportSize(w, h)) {
+        QMessageBox::warning(this, "Export Image",
+                         "No Images found; nothing to export.");
+        return;
+    }
 
     QString fn = QFileDialog::getSaveFileName(this, "Export Atlas Image",
                                               _prevImagePath);
     if (! fn.isEmpty()) {
         _prevImagePath = fn;
-        exportAtlasImage(fn, w, h);
+        if (exportAtlasImage(fn, w, h))
+            _watchExport = fn;
     }
 }
 
@@ -1043,6 +1573,7 @@ void AWindow::mergeImages()
     if (file.isEmpty())
         return;
     _prevImagePath = file;
+    requireRegionItems();
 
 #if 1
     QList<QGraphicsItem *> list = _scene->items(Qt::AscendingOrder);
@@ -1059,8 +1590,9 @@ void AWindow::mergeImages()
     QGraphicsItem* gi;
     QGraphicsPixmapItem* pitem;
 
+    beginBulk();
     pitem = makeImage(QPixmap(), 0, 0);
-    pitem->setData(ID_NAME, file);
+    setItemName(pitem, file);
 
     newPix.fill(QColor(0,0,0,0));
     ip.begin(&newPix);
@@ -1084,6 +1616,7 @@ void AWindow::mergeImages()
     pitem->setPixmap(newPix);
 
     removeItems(removeList.constData(), removeList.size());
+    endBulk("Merge");
 
     if (! newPix.save(file)) {
         QString error("Could not save image to file ");
@@ -1103,6 +1636,7 @@ void AWindow::convertToImage()
     if (dir.back() != '/')
         dir.append('/');
 
+    requireRegionItems();
     ItemList list = _scene->selectedItems();
     if (list.empty())
         list = _scene->items(Qt::AscendingOrder);
@@ -1137,11 +1671,13 @@ void AWindow::convertToImage()
 
                 if (newPix.save(file)) {
                     // Replace region with new image.
+                    _names.removeTree(gi);
                     _scene->removeItem(gi);
                     delete gi;
+                    _journal.touch();
 
-                    pitem = makeImage(newPix, val.x, val.y);
-                    pitem->setData(ID_NAME, file);
+                    pitem = makeImage(newPix, val.x, val.y, file);
+                    setItemName(pitem, file);
                 } else {
                     QString error("Could not save image to file ");
                     QMessageBox::critical(this, "Convert Region", error + file);
@@ -1152,85 +1688,6 @@ void AWindow::convertToImage()
     }
 }
 
-static int testRowAlpha(QImage& img, int y, int w) {
-    QRgb rgb;
-    int x;
-    for (x = 0; x < w; ++x) {
-        rgb = img.pixel(x, y);
-        if (qAlpha(rgb) != 0)
-            return x;
-    }
-    return x;
-}
-
-static int testRowAlphaEnd(QImage& img, int y, int w) {
-    QRgb rgb;
-    int x;
-    for (x = w - 1; x > 0; --x) {
-        rgb = img.pixel(x, y);
-        if (qAlpha(rgb) != 0)
-            return x;
-    }
-    return x;
-}
-
-static bool cropAlpha(QImage& img, QRect& rect)
-{
-    if (! img.hasAlphaChannel() || img.isNull())
-        return false;
-
-    int x = 0;
-    int y, r;
-    int lx, hx;
-    int w = img.width();
-    int h = img.height();
-
-    for (y = 0; y < h; ++y) {
-        x = testRowAlpha(img, y, w);
-        if (x < w)
-            break;
-    }
-    if (y == h)
-        return false;   // Completely empty.
-    lx = x;
-
-    for (--h; h > y; --h) {
-        x = testRowAlpha(img, h, w);
-        if (x < w)
-            break;
-    }
-    if (y == 0 && h == (img.height() - 1))
-        return false;
-    if (x < lx)
-        lx = x;
-
-    // Find minimum X.
-    if (lx > 0) {
-        for (r = y+1; r < h; ++r) {
-            x = testRowAlpha(img, r, w);
-            if (x < lx) {
-                lx = x;
-                if (lx == 0)
-                    break;
-            }
-        }
-    }
-
-    // Find maximum X.
-    hx = 0;
-    for (r = y; r <= h; ++r) {
-        x = testRowAlphaEnd(img, r, w);
-        if (x > hx) {
-            hx = x;
-            if (hx == w-1)
-                break;
-        }
-    }
-
-    rect.setCoords(lx, y, hx, h);
-    return true;
-}
-
 static void translateChildren(QGraphicsItem* item, QPointF& delta)
 {
     ItemList list = item->childItems();
@@ -1257,6 +1714,7 @@ void AWindow::cropImages()
         list = _scene->items(Qt::AscendingOrder);
 
     {
+    PROFILE(prof, "Crop");
     QPainter ip;
     QString file;
     ItemValues val;
@@ -1267,9 +1725,17 @@ void AWindow::cropImages()
         gi = list.at(i);
         if(IS_IMAGE(gi)) {
             itemValues(val, gi);
-
-            QImage img = ITEM_PIXMAP(gi).toImage();
-            if (cropAlpha(img, rect)) {
+            prof.addItems(1);
+
+            bool crop;
+            QImage img;
+            {
+            PROFILE(scan, "Scan Alpha");
+            img = ITEM_PIXMAP(gi).toImage();
+            crop = cropAlpha(img, rect);
+            scan.addBytes(qint64(img.bytesPerLine()) * img.height());
+            }
+            if (crop) {
                 QPixmap newPix(rect.width(), rect.height());
                 newPix.fill(QColor(0,0,0,0));
                 ip.begin(&newPix);
@@ -1280,13 +1746,19 @@ void AWindow::cropImages()
                 file = dir;
                 file.append(info.fileName());
 
-                if (newPix.save(file)) {
+                bool saved;
+                {
+                PROFILE(enc, "Encode");
+                saved = newPix.save(file);
+                }
+                if (saved) {
                     // Replace pixmap and move to cropped pos.
-                    static_cast<QGraphicsPixmapItem*>(gi)->setPixmap(newPix);
+                    static_cast<ResidentImage*>(gi)->setPixels(newPix, file);
                     QPointF delta(rect.x(), rect.y());
                     gi->setPos(gi->pos() + delta);
-                    gi->setData(ID_NAME, file);
+                    setItemName(gi, file);
                     translateChildren(gi, delta);
+                    _journal.touch();
 
                     syncSelection();    // Update information in toolbar.
                 } else {
@@ -1299,29 +1771,291 @@ void AWindow::cropImages()
     }
 }
 
-void AWindow::removeItems(QGraphicsItem* const* list, int count)
+// Return the name prefix of regions generated for an image.
+static QString slicePrefix(const QGraphicsItem* image)
 {
-    QGraphicsItem* item;
-    for (int i = 0; i < count; ++i) {
-        item = list[i];
-        _scene->removeItem(item);
-        delete item;
+    QString base = QFileInfo(image->data(ID_NAME).toString()).baseName();
+    base.append('_');
+    return base;
+}
+
+/*
+ * Record the regions made around the sprites of an image as UNDO_SLICE
+ * steps, split into as many steps as needed to fit UNDO_VAL_LIMIT.
+ */
+static void recordSlice(AUndoSystem& undo, uint32_t imageSerial,
+                        uint32_t firstSerial, const std::vector<QRect>& rects)
+{
+    UndoValue vals[UNDO_VAL_LIMIT];
+    vals[SU_IMAGE].u = imageSerial;
+
+    size_t i = 0;
+    size_t end = rects.size();
+    while (i < end) {
+        vals[SU_SERIAL].u = firstSerial + uint32_t(i);
+        vals[SU_INDEX].u  = uint32_t(i);
+        int n = SU_RECTS;
+        for (; i < end && n + 2 <= UNDO_VAL_LIMIT; ++i) {
+            const QRect& rc = rects[i];
+            vals[n].h[0] = uint16_t(rc.x());
+            vals[n].h[1] = uint16_t(rc.y());
+            ++n;
+            vals[n].h[0] = uint16_t(rc.width());
+            vals[n].h[1] = uint16_t(rc.height());
+            ++n;
+        }
+        undo.recordStep(UNDO_SLICE, vals, n);
     }
 }
 
-void AWindow::addImage()
+/*
+ * Create a region around each separate sprite (group of connected opaque
+ * pixels) of the selected images, or of all images if none are selected.
+ * The regions of all the images are removed by a single undo.
+ */
+void AWindow::autoSlice()
 {
-    QString fn;
-
-    fn = QFileDialog::getOpenFileName(this, "Add Image", _prevImagePath);
+    int threshold, merge;
+    {
+    SliceDialog dlg(SLICE_SPRITES, this);
+    if (dlg.exec() != QDialog::Accepted)
+        return;
+    threshold = dlg.threshold();
+    merge = dlg.mergeDistance();
+    }
+
+    requireRegionItems();
+    ItemList list = _scene->selectedItems();
+    if (list.empty())
+        list = _scene->items(Qt::AscendingOrder);
+
+    PROFILE(prof, "Auto Slice");
+    std::vector<QRect> blobs;
+    QGraphicsItem* gi;
+    int total = 0;
+
+    beginBulk();
+    _undo.beginGroup();
+    for (int i = 0; i < list.size(); ++i) {
+        gi = list.at(i);
+        if (! IS_IMAGE(gi))
+            continue;
+        QSize size = ITEM_PIXMAP(gi).size();
+        if (size.width() > UINT16_MAX || size.height() > UINT16_MAX)
+            continue;
+
+        {
+        PROFILE(scan, "Find Sprites");
+        QImage img = ITEM_PIXMAP(gi).toImage();
+        findBlobs(img, threshold, merge, blobs);
+        scan.addBytes(qint64(img.bytesPerLine()) * img.height());
+        }
+        prof.addItems(int64_t(blobs.size()));
+
+        uint32_t first = makeRegions(gi, blobs.data(), NULL,
+                                     int(blobs.size()), slicePrefix(gi));
+        recordSlice(_undo, gi->data(ID_SERIAL).toUInt(), first, blobs);
+        total += int(blobs.size());
+    }
+    _undo.endGroup();
+    endBulk("Auto Slice");
+
+    statusBar()->showMessage(QString("Auto Slice created %1 regions")
+                             .arg(total), 5000);
+}
+
+/*
+ * Append the ids of the cells of an image which have any alpha above skip,
+ * or of all the cells if skip is negative.
+ */
+static void gridCells(QGraphicsItem* image, const CellGrid& grid, int skip,
+                      std::vector<int>& ids)
+{
+    std::vector<uint8_t> occupied;
+    if (skip >= 0) {
+        PROFILE(scan, "Scan Cells");
+        QImage img = ITEM_PIXMAP(image).toImage();
+        markOccupiedCells(img, grid, skip, occupied);
+        scan.addBytes(qint64(img.bytesPerLine()) * img.height());
+    }
+
+    int cells = grid.cols * grid.rows;
+    for (int id = 0; id < cells; ++id) {
+        if (occupied.empty() || occupied[id])
+            ids.push_back(id);
+    }
+}
+
+static void cellRects(const CellGrid& grid, const std::vector<int>& ids,
+                      std::vector<QRect>& rects)
+{
+    rects.clear();
+    rects.reserve(ids.size());
+    for (int id : ids)
+        rects.push_back(grid.cell(id % grid.cols, id / grid.cols));
+}
+
+/*
+ * Record the regions made for the cells of an image as UNDO_GRID steps.
+ * The cell ids are stored as runs of consecutive cells, split into as many
+ * steps as needed to fit UNDO_VAL_LIMIT.
+ */
+static void recordGrid(AUndoSystem& undo, uint32_t imageSerial,
+                       uint32_t firstSerial, const CellGrid& grid,
+                       const std::vector<int>& ids)
+{
+    UndoValue vals[UNDO_VAL_LIMIT];
+    vals[GU_IMAGE].u = imageSerial;
+    vals[GU_CELL].s[0]  = int16_t(grid.cellW);
+    vals[GU_CELL].s[1]  = int16_t(grid.cellH);
+    vals[GU_SPACE].s[0] = int16_t(grid.spacing);
+    vals[GU_SPACE].s[1] = int16_t(grid.margin);
+    vals[GU_DIM].h[0]   = uint16_t(grid.cols);
+    vals[GU_DIM].h[1]   = uint16_t(grid.rows);
+
+    size_t i = 0;
+    size_t end = ids.size();
+    while (i < end) {
+        int n = GU_RUNS;
+        uint32_t count = 0;
+        while (i < end && n + 2 <= UNDO_VAL_LIMIT) {
+            size_t run = i + 1;
+            while (run < end && ids[run] == ids[run - 1] + 1)
+                ++run;
+            vals[n++].u = uint32_t(ids[i]);
+            vals[n++].u = uint32_t(run - i);
+            count += uint32_t(run - i);
+            i = run;
+        }
+        vals[GU_SERIAL].u = firstSerial;
+        vals[GU_COUNT].u  = count;
+        undo.recordStep(UNDO_GRID, vals, n);
+        firstSerial += count;
+    }
+}
+
+/*
+ * Create a region for each cell of a uniform grid on the selected images,
+ * or on all images if none are selected.  The regions of all the images are
+ * recorded as joined steps so that a single undo removes them.
+ */
+void AWindow::gridSlice()
+{
+    CellGrid base;
+    int skip;
+    {
+    SliceDialog dlg(SLICE_GRID, this);
+    if (dlg.exec() != QDialog::Accepted)
+        return;
+    dlg.grid(base);
+    skip = dlg.skipEmpty() ? dlg.threshold() : -1;
+    }
+
+    requireRegionItems();
+    ItemList list = _scene->selectedItems();
+    if (list.empty())
+        list = _scene->items(Qt::AscendingOrder);
+
+    PROFILE(prof, "Grid Slice");
+    std::vector<QRect> rects;
+    std::vector<int> ids;
+    QGraphicsItem* gi;
+    int total = 0;
+
+    beginBulk();
+    _undo.beginGroup();
+    for (int i = 0; i < list.size(); ++i) {
+        gi = list.at(i);
+        if (! IS_IMAGE(gi))
+            continue;
+
+        QSize size = ITEM_PIXMAP(gi).size();
+        CellGrid grid = base;
+        grid.fit(size.width(), size.height());
+        if (grid.cols < 1 || grid.rows < 1 ||
+            grid.cellW > INT16_MAX || grid.cellH > INT16_MAX ||
+            grid.cols > UINT16_MAX || grid.rows > UINT16_MAX)
+            continue;
+
+        ids.clear();
+        gridCells(gi, grid, skip, ids);
+        if (ids.empty())
+            continue;
+        int count = int(ids.size());
+        prof.addItems(count);
+        total += count;
+
+        cellRects(grid, ids, rects);
+        uint32_t first = makeRegions(gi, rects.data(), ids.data(), count,
+                                     slicePrefix(gi));
+        recordGrid(_undo, gi->data(ID_SERIAL).toUInt(), first, grid, ids);
+    }
+    _undo.endGroup();
+    endBulk("Grid Slice");
+
+    statusBar()->showMessage(QString("Grid Slice created %1 regions")
+                             .arg(total), 5000);
+}
+
+/*
+ * Begin changes to many items.  The scene index and signals are suspended
+ * until the matching endBulk() call so that each item change does not
+ * update the BSP tree or the toolbar.  Calls may be nested.
+ */
+void AWindow::beginBulk()
+{
+    if (_bulkDepth++ == 0) {
+        _bulkTime.start();
+        _scene->blockSignals(true);
+        _scene->setItemIndexMethod(QGraphicsScene::NoIndex);
+    }
+}
+
+/*
+ * End bulk changes, rebuild the scene index, & report the time taken in the
+ * status bar.
+ */
+void AWindow::endBulk(const char* label)
+{
+    if (--_bulkDepth == 0) {
+        _scene->setItemIndexMethod(QGraphicsScene::BspTreeIndex);
+        _scene->blockSignals(false);
+        syncSelection();
+        sceneChange();
+
+        QString msg(label);
+        msg += QString(" took %1 ms").arg(_bulkTime.elapsed());
+        statusBar()->showMessage(msg, 5000);
+    }
+}
+
+void AWindow::removeItems(QGraphicsItem* const* list, int count)
+{
+    QGraphicsItem* item;
+    for (int i = 0; i < count; ++i) {
+        item = list[i];
+        _names.removeTree(item);
+        _scene->removeItem(item);
+        delete item;
+    }
+    _journal.touch();
+}
+
+void AWindow::addImage()
+{
+    QString fn;
+
+    fn = QFileDialog::getOpenFileName(this, "Add Image", _prevImagePath);
     if( ! fn.isEmpty() ) {
         _prevImagePath = fn;
         importImage(fn);
+        updateWatch();
     }
 }
 
 void AWindow::addRegion()
 {
+    requireRegionItems();
     ItemList sel = _scene->selectedItems();
     if (! sel.empty()) {
         QGraphicsItem* item = sel[0];
@@ -1329,7 +2063,7 @@ void AWindow::addRegion()
             item = item->parentItem();
         if (item) {
             QGraphicsItem* child = makeRegion(item, 0, 0, 32, 32, 0, 0);
-            child->setData(ID_NAME, QString("<unnamed>"));
+            setItemName(child, QString("<unnamed>"));
         }
     }
 }
@@ -1341,8 +2075,10 @@ void AWindow::removeSelected()
 
     ItemList sel = _scene->selectedItems();
     if (sel.size() == 1) {
+        _names.removeTree(sel[0]);
         _scene->removeItem(sel[0]);
         delete sel[0];
+        _journal.touch();
     } else {
         QVector<QGraphicsItem*> regList;
         QVector<QGraphicsItem*> imgList;
@@ -1370,101 +2106,325 @@ void AWindow::removeSelected()
 void AWindow::undoClear()
 {
     undo_clear(&_undo.stack);
+    qDeleteAll(_parked);
+    _parked.clear();
     _actUndo->setEnabled(false);
     _actRedo->setEnabled(false);
 }
 
+/*
+ * Apply an undo step to a region held in a RegionLayer.
+ * Return false if no layer holds the serial number.
+ */
+typedef std::vector<RegionLayer*> LayerList;
+
+static bool undoLayerRegion(const LayerList& layers, uint32_t serial,
+                            const UndoValue* dpos, const UndoValue* ddim,
+                            bool redo)
+{
+    int sign = redo ? 1 : -1;
+    for (RegionLayer* layer : layers) {
+        int i = layer->find(serial);
+        if (i >= 0) {
+            layer->adjustRegion(i, sign * dpos->s[0], sign * dpos->s[1],
+                                ddim ? sign * ddim->s[0] : 0,
+                                ddim ? sign * ddim->s[1] : 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Map serial numbers to items for a single pass over the undo values.
+// The RegionLayers are added to layers, if non-NULL.
+static void serialMap(const ItemList& list,
+                      QHash<uint32_t, QGraphicsItem*>& map,
+                      LayerList* layers = NULL)
+{
+    map.reserve(list.size());
+    for (auto it : list) {
+        if (! IS_LAYER(it))
+            map.insert(it->data(ID_SERIAL).toUInt(), it);
+        else if (layers)
+            layers->push_back(static_cast<RegionLayer*>(it));
+    }
+}
+
 static void undoPosition(QGraphicsScene* scene, const UndoValue* step,
                          const UndoValue* end, bool redo)
 {
-    QList<QGraphicsItem *> list = scene->items();
+    QHash<uint32_t, QGraphicsItem*> map;
+    LayerList layers;
+    serialMap(scene->items(), map, &layers);
 
     for (; step != end; step += 2) {
-        // Slog through all items to find serial number.
-        for (auto it : list) {
-            if (it->data(ID_SERIAL).toUInt() == step->u) {
-                QPointF pos = it->pos();
-                QPointF delta(float(step[1].s[0]),
-                              float(step[1].s[1]));
-                //printf( "KR # %d %f,%f\n", step->u, delta.x(), delta.y());
-                if (redo)
-                    pos += delta;
-                else
-                    pos -= delta;
-                it->setPos(pos);
-                break;
-            }
-        }
+        QGraphicsItem* it = map.value(step->u);
+        if (it) {
+            QPointF pos = it->pos();
+            QPointF delta(float(step[1].s[0]),
+                          float(step[1].s[1]));
+            //printf( "KR # %d %f,%f\n", step->u, delta.x(), delta.y());
+            if (redo)
+                pos += delta;
+            else
+                pos -= delta;
+            it->setPos(pos);
+        } else
+            undoLayerRegion(layers, step->u, step + 1, NULL, redo);
     }
 }
 
 static void undoRect(QGraphicsScene* scene, const UndoValue* step,
                      const UndoValue* end, bool redo)
 {
-    QList<QGraphicsItem *> list = scene->items();
+    QHash<uint32_t, QGraphicsItem*> map;
+    LayerList layers;
+    serialMap(scene->items(), map, &layers);
 
     for (; step != end; step += 3) {
-        for (auto it : list) {
-            if (it->data(ID_SERIAL).toUInt() == step->u) {
-                QPointF dpos(float(step[1].s[0]), float(step[1].s[1]));
-                QPointF ddim(float(step[2].s[0]), float(step[2].s[1]));
-                if (! redo) {
-                    dpos *= -1.0f;
-                    ddim *= -1.0f;
-                }
-
-                ARegion* region = static_cast<ARegion*>(it);
-                QPointF pos = region->pos();
-                QRectF rect = region->rect();
-                region->setPos(pos + dpos);
-                region->setRect(0.0f, 0.0f, rect.width() + ddim.x(),
-                                            rect.height() + ddim.y());
-                break;
+        QGraphicsItem* it = map.value(step->u);
+        if (it) {
+            QPointF dpos(float(step[1].s[0]), float(step[1].s[1]));
+            QPointF ddim(float(step[2].s[0]), float(step[2].s[1]));
+            if (! redo) {
+                dpos *= -1.0f;
+                ddim *= -1.0f;
             }
+
+            ARegion* region = static_cast<ARegion*>(it);
+            QPointF pos = region->pos();
+            QRectF rect = region->rect();
+            region->setPos(pos + dpos);
+            region->setRect(0.0f, 0.0f, rect.width() + ddim.x(),
+                                        rect.height() + ddim.y());
+        } else
+            undoLayerRegion(layers, step->u, step + 1, step + 2, redo);
+    }
+}
+
+/*
+ * Remove (undo) or recreate (redo) the regions made by gridSlice() for one
+ * image.  The regions get back their serial numbers so that later steps
+ * which move them still apply.  Redo makes exactly the recorded cells.
+ */
+void AWindow::undoGrid(const UndoValue* it, const UndoValue* end, bool redo)
+{
+    if (end - it < GU_RUNS)
+        return;
+
+    QHash<uint32_t, QGraphicsItem*> map;
+    requireRegionItems();
+    serialMap(_scene->items(), map);
+
+    QGraphicsItem* image = map.value(it[GU_IMAGE].u);
+    if (! image || ! IS_IMAGE(image))
+        return;
+
+    uint32_t first = it[GU_SERIAL].u;
+    uint32_t count = it[GU_COUNT].u;
+
+    beginBulk();
+    if (redo) {
+        CellGrid grid;
+        grid.cellW   = it[GU_CELL].s[0];
+        grid.cellH   = it[GU_CELL].s[1];
+        grid.spacing = it[GU_SPACE].s[0];
+        grid.margin  = it[GU_SPACE].s[1];
+        grid.cols    = it[GU_DIM].h[0];
+        grid.rows    = it[GU_DIM].h[1];
+
+        std::vector<int> ids;
+        ids.reserve(count);
+        for (it += GU_RUNS; end - it >= 2; it += 2) {
+            int id = int(it[0].u);
+            int idEnd = id + int(it[1].u);
+            for (; id < idEnd; ++id)
+                ids.push_back(id);
+        }
+
+        std::vector<QRect> rects;
+        cellRects(grid, ids, rects);
+        makeRegions(image, rects.data(), ids.data(), int(ids.size()),
+                    slicePrefix(image), first);
+    } else {
+        QVector<QGraphicsItem*> removeList;
+        for (QGraphicsItem* ch : image->childItems()) {
+            uint32_t serial = ch->data(ID_SERIAL).toUInt();
+            if (IS_REGION(ch) && serial - first < count)
+                removeList.push_back(ch);
         }
+        removeItems(removeList.constData(), removeList.size());
     }
+    endBulk(redo ? "Redo" : "Undo");
 }
 
-void AWindow::undo()
+/*
+ * Remove (undo) or recreate (redo) the regions made by autoSlice() for one
+ * image.
+ */
+void AWindow::undoSlice(const UndoValue* it, const UndoValue* end, bool redo)
 {
-    const UndoValue* step;
-    int adv = undo_stepBack(&_undo.stack, &step);
-    if (adv & Undo_AdvancedToEnd)
-        _actUndo->setEnabled(false);
-    if (adv & Undo_AdvancedFromStart)
-        _actRedo->setEnabled(true);
-    if (! adv)
+    if (end - it < SU_RECTS)
+        return;
+
+    QHash<uint32_t, QGraphicsItem*> map;
+    requireRegionItems();
+    serialMap(_scene->items(), map);
+
+    QGraphicsItem* image = map.value(it[SU_IMAGE].u);
+    if (! image || ! IS_IMAGE(image))
         return;
 
-    switch (step->op.code) {
+    uint32_t first = it[SU_SERIAL].u;
+    uint32_t count = uint32_t(end - it - SU_RECTS) / 2;
+
+    beginBulk();
+    if (redo) {
+        std::vector<QRect> rects;
+        std::vector<int> ids;
+        rects.reserve(count);
+        ids.reserve(count);
+        int index = int(it[SU_INDEX].u);
+        for (it += SU_RECTS; end - it >= 2; it += 2) {
+            rects.push_back(QRect(it[0].h[0], it[0].h[1],
+                                  it[1].h[0], it[1].h[1]));
+            ids.push_back(index++);
+        }
+        makeRegions(image, rects.data(), ids.data(), int(rects.size()),
+                    slicePrefix(image), first);
+    } else {
+        QVector<QGraphicsItem*> removeList;
+        for (QGraphicsItem* ch : image->childItems()) {
+            uint32_t serial = ch->data(ID_SERIAL).toUInt();
+            if (IS_REGION(ch) && serial - first < count)
+                removeList.push_back(ch);
+        }
+        removeItems(removeList.constData(), removeList.size());
+    }
+    endBulk(redo ? "Redo" : "Undo");
+}
+
+/*
+ * Take an image (with its regions) out of the scene but keep it so that an
+ * UNDO_REMOVE step can put it back.  Parked items are deleted by
+ * undoClear().
+ */
+void AWindow::parkItem(QGraphicsItem* gi)
+{
+    _names.removeTree(gi);
+    _scene->removeItem(gi);
+    _parked.insert(gi->data(ID_SERIAL).toUInt(), gi);
+    _journal.touch();
+}
+
+/*
+ * Put back (undo) or remove again (redo) the images of an UNDO_REMOVE
+ * step.
+ */
+void AWindow::undoRemove(const UndoValue* it, const UndoValue* end,
+                         bool redo)
+{
+    QHash<uint32_t, QGraphicsItem*> map;
+    if (redo)
+        serialMap(_scene->items(), map);
+
+    beginBulk();
+    for (; it != end; ++it) {
+        QGraphicsItem* gi;
+        if (redo) {
+            gi = map.value(it->u);
+            if (gi && IS_IMAGE(gi))
+                parkItem(gi);
+        } else {
+            gi = _parked.take(it->u);
+            if (gi) {
+                _scene->addItem(gi);
+                _names.insertTree(gi);
+                _journal.touch();
+            }
+        }
+    }
+    endBulk(redo ? "Redo" : "Undo");
+}
+
+void AWindow::applyUndoStep(const UndoValue* step, bool redo)
+{
+    switch (step->op.code & ~UNDO_JOIN) {
         case UNDO_POS:
-            undoPosition(_scene, step + 1, step + step->op.skipNext, false);
+            undoPosition(_scene, step + 1, step + step->op.skipNext, redo);
             break;
         case UNDO_RECT:
-            undoRect(_scene, step + 1, step + step->op.skipNext, false);
+            undoRect(_scene, step + 1, step + step->op.skipNext, redo);
+            break;
+        case UNDO_GRID:
+            undoGrid(step + 1, step + step->op.skipNext, redo);
+            break;
+        case UNDO_REMOVE:
+            undoRemove(step + 1, step + step->op.skipNext, redo);
+            break;
+        case UNDO_SLICE:
+            undoSlice(step + 1, step + step->op.skipNext, redo);
             break;
     }
 }
 
-void AWindow::redo()
+/*
+ * Undo the last step, along with the steps joined to it.
+ */
+void AWindow::undo()
 {
+    UndoStack& us = _undo.stack;
     const UndoValue* step;
-    int adv = undo_stepForward(&_undo.stack, &step);
-    if (adv & Undo_AdvancedToEnd)
-        _actRedo->setEnabled(false);
-    if (adv & Undo_AdvancedFromStart)
-        _actUndo->setEnabled(true);
-    if (! adv)
-        return;
+    bool bulk = false;
 
-    switch (step->op.code) {
-        case UNDO_POS:
-            undoPosition(_scene, step + 1, step + step->op.skipNext, true);
+    if (! undo_stepBack(&us, &step))
+        return;
+    for (;;) {
+        if (! bulk && (step->op.skipNext > BULK_UNDO_VALUES ||
+                       (step->op.code & UNDO_JOIN))) {
+            bulk = true;
+            beginBulk();
+        }
+        applyUndoStep(step, false);
+        if (! (step->op.code & UNDO_JOIN) || ! undo_stepBack(&us, &step))
             break;
-        case UNDO_RECT:
-            undoRect(_scene, step + 1, step + step->op.skipNext, true);
+    }
+    if (bulk)
+        endBulk("Undo");
+
+    _actUndo->setEnabled(us.pos > 0);
+    _actRedo->setEnabled(true);
+    _journal.mark(JREC_UNDO);
+}
+
+/*
+ * Redo the next step, along with the steps joined to it.
+ */
+void AWindow::redo()
+{
+    UndoStack& us = _undo.stack;
+    const UndoValue* step;
+    bool bulk = false;
+
+    if (! undo_stepForward(&us, &step))
+        return;
+    for (;;) {
+        bool joined = us.pos < us.used &&
+                      (us.stack[us.pos].op.code & UNDO_JOIN);
+        if (! bulk && (step->op.skipNext > BULK_UNDO_VALUES || joined)) {
+            bulk = true;
+            beginBulk();
+        }
+        applyUndoStep(step, true);
+        if (! joined || ! undo_stepForward(&us, &step))
             break;
     }
+    if (bulk)
+        endBulk("Redo");
+
+    _actUndo->setEnabled(true);
+    _actRedo->setEnabled(us.pos < us.used);
+    _journal.mark(JREC_REDO);
 }
 
 // Set QSpinBox value without emitting the valueChanged() signal.
@@ -1496,6 +2456,7 @@ void AWindow::updateHotspot(int x, int y)
 {
     assignSpin(_spinHotX, x);
     assignSpin(_spinHotY, y);
+    _journal.touch();
 }
 
 void AWindow::syncSelection()
@@ -1543,8 +2504,10 @@ void AWindow::modName()
     if (_modifiedStr == _name) {
         _modifiedStr = NULL;
 
-        if (_selItem)
-            _selItem->setData(ID_NAME, _name->text());
+        if (_selItem) {
+            setItemName(_selItem, _name->text());
+            _journal.touch();
+        }
     }
 }
 
@@ -1556,45 +2519,74 @@ static void highlightItem(QGraphicsItem* item, bool on)
     }
 }
 
+// Move the search highlight to the item of a NameIndex entry, or remove it
+// if id is negative.
+void AWindow::highlightHit(int id)
+{
+    QGraphicsItem* gi;
+    if (_searchHit >= 0 && (gi = _names.item(_searchHit))) {
+        if (IS_LAYER(gi))
+            static_cast<RegionLayer*>(gi)->setCurrent(-1);
+        else
+            highlightItem(gi, false);
+    }
+    _searchHit = id;
+    if (id >= 0 && (gi = _names.item(id))) {
+        if (IS_LAYER(gi)) {
+            RegionLayer* layer = static_cast<RegionLayer*>(gi);
+            layer->setCurrent(layer->find(_names.serial(id)));
+        } else
+            highlightItem(gi, true);
+    }
+}
+
 void AWindow::modSearch()
 {
-    QString name;
+    std::vector<int> found;
     QString pattern = _search->text();
-    QGraphicsItem* prev = NULL;
 
-    if (pattern.isEmpty()) {
-        each_item_mod(gi) {
-            highlightItem(gi, false);
-        }
-        return;
+    _searchTimer->stop();
+    highlightHit(-1);
+
+    if (! pattern.isEmpty()) {
+        if (! _names.search(pattern, _searchMode->currentIndex(), found))
+            statusBar()->showMessage("Invalid regular expression", 3000);
     }
+    _results->setResults(found);
 
-    _scene->blockSignals(true);
-    each_item_mod(gi) {
-        if (IS_CANVAS(gi))
-            continue;
+    if (_results->rowCount() && ! _resultDock->isVisible())
+        _resultDock->show();
+}
 
-        name = gi->data(ID_NAME).toString();
-        if (name.contains(pattern)) {
-            if (! prev)
-                _scene->clearSelection();
-            else {
-                prev->setSelected(true);
-                highlightItem(prev, true);
-            }
-            prev = gi;
-        } else
-            highlightItem(gi, false);
-    }
-    _scene->blockSignals(false);
+void AWindow::searchJump()
+{
+    modSearch();
+    if (_results->rowCount())
+        _resultList->setCurrentIndex(_results->index(0));
+}
 
-    // Do the final selection change outside the loop now that signals are
-    // enabled again.
-    if (prev) {
-        prev->setSelected(true);
-        highlightItem(prev, true);
-    } else
+void AWindow::jumpToResult(const QModelIndex& mi)
+{
+    if (! mi.isValid())
+        return;
+
+    int id = _results->id(mi.row());
+    QGraphicsItem* gi = _names.item(id);
+    if (gi) {
+        _scene->blockSignals(true);
         _scene->clearSelection();
+        _scene->blockSignals(false);
+        highlightHit(id);
+
+        if (IS_LAYER(gi)) {
+            RegionLayer* layer = static_cast<RegionLayer*>(gi);
+            int i = layer->find(_names.serial(id));
+            _view->centerOn(layer->mapToScene(layer->regionRect(i).center()));
+        } else {
+            gi->setSelected(true);
+            _view->centerOn(gi);
+        }
+    }
 }
 
 // Record that a QLineEdit was edited.
@@ -1611,6 +2603,7 @@ void AWindow::modX(int n)
         if (pi)
             r -= pi->scenePos().x();
         _selItem->setX(r);
+        _journal.touch();
     }
 }
 
@@ -1622,6 +2615,7 @@ void AWindow::modY(int n)
         if (pi)
             r -= pi->scenePos().y();
         _selItem->setY(r);
+        _journal.touch();
     }
 }
 
@@ -1642,11 +2636,13 @@ static void setRectDim(QGraphicsItem* gi, int w, int h)
 void AWindow::modW(int n)
 {
     setRectDim(_selItem, n, -1);
+    _journal.touch();
 }
 
 void AWindow::modH(int n)
 {
     setRectDim(_selItem, -1, n);
+    _journal.touch();
 }
 
 // Set either hotX or hotY.
@@ -1662,11 +2658,13 @@ static void setHotspotN(QGraphicsItem* gi, int i, int val)
 void AWindow::modHotX(int n)
 {
     setHotspotN(_selItem, 0, n);
+    _journal.touch();
 }
 
 void AWindow::modHotY(int n)
 {
     setHotspotN(_selItem, 1, n);
+    _journal.touch();
 }
 
 void AWindow::editDocSize()
@@ -1682,6 +2680,8 @@ void AWindow::editDocSize()
 
 void AWindow::canvasChanged()
 {
+    _journal.touch();
+
     each_item(it) {
         if (IS_CANVAS(it)) {
             QGraphicsRectItem* rit = (QGraphicsRectItem*) it;
@@ -1711,62 +2711,904 @@ void AWindow::pipelinesChanged()
     _io->setSpec(_ioSpec);
 }
 
-void AWindow::execute(int pi, int push)
+void AWindow::usePixelCache(bool on)
 {
-    char fileVar[40];
-    sprintf(fileVar, "/tmp/atlush-%lld.atl", qApp->applicationPid());
-#ifdef _WIN32
-    _putenv_s("ATL", fileVar);
-#else
-    setenv("ATL", fileVar, 1);
-#endif
+    if (! on)
+        _pixelCache.close();
+}
 
-    QString fn(fileVar);
-    if (push) {
-        if (! saveProject(fn)) {
-            saveFailed(this, fn);
-            return;
-        }
+void AWindow::watchFiles(bool)
+{
+    updateWatch();
+}
+
+/*
+ * Watch the image files of the project and the imported directories.
+ * Does nothing unless Settings -> Watch Files is enabled.
+ */
+void AWindow::updateWatch()
+{
+    if (! _actWatch->isChecked()) {
+        _watcher->clear();
+        return;
     }
 
-    QString cmd;
-    int stat = io_execute(_ioSpec, pi, push, cmd);
-    if (stat < 0) {
-        QString error("Could not run: ");
-        QMessageBox::warning(this, "System Failure", error + cmd);
-    } else if (stat) {
-        QString error("Command: ");
-        error += cmd;
-        error += "\n\nExit Status: ";
-        error += QString::number(stat);
-        QMessageBox::warning(this, "I/O Command Failure", error);
-    } else if(! push) {
-        openFile(fn);
+    QStringList files;
+    each_item(gi) {
+        if (IS_IMAGE(gi)) {
+            const ResidentImage* img = static_cast<const ResidentImage*>(gi);
+            if (! img->source().isEmpty())
+                files << img->source();
+        }
     }
+    _watcher->setPaths(files, _watchDirs);
 }
 
-//----------------------------------------------------------------------------
-// Project methods
-
-void AWindow::newProject()
+void AWindow::watchNotify(const QStringList& files, const QStringList& dirs,
+                          void* user)
 {
-    _scene->clear();
-    undoClear();
-    _serialNo = 0;
+    static_cast<AWindow*>(user)->applyWatch(files, dirs);
 }
 
-QGraphicsPixmapItem* AWindow::makeImage(const QPixmap& pix, int x, int y)
+/*
+ * Reload changed images, import new images from the watched directories,
+ * remove images whose files were deleted, then repack all the images and
+ * re-export the last exported atlas image.  Only files which appeared in a
+ * directory since it was last listed are imported, so images the user has
+ * removed from the project stay out.  The removal and the repack are
+ * undone in one step.
+ */
+void AWindow::applyWatch(const QStringList& files, const QStringList& dirs)
 {
-    QGraphicsPixmapItem* item = new AImage;
-    item->setData(ID_SERIAL, ++_serialNo);
-    item->setPixmap(pix);
-    item->setFlags(QGraphicsItem::ItemIsMovable |
-                   QGraphicsItem::ItemIsSelectable |
-                   QGraphicsItem::ItemSendsGeometryChanges);
+    if (_ioProc || _undo.snapshotInProgress()) {
+        // The project cannot change now; try again shortly.
+        QTimer::singleShot(500, this, [this, files, dirs]() {
+            applyWatch(files, dirs);
+        });
+        return;
+    }
+
+    PROFILE(prof, "Watch");
+    QSet<QString> changed;
+    for (const QString& fn : files)
+        changed.insert(QFileInfo(fn).absoluteFilePath());
+
+    QSet<QString> present;
+    std::vector<QGraphicsItem*> removed;
+    int reloaded = 0;
+    int added = 0;
+
+    beginBulk();
+    _undo.beginGroup();
+    {
+    PROFILE(reload, "Reload");
+    each_item_mod(gi) {
+        if (! IS_IMAGE(gi))
+            continue;
+        ResidentImage* img = static_cast<ResidentImage*>(gi);
+        if (img->source().isEmpty())
+            continue;
+        QString path(QFileInfo(img->source()).absoluteFilePath());
+        present.insert(path);
+        if (! changed.contains(path))
+            continue;
+
+        if (QFileInfo::exists(path)) {
+            // Only this file is decoded again; the ImageCache entry is stale.
+            img->setPixels(loadPixmap(QDir(), img->source()), img->source());
+            ++reloaded;
+        } else
+            removed.push_back(gi);
+    }
+
+    if (! removed.empty()) {
+        std::vector<UndoValue> vals(removed.size());
+        for (size_t i = 0; i < removed.size(); ++i) {
+            vals[i].u = removed[i]->data(ID_SERIAL).toUInt();
+            parkItem(removed[i]);
+        }
+        _undo.recordValues(UNDO_REMOVE, 1, vals);
+    }
+    reload.addItems(reloaded);
+    }
+
+    for (const QString& dpath : dirs) {
+        QDir dir(dpath);
+        dir.setNameFilters(imageFilters());
+        QSet<QString>& known = _watchListing[dir.absolutePath()];
+        QSet<QString> listing;
+        for (const QString& fn : dir.entryList(QDir::Files, QDir::Name)) {
+            listing.insert(fn);
+            if (known.contains(fn))
+                continue;
+            QString path(dir.absoluteFilePath(fn));
+            if (! present.contains(path) && importImage(path))
+                ++added;
+        }
+        known.swap(listing);
+    }
+    endBulk("Watch");
+
+    int count = reloaded + added + int(removed.size());
+    if (count) {
+        _journal.touch();
+        packItems(NULL);
+
+        int w, h;
+        if (! _watchExport.isEmpty() && exportSize(w, h))
+            exportAtlasImage(_watchExport, w, h);
+    }
+    _undo.endGroup();
+    if (added || ! removed.empty())
+        updateWatch();
+    prof.addItems(count);
+}
+
+/*
+ * Writes a pixel cache file on a worker thread.  The previous file is mapped
+ * separately so that the window may close or reopen its own mapping.
+ */
+class CacheThread : public QThread
+{
+public:
+    QString path;
+    std::vector<PixelCacheSource> sources;
+    bool ok;
+
+protected:
+    void run()
+    {
+        PixelCache prev;
+        prev.open(path);
+
+        PixelCacheWriter writer(path);
+        ok = writer.begin(sources);
+        for (size_t i = 0; ok && i < sources.size(); ++i) {
+            const QString& src = sources[i].path;
+            QImage image = prev.image(src);
+            if (image.isNull())
+                image = ImageCache::instance().load(src);
+            ok = writer.append(image);
+        }
+        ok = writer.commit() && ok;
+    }
+};
+
+/*
+ * Rewrite the pixel cache file of a project unless it already holds the
+ * current version of every image file used.  Does nothing unless
+ * Settings -> Pixel Cache Files is enabled.  The file is written in the
+ * background; images not yet cached are decoded there too.
+ */
+void AWindow::updatePixelCache(const QString& project)
+{
+    if (! _actPixelCache->isChecked())
+        return;
+    waitForCache();
+
+    QDir dir(QFileInfo(project).dir());
+    QString cachePath(PixelCache::pathFor(project));
+    if (! _pixelCache.isOpen())
+        _pixelCache.open(cachePath);
+
+    // Gather the image files and their dimensions.
+    std::vector<PixelCacheSource> sources;
+    QSet<QString> seen;
+    bool stale = false;
+
+    each_item(it) {
+        if (! IS_IMAGE(it))
+            continue;
+        QFileInfo info(dir.filePath(it->data(ID_NAME).toString()));
+        PixelCacheSource src;
+        src.path = info.canonicalFilePath();
+        if (src.path.isEmpty() || seen.contains(src.path))
+            continue;
+        seen.insert(src.path);
+
+        int ci = _pixelCache.find(info);
+        QSize size;
+        if (ci >= 0)
+            size = _pixelCache.size(ci);
+        else {
+            stale = true;
+            size = QImageReader(src.path).size();
+            if (! size.isValid())
+                continue;
+        }
+        src.mtime  = info.lastModified().toMSecsSinceEpoch();
+        src.size   = info.size();
+        src.width  = size.width();
+        src.height = size.height();
+        sources.push_back(src);
+    }
+    if (! stale && int(sources.size()) == _pixelCache.count())
+        return;
+
+    CacheThread* ct = new CacheThread;
+    ct->path = cachePath;
+    ct->sources.swap(sources);
+    ct->ok = false;
+    connect(ct, SIGNAL(finished()), SLOT(cacheFinished()));
+
+    _cacheThread = ct;
+    ct->start();
+}
+
+/*
+ * Block until any background pixel cache write is done.
+ */
+void AWindow::waitForCache()
+{
+    if (_cacheThread) {
+        _cacheThread->wait();
+        cacheFinished();
+    }
+}
+
+void AWindow::cacheFinished()
+{
+    CacheThread* ct = _cacheThread;
+    if (! ct || ! ct->isFinished())
+        return;     // Already handled by waitForCache().
+    _cacheThread = NULL;
+
+    if (ct->ok) {
+        if (_actPixelCache->isChecked())
+            _pixelCache.open(ct->path);
+        statusBar()->showMessage(QString("Pixel cache updated (%1 images)")
+                                 .arg(ct->sources.size()), 5000);
+    } else
+        statusBar()->showMessage("Pixel cache write failed", 5000);
+
+    delete ct;
+}
+
+QPixmap AWindow::residencyLoad(const QString& path, void* user)
+{
+    return static_cast<AWindow*>(user)->loadPixmap(QDir(), path);
+}
+
+void AWindow::editMemoryLimit()
+{
+    bool ok;
+    int mb = QInputDialog::getInt(this, "Image Memory",
+                    "Pixel memory limit for images (MiB, 0 = none):",
+                    _residency->limit(), 0, 1024*1024, 256, &ok);
+    if (ok)
+        _residency->setLimit(mb);
+}
+
+void AWindow::editCacheSize()
+{
+    ImageCache& cache = ImageCache::instance();
+    bool ok;
+    int mb = QInputDialog::getInt(this, "Image Cache",
+                    "Memory for decoded images (MiB):", cache.budget(),
+                    0, 16384, 64, &ok);
+    if (ok)
+        cache.setBudget(mb);
+}
+
+#define IO_FEED_IMAGES  256         // Images serialized per write.
+#define IO_FEED_QUEUED  (256*1024)  // Maximum bytes waiting to be written.
+
+/*
+ * Start an import or export command.  The command runs in the background
+ * with its output shown in the I/O log, and the project is read-only until
+ * it finishes.
+ *
+ * The project is exchanged through the temporary file named by $ATL, unless
+ * the command starts with '|', in which case it is streamed the project on
+ * stdin (export) or must print it to stdout (import).
+ */
+void AWindow::execute(int pi, int push)
+{
+    if (_ioProc)
+        return;
+
+    char fileVar[40];
+    sprintf(fileVar, "/tmp/atlush-%lld.atl", qApp->applicationPid());
+#ifdef _WIN32
+    _putenv_s("ATL", fileVar);
+#else
+    setenv("ATL", fileVar, 1);
+#endif
+
+    QString cmd;
+    bool stream;
+    if (! io_command(_ioSpec, pi, push, cmd, &stream)) {
+        QString error("Could not run: ");
+        QMessageBox::warning(this, "System Failure", error + cmd);
+        return;
+    }
+
+    if (cmd.startsWith('@')) {
+        if (push)
+            exportBuiltin(cmd);
+        else
+            QMessageBox::warning(this, "Import Failed",
+                                 "Built-in formats can only be exported: " +
+                                 cmd);
+        return;
+    }
+
+    PROFILE(prof, "Execute");
+    _ioStart = Profiler::instance().now();
+    _ioBytes = 0;
+
+    QString fn(fileVar);
+    if (push && ! stream) {
+        if (! saveProject(fn)) {
+            saveFailed(this, fn);
+            return;
+        }
+    }
+
+    _ioFile = fn;
+    _ioCmd  = cmd;
+    _ioPush = push;
+    _ioCanceled = false;
+    _ioNext = -1;
+    _ioModel.clear();
+    if (stream) {
+        if (push)
+            captureModel(_ioModel);
+        else
+            _ioReader = new AtlasStreamReader(&_ioModel);
+    }
+    _ioLog->appendPlainText(QString("$ ") + cmd);
+    _ioDock->show();
+
+    _ioProc = newCommandProcess(this);
+    connect(_ioProc, SIGNAL(readyReadStandardOutput()), SLOT(ioStdout()));
+    connect(_ioProc, SIGNAL(readyReadStandardError()), SLOT(ioStderr()));
+    connect(_ioProc, SIGNAL(finished(int, QProcess::ExitStatus)),
+            SLOT(ioFinished(int, QProcess::ExitStatus)));
+    connect(_ioProc, SIGNAL(errorOccurred(QProcess::ProcessError)),
+            SLOT(ioError(QProcess::ProcessError)));
+    if (stream && push) {
+        _ioNext = 0;
+        connect(_ioProc, SIGNAL(started()), SLOT(ioFeed()));
+        connect(_ioProc, SIGNAL(bytesWritten(qint64)), SLOT(ioFeed()));
+    }
+
+    setProjectReadOnly(true);
+    _io->setRunning(true);
+
+#ifdef _WIN32
+    _ioProc->start("cmd.exe", QStringList() << "/C" << cmd);
+#else
+    _ioProc->start("/bin/sh", QStringList() << "-c" << cmd);
+#endif
+    if (! (stream && push))
+        _ioProc->closeWriteChannel();
+}
+
+/*
+ * Write the next part of the project to an export command.  Only a limited
+ * amount is queued at a time so that formatting overlaps with the command
+ * reading its input.
+ */
+void AWindow::ioFeed()
+{
+    if (! _ioProc || _ioNext < 0 || _ioProc->bytesToWrite() > IO_FEED_QUEUED)
+        return;
+
+    QByteArray text;
+    if (_ioNext == 0)
+        _ioModel.appendHeader(text);
+
+    int count = _ioModel.imageCount();
+    int end = qMin(_ioNext + IO_FEED_IMAGES, count);
+    _ioModel.appendText(text, _ioNext, end);
+    if (! text.isEmpty())
+        _ioProc->write(text);
+    _ioBytes += text.size();
+
+    if (end == count) {
+        _ioNext = -1;
+        _ioModel.clear();
+        _ioProc->closeWriteChannel();
+    } else
+        _ioNext = end;
+}
+
+/*
+ * Split a command into words separated by spaces.  Double quotes group
+ * words containing spaces (the quotes are removed).
+ */
+static QStringList splitWords(const QString& cmd)
+{
+    QStringList words;
+    QString word;
+    bool quoted = false;
+    bool inWord = false;
+    for (QChar c : cmd) {
+        if (c == '"') {
+            quoted = ! quoted;
+            inWord = true;
+        } else if (c.isSpace() && ! quoted) {
+            if (inWord)
+                words << word;
+            word.clear();
+            inWord = false;
+        } else {
+            word += c;
+            inWord = true;
+        }
+    }
+    if (inWord)
+        words << word;
+    return words;
+}
+
+/*
+ * Run an export command which names a built-in format
+ * ("@<format> <file> [<image>]").  The file is written straight from the
+ * scene with no temporary project or child process.
+ */
+void AWindow::exportBuiltin(const QString& cmd)
+{
+    _ioLog->appendPlainText(QString("$ ") + cmd);
+    _ioDock->show();
+
+    QStringList args = splitWords(cmd.mid(1));
+    int format = args.isEmpty() ? -1
+                    : dataFormatByName(args[0].toLatin1().constData());
+    if (format < 0 || args.size() < 2 || args.size() > 3) {
+        QByteArray usage("Usage: @<format> <file> [<image>]\n"
+                         "Quote paths which contain spaces.\nFormats:");
+        for (int i = 0; i < DF_Count; ++i)
+            usage += QByteArray(" ") + dataFormatName(i);
+        ioLog(usage);
+        return;
+    }
+
+    // A relative file is found in the project directory, like image names.
+    // The atlas image defaults to a PNG with the same base name.
+    QString file(args[1]);
+    if (! _prevProjPath.isEmpty())
+        file = QFileInfo(_prevProjPath).dir().absoluteFilePath(file);
+    QString image = (args.size() > 2) ? args[2]
+                        : QFileInfo(file).completeBaseName() + ".png";
+
+    PROFILE(prof, "Export Data");
+    AtlasModel model;
+    captureModel(model);
+    prof.addItems(model.regionCount());
+    QString error;
+    if (! exportData(model, format, file, image, &error)) {
+        ioLog(error.toLocal8Bit());
+        QMessageBox::warning(this, "Export Failed", error);
+        return;
+    }
+    _ioLog->appendPlainText(QString("[Wrote %1]").arg(file));
+}
+
+void AWindow::ioLog(QByteArray out)
+{
+    if (out.endsWith('\n'))
+        out.chop(1);
+    if (! out.isEmpty())
+        _ioLog->appendPlainText(QString::fromLocal8Bit(out));
+}
+
+void AWindow::ioStdout()
+{
+    QByteArray out = _ioProc->readAllStandardOutput();
+    _ioBytes += out.size();
+    if (! _ioReader) {
+        ioLog(out);
+    } else if (! _ioReader->feed(out.constData(), out.size())) {
+        // Stop the command; ioFinished() reports the error.
+        killCommand(_ioProc);
+    }
+}
+
+void AWindow::ioStderr()
+{
+    ioLog(_ioProc->readAllStandardError());
+}
+
+void AWindow::ioCancel()
+{
+    if (_ioProc) {
+        _ioCanceled = true;
+        killCommand(_ioProc);
+    }
+}
+
+void AWindow::ioError(QProcess::ProcessError err)
+{
+    // Only a failed start does not emit finished().
+    if (err == QProcess::FailedToStart) {
+        _ioLog->appendPlainText(QString("[") + _ioProc->errorString() + "]");
+        delete _ioReader;
+        _ioReader = NULL;
+        _ioModel.clear();
+        ioDone();
+        QString error("Could not run: ");
+        QMessageBox::warning(this, "System Failure", error + _ioCmd);
+    }
+}
+
+void AWindow::ioFinished(int exitCode, QProcess::ExitStatus status)
+{
+    ioStdout();
+    ioStderr();
+
+    AtlasStreamReader* reader = _ioReader;
+    _ioReader = NULL;
+    ioDone();
+    Profiler::instance().record("Command", _ioStart, 0, _ioBytes);
+
+    QString msg;
+    if (_ioCanceled) {
+        _ioLog->appendPlainText("[canceled]");
+        statusBar()->showMessage("I/O command canceled", 5000);
+    } else if (reader && ! reader->finish()) {
+        msg = QString("Parse error on line ") +
+              QString::number(reader->errorLine() + 1) +
+              " of command output";
+        _ioLog->appendPlainText(QString("[") + msg + "]");
+        QMessageBox::warning(this, "I/O Command Failure", msg);
+    } else if (status != QProcess::NormalExit || exitCode) {
+        msg = (status == QProcess::NormalExit) ?
+                QString("Exit Status: ") + QString::number(exitCode) :
+                QString("Command crashed");
+        _ioLog->appendPlainText(QString("[") + msg + "]");
+
+        QString error("Command: ");
+        error += _ioCmd;
+        error += "\n\n";
+        error += msg;
+        QMessageBox::warning(this, "I/O Command Failure", error);
+    } else {
+        _ioLog->appendPlainText("[done]");
+        statusBar()->showMessage("I/O command finished", 5000);
+        if (reader || ! _ioPush) {
+            PROFILE(prof, "Import");
+            if (reader)
+                mergeModel(_ioModel, QDir::current());
+            else
+                importFile(_ioFile);
+        }
+    }
+
+    delete reader;
+    _ioModel.clear();
+}
+
+static void pushDelta(std::vector<UndoValue>& vals, uint32_t serial,
+                      int a, int b)
+{
+    UndoValue uval;
+    uval.u = serial;
+    vals.push_back(uval);
+    uval.s[0] = int16_t(a);
+    uval.s[1] = int16_t(b);
+    vals.push_back(uval);
+}
+
+/*
+ * Load an image from the pixel cache, or else decode it.  The pixmap is a
+ * copy of cached pixels, but that is much cheaper than decoding.
+ */
+QPixmap AWindow::loadPixmap(const QDir& dir, const QString& name) const
+{
+    QString path(dir.filePath(name));
+    QImage image = _pixelCache.image(path);
+    if (image.isNull())
+        image = ImageCache::instance().load(path);
+
+    QPixmap pix = QPixmap::fromImage(image);
+    if (pix.isNull())
+        pix = QPixmap(":/icons/missing.png");
+    return pix;
+}
+
+/*
+ * Update the regions of an existing image to match those of image i in the
+ * model.  Regions are matched by name; regions with the same name are
+ * matched in order.
+ */
+void AWindow::mergeRegions(QGraphicsItem* pitem, const AtlasModel& model,
+                           int i, std::vector<UndoValue>& rects)
+{
+    // The multi-hashes are filled in reverse so that take() returns the
+    // first item of each name.
+    QMultiHash<QByteArray, ARegion*> regions;
+    RegionLayer* layer = NULL;
+
+    QList<QGraphicsItem*> children = pitem->childItems();
+    for (int k = children.size() - 1; k >= 0; --k) {
+        QGraphicsItem* ch = children[k];
+        if (IS_REGION(ch)) {
+            QByteArray name(ch->data(ID_NAME).toString().toUtf8());
+            regions.insert(name, static_cast<ARegion*>(ch));
+        } else if (IS_LAYER(ch))
+            layer = static_cast<RegionLayer*>(ch);
+    }
+
+    int ix = model.imageX[i];
+    int iy = model.imageY[i];
+    int r   = model.regionStart(i);
+    int end = model.regionEnd(i);
+
+    if (layer || _actBatchRegions->isChecked()) {
+        // Layers are cheap to rebuild; only the serial numbers of matching
+        // regions are kept so that undo steps still apply.
+        QMultiHash<QByteArray, LayerRegion> prev;
+        if (layer) {
+            for (int k = layer->count() - 1; k >= 0; --k)
+                prev.insert(layer->name(k).toUtf8(), layer->region(k));
+            delete layer;
+            layer = NULL;
+        }
+
+        for (; r != end; ++r) {
+            const QByteArray& name = model.regionName(r);
+            LayerRegion lr;
+            lr.x = model.regionX[r] - ix;
+            lr.y = model.regionY[r] - iy;
+            lr.w = model.regionW[r];
+            lr.h = model.regionH[r];
+            lr.hotx = model.regionHotX[r];
+            lr.hoty = model.regionHotY[r];
+
+            auto it = prev.find(name);
+            if (it != prev.end()) {
+                const LayerRegion& old = it.value();
+                lr.serial = old.serial;
+                if (lr.x != old.x || lr.y != old.y ||
+                    lr.w != old.w || lr.h != old.h) {
+                    pushDelta(rects, lr.serial, lr.x - old.x, lr.y - old.y);
+                    rects.push_back(rects.back());
+                    rects.back().s[0] = int16_t(lr.w - old.w);
+                    rects.back().s[1] = int16_t(lr.h - old.h);
+                }
+                prev.erase(it);
+            } else
+                lr.serial = ++_serialNo;
+
+            if (! layer)
+                layer = newLayer(pitem);
+            QString rname(QString::fromUtf8(name));
+            layer->append(lr, rname);
+            _names.insert(layer, lr.serial, rname);
+        }
+
+        for (const LayerRegion& old : prev)
+            _names.remove(old.serial);
+        return;
+    }
+
+    for (; r != end; ++r) {
+        const QByteArray& name = model.regionName(r);
+        int rx = model.regionX[r] - ix;
+        int ry = model.regionY[r] - iy;
+        int rw = model.regionW[r];
+        int rh = model.regionH[r];
+
+        ARegion* region = regions.take(name);
+        if (! region) {
+            QGraphicsItem* gi = makeRegion(pitem, rx, ry, rw, rh,
+                                    model.regionHotX[r], model.regionHotY[r]);
+            setItemName(gi, QString::fromUtf8(name));
+            continue;
+        }
+
+        QPointF pos = region->pos();
+        QRectF rect = region->rect();
+        int dx = rx - int(pos.x());
+        int dy = ry - int(pos.y());
+        int dw = rw - int(rect.width());
+        int dh = rh - int(rect.height());
+        if (dx || dy || dw || dh) {
+            region->setPos(rx, ry);
+            region->setRect(0.0, 0.0, rw, rh);
+            pushDelta(rects, region->data(ID_SERIAL).toUInt(), dx, dy);
+            rects.push_back(rects.back());
+            rects.back().s[0] = int16_t(dw);
+            rects.back().s[1] = int16_t(dh);
+        }
+        region->hotspot[0] = model.regionHotX[r];
+        region->hotspot[1] = model.regionHotY[r];
+    }
+
+    // Remove regions which were not imported.
+    for (ARegion* region : regions) {
+        _names.remove(region->data(ID_SERIAL).toUInt());
+        delete region;
+    }
+}
+
+/*
+ * Update the project to match an imported model.  Images are matched by
+ * name and their regions by name within the image (items with the same
+ * name are matched in order), and only the items which differ are changed.
+ * The pixmaps of matched images are reused unless their file has changed.
+ *
+ * The undo history is kept and the moves & resizes are recorded as a
+ * single undo step.  Added and removed items cannot be undone, as with
+ * other item creation & deletion.
+ */
+void AWindow::mergeModel(const AtlasModel& model, const QDir& dir)
+{
+    QMultiHash<QByteArray, QGraphicsItem*> images;
+    std::vector<UndoValue> moves;
+    std::vector<UndoValue> rects;
+    QVector<QGraphicsItem*> removeList;
+    int added = 0;
+
+    beginBulk();
+
+    {
+    // Filled in reverse so that take() returns the first of each name.
+    QList<QGraphicsItem*> list = _scene->items(Qt::AscendingOrder);
+    for (int k = list.size() - 1; k >= 0; --k) {
+        QGraphicsItem* it = list[k];
+        if (IS_IMAGE(it))
+            images.insert(it->data(ID_NAME).toString().toUtf8(), it);
+    }
+    }
+
+    if ((model.docW || model.docH) &&
+        (model.docW != _docSize.width() || model.docH != _docSize.height())) {
+        _docSize = QSize(model.docW, model.docH);
+        canvasChanged();
+    }
+
+    int count = model.imageCount();
+    for (int i = 0; i < count; ++i) {
+        const QByteArray& name = model.imageName(i);
+        int x = model.imageX[i];
+        int y = model.imageY[i];
+
+        QGraphicsItem* pitem = images.take(name);
+        if (pitem) {
+            ResidentImage* img = static_cast<ResidentImage*>(pitem);
+            if (img->size() != QSize(model.imageW[i], model.imageH[i]) ||
+                img->sourceChanged()) {
+                QString sname(QString::fromUtf8(name));
+                img->setPixels(loadPixmap(dir, sname), dir.filePath(sname));
+            }
+
+            QPointF pos = pitem->pos();
+            int dx = x - int(pos.x());
+            int dy = y - int(pos.y());
+            if (dx || dy) {
+                pitem->setPos(x, y);
+                pushDelta(moves, pitem->data(ID_SERIAL).toUInt(), dx, dy);
+            }
+        } else {
+            QString sname(QString::fromUtf8(name));
+            pitem = makeImage(loadPixmap(dir, sname), x, y,
+                              dir.filePath(sname));
+            setItemName(pitem, sname);
+            ++added;
+        }
+        mergeRegions(pitem, model, i, rects);
+    }
+
+    // Remove images which were not imported.
+    for (QGraphicsItem* gi : images)
+        removeList.push_back(gi);
+    removeItems(removeList.constData(), removeList.size());
+
+    QString msg = QString("Import: %1 images added, %2 moved, %3 removed, "
+                          "%4 regions changed")
+                          .arg(added).arg(moves.size() / 2)
+                          .arg(removeList.size()).arg(rects.size() / 3);
+
+    _undo.beginGroup();
+    _undo.recordValues(UNDO_POS, 2, moves);
+    _undo.recordValues(UNDO_RECT, 3, rects);
+    _undo.endGroup();
+    _journal.touch();
+    endBulk("Import");
+    statusBar()->showMessage(msg, 5000);
+}
+
+/*
+ * Merge the project file written by an import command.
+ */
+void AWindow::importFile(const QString& file)
+{
+    AtlasModel model;
+    int line;
+    if (model.load(UTF8(file), &line)) {
+        mergeModel(model, QFileInfo(file).dir());
+    } else {
+        QString error;
+        if (line < 0)
+            error = "Error opening file ";
+        else {
+            error = "Parse error on line ";
+            error += QString::number(line);
+            error += " of ";
+        }
+        QMessageBox::warning(this, "Import Error", error + file);
+    }
+}
+
+void AWindow::ioDone()
+{
+    _ioProc->deleteLater();
+    _ioProc = NULL;
+    _io->setRunning(false);
+    setProjectReadOnly(false);
+}
+
+/*
+ * Enable or disable everything which modifies the project.
+ */
+void AWindow::setProjectReadOnly(bool ro)
+{
+    bool on = ! ro;
+    for (QAction* act : _editActs)
+        act->setEnabled(on);
+    _view->setInteractive(on);
+    _propBar->setEnabled(on);
+    _hotspotBar->setEnabled(on);
+    _packBar->setEnabled(on);
+
+    if (on) {
+        _actUndo->setEnabled(_undo.stack.pos > 0);
+        _actRedo->setEnabled(_undo.stack.pos < _undo.stack.used);
+        syncSelection();
+    }
+}
+
+//----------------------------------------------------------------------------
+// Project methods
+
+void AWindow::setItemName(QGraphicsItem* item, const QString& name)
+{
+    item->setData(ID_NAME, name);
+    _names.insert(item, item->data(ID_SERIAL).toUInt(), name);
+}
+
+void AWindow::newProject()
+{
+    waitForSave();
+    waitForCache();
+
+    std::vector<int> none;
+    _results->setResults(none);
+    _searchHit = -1;
+    _names.clear();
+
+    _scene->clear();
+    undoClear();
+    _serialNo = 0;
+    _pixelCache.close();
+    _watchDirs.clear();
+    _watchListing.clear();
+    _watchExport.clear();
+    _watcher->clear();
+    _journal.touch();
+    _savedChanges = _journal.changes();     // Nothing to lose yet.
+}
+
+/*
+ * \param source  Image file of pix, or empty if the pixels were generated.
+ */
+QGraphicsPixmapItem* AWindow::makeImage(const QPixmap& pix, int x, int y,
+                                        const QString& source)
+{
+    AImage* item = new AImage(_residency);
+    item->setData(ID_SERIAL, ++_serialNo);
+    item->setPixels(pix, source);
+    item->setFlags(QGraphicsItem::ItemIsMovable |
+                   QGraphicsItem::ItemIsSelectable |
+                   QGraphicsItem::ItemSendsGeometryChanges);
     item->setShapeMode(QGraphicsPixmapItem::BoundingRectShape);
     item->setPos(x, y);
 
     _scene->addItem(item);
+    _journal.touch();
     return item;
 }
 
@@ -1787,6 +3629,7 @@ QGraphicsRectItem* AWindow::makeRegion(QGraphicsItem* parent, int x, int y,
     item->setPos(x, y);
     item->hotspot[0] = hotx;
     item->hotspot[1] = hoty;
+    _journal.touch();
 
     //QPointF p = item->scenePos();
     //printf("KR region %f,%f\n", p.x(), p.y());
@@ -1794,44 +3637,185 @@ QGraphicsRectItem* AWindow::makeRegion(QGraphicsItem* parent, int x, int y,
     return item;
 }
 
-#include "atl_read.h"
-
-struct AtlReadContext {
-    AWindow* win;
-    QGraphicsItem* pitem;
-};
+/*
+ * Create many regions of an image.  Each item is fully set up before it is
+ * given its parent so that the scene sees a single insertion per region
+ * rather than a change for each property.  Hotspots are zero.
+ *
+ * \param ids          Number appended to the prefix to name each region.
+ *                     If NULL the regions are numbered from zero.
+ * \param firstSerial  Serial number of the first region (the rest follow
+ *                     in order), or zero to use new serial numbers.
+ *
+ * Return the serial number of the first region.
+ */
+uint32_t AWindow::makeRegions(QGraphicsItem* parent, const QRect* rects,
+                              const int* ids, int count,
+                              const QString& prefix, uint32_t firstSerial)
+{
+    if (! firstSerial)
+        firstSerial = _serialNo + 1;
+    if (count && _serialNo < firstSerial + count - 1)
+        _serialNo = firstSerial + count - 1;
+
+    const QBrush brush(QColor(255, 20, 20));
+    const QPen pen(Qt::NoPen);
+    const QGraphicsItem::GraphicsItemFlags flags =
+        QGraphicsItem::ItemIsMovable |
+        QGraphicsItem::ItemIsSelectable |
+        QGraphicsItem::ItemSendsGeometryChanges;
+
+    beginBulk();
+    for (int i = 0; i < count; ++i) {
+        const QRect& rc = rects[i];
+        ARegion* item = new ARegion(NULL);
+        item->setData(ID_SERIAL, firstSerial + i);
+        item->setRect(0.0, 0.0, rc.width(), rc.height());
+        item->setPen(pen);
+        item->setBrush(brush);
+        item->setOpacity(0.5);
+        item->setPos(rc.x(), rc.y());   // Before flags; no snap is needed.
+        item->setFlags(flags);
+        item->hotspot[0] = 0;
+        item->hotspot[1] = 0;
+        item->setParentItem(parent);
+        setItemName(item, prefix + QString::number(ids ? ids[i] : i));
+    }
+    _journal.touch();
+    endBulk("Regions");
+    return firstSerial;
+}
 
-void AWindow::atlElement(int type, const AtlRegion* reg, void* user)
+/*
+ * Copy the images & regions in the scene to a model.
+ *
+ * \param images   If not NULL, set to the image items in model order.
+ * \param from     If not NULL, only the images in this list are copied.
+ * \param regions  Copy regions as well as images.
+ */
+void AWindow::captureModel(AtlasModel& model, ItemList* images,
+                           const ItemList* from, bool regions) const
 {
-    AtlReadContext* ctx = (AtlReadContext*) user;
-    AWindow* win = ctx->win;
-    switch (type) {
-        case ATL_DOCUMENT:
-            win->_docSize.setWidth(reg->w);
-            win->_docSize.setHeight(reg->h);
-            break;
+    ItemList all;
+    if (! from) {
+        all = _scene->items(Qt::AscendingOrder);
+        from = &all;
+    }
 
-        case ATL_IMAGE:
-        {
-            QPixmap pix(QString(reg->projPath));
-            if (pix.isNull())
-                pix = QPixmap(":/icons/missing.png");
+    model.clear();
+    if (! _docSize.isEmpty()) {
+        model.docW = _docSize.width();
+        model.docH = _docSize.height();
+    }
+    if (images)
+        images->clear();
+
+    for (QGraphicsItem* it : *from) {
+        if (! IS_IMAGE(it))
+            continue;
+        QPointF pos = it->scenePos();
+        QSize size = static_cast<const ResidentImage*>(it)->size();
+        model.addImage(it->data(ID_SERIAL).toUInt(),
+                       model.intern(it->data(ID_NAME).toString().toUtf8()),
+                       int(pos.x()), int(pos.y()),
+                       size.width(), size.height());
+        if (images)
+            images->append(it);
+        if (! regions)
+            continue;
 
-            ctx->pitem = win->makeImage(pix, reg->x, reg->y);
-            ctx->pitem->setData(ID_NAME, QString(reg->name));
+        for (const QGraphicsItem* ch : it->childItems()) {
+            if (IS_REGION(ch)) {
+                const ARegion* region = static_cast<const ARegion*>(ch);
+                QPointF rpos = region->scenePos();
+                QRectF rect = region->rect();
+                model.addRegion(region->data(ID_SERIAL).toUInt(),
+                        model.intern(region->data(ID_NAME).toString().toUtf8()),
+                        int(rpos.x()), int(rpos.y()),
+                        int(rect.width()), int(rect.height()),
+                        region->hotspot[0], region->hotspot[1]);
+            } else if (IS_LAYER(ch)) {
+                const RegionLayer* layer =
+                    static_cast<const RegionLayer*>(ch);
+                QPointF lpos = layer->scenePos();
+                for (int i = 0; i < layer->count(); ++i) {
+                    const LayerRegion& lr = layer->region(i);
+                    model.addRegion(lr.serial,
+                                    model.intern(layer->name(i).toUtf8()),
+                                    int(lpos.x()) + lr.x, int(lpos.y()) + lr.y,
+                                    lr.w, lr.h, lr.hotx, lr.hoty);
+                }
+            }
         }
-            break;
+    }
+}
 
-        case ATL_REGION:
-            if (ctx->pitem) {
-                QPointF pp = ctx->pitem->scenePos();
+/*
+ * Append the images & regions of a model to the scene.  Items with a zero
+ * serial number are assigned a new one.  Relative image paths are found in
+ * dir.
+ */
+void AWindow::buildScene(const AtlasModel& model, const QDir& dir)
+{
+    bool batch = _actBatchRegions->isChecked();
+    qint64 budget = _residency->limitBytes();
+    qint64 loaded = 0;
+    uint32_t serial;
+
+    int count = model.imageCount();
+    for (int i = 0; i < count; ++i) {
+        QString name(QString::fromUtf8(model.imageName(i)));
+        QString path(dir.filePath(name));
+        int ix = model.imageX[i];
+        int iy = model.imageY[i];
+        if ((serial = model.imageSerial[i]))
+            _serialNo = serial - 1;
+
+        // Once the memory limit is reached the remaining images are only
+        // loaded when they are shown.
+        QSize size(model.imageW[i], model.imageH[i]);
+        qint64 bytes = qint64(size.width()) * size.height() * 4;
+        AImage* pitem;
+        if (budget && loaded + bytes > budget && ! size.isEmpty()) {
+            pitem = static_cast<AImage*>(makeImage(QPixmap(), ix, iy));
+            pitem->setPlaceholder(size, path);
+        } else {
+            pitem = static_cast<AImage*>(makeImage(loadPixmap(dir, name),
+                                                   ix, iy, path));
+            loaded += bytes;
+        }
+        setItemName(pitem, name);
+
+        RegionLayer* layer = NULL;
+        int end = model.regionEnd(i);
+        for (int r = model.regionStart(i); r != end; ++r) {
+            QString rname(QString::fromUtf8(model.regionName(r)));
+            serial = model.regionSerial[r];
+            if (batch) {
+                LayerRegion lr;
+                lr.x = model.regionX[r] - ix;
+                lr.y = model.regionY[r] - iy;
+                lr.w = model.regionW[r];
+                lr.h = model.regionH[r];
+                lr.hotx = model.regionHotX[r];
+                lr.hoty = model.regionHotY[r];
+                lr.serial = serial ? serial : ++_serialNo;
+
+                if (! layer)
+                    layer = newLayer(pitem);
+                layer->append(lr, rname);
+                _names.insert(layer, lr.serial, rname);
+            } else {
+                if (serial)
+                    _serialNo = serial - 1;
                 QGraphicsItem* region =
-                    win->makeRegion(ctx->pitem,
-                                reg->x - int(pp.x()), reg->y - int(pp.y()),
-                                reg->w, reg->h, reg->hotx, reg->hoty);
-                region->setData(ID_NAME, QString(reg->name));
+                    makeRegion(pitem, model.regionX[r] - ix,
+                               model.regionY[r] - iy,
+                               model.regionW[r], model.regionH[r],
+                               model.regionHotX[r], model.regionHotY[r]);
+                setItemName(region, rname);
             }
-            break;
+        }
     }
 }
 
@@ -1843,20 +3827,25 @@ void AWindow::atlElement(int type, const AtlRegion* reg, void* user)
  */
 bool AWindow::loadProject(const QString& path, int* errorLine)
 {
-    AtlReadContext ctx;
-    ctx.win   = this;
-    ctx.pitem = NULL;
-    return atl_read(UTF8(path), errorLine, atlElement, &ctx);
-}
+    PROFILE(prof, "Load");
+    AtlasModel model;
+    {
+    PROFILE(parse, "Parse");
+    if (! model.load(UTF8(path), errorLine))
+        return false;
+    parse.addBytes(QFileInfo(path).size());
+    }
 
-static int regionWriteBoron(FILE* fp, const ItemValues& iv,
-                            const int* hotspot) {
-    char end = (hotspot && (hotspot[0] || hotspot[1])) ? ',' : '\n';
-    int n = fprintf(fp, "\"%s\" %d,%d,%d,%d%c",
-                    iv.name.constData(), iv.x, iv.y, iv.w, iv.h, end);
-    if (n > 0 && end == ',')
-        n = fprintf(fp, "%d,%d\n", hotspot[0], hotspot[1]);
-    return n;
+    if (model.docW || model.docH)
+        _docSize = QSize(model.docW, model.docH);
+    {
+    PROFILE(build, "Build Scene");
+    beginBulk();
+    buildScene(model, QFileInfo(path).dir());
+    endBulk("Load");
+    }
+    prof.addItems(model.imageCount() + model.regionCount());
+    return true;
 }
 
 /*
@@ -1864,44 +3853,138 @@ static int regionWriteBoron(FILE* fp, const ItemValues& iv,
  */
 bool AWindow::saveProject(const QString& path)
 {
-    ItemValues val;
-    FILE* fp = fopen(UTF8(path), "w");
-    if (! fp)
-        return false;
-
-    if (! _docSize.isEmpty()) {
-        fprintf(fp, "image-atlas 1 %d,%d\n",
-                _docSize.width(), _docSize.height());
+    PROFILE(prof, "Save");
+    AtlasModel model;
+    {
+    PROFILE(capture, "Capture");
+    captureModel(model);
     }
+    bool ok;
+    {
+    PROFILE(write, "Write");
+    ok = model.save(UTF8(path));
+    }
+    prof.addItems(model.imageCount() + model.regionCount());
+    prof.addBytes(QFileInfo(path).size());
+    return ok;
+}
 
-    bool done = false;
-    each_item(it) {
-        if (it->type() != GIT_PIXMAP)
-            continue;
-        itemValues(val, it);
-        if (regionWriteBoron(fp, val, NULL) < 0)
-            goto fail;
-
-        ItemList clist = it->childItems();
-        if (! clist.empty()) {
-            fprintf(fp, "[\n");
-            for(const QGraphicsItem* ch : clist) {
-                if (IS_REGION(ch)) {
-                    const ARegion* region = static_cast<const ARegion *>(ch);
-                    fprintf(fp, "  ");
-                    itemValues(val, ch);
-                    if (regionWriteBoron(fp, val, region->hotspot) < 0)
-                        goto fail;
-                }
+//----------------------------------------------------------------------------
+// Crash recovery
+
+void AWindow::journalTick()
+{
+    if (_journal.wantSnapshot() && ! _undo.snapshotInProgress())
+        journalSnapshot();
+    else
+        _journal.flush();
+}
+
+/*
+ * Write the entire project and undo history to the journal.
+ */
+void AWindow::journalSnapshot()
+{
+    JournalSnapshot snap;
+
+    captureModel(snap.model);
+    snap.model.docW = _docSize.width();
+    snap.model.docH = _docSize.height();
+    snap.serialNo = _serialNo;
+
+    const UndoStack& us = _undo.stack;
+    snap.undoUsed = us.used;
+    snap.undoPos  = us.pos;
+    snap.undo.assign(us.stack, us.stack + us.used + 1);
+
+    _journal.snapshot(snap);
+}
+
+/*
+ * Rebuild the project from a journal snapshot and replay the steps which
+ * were recorded after it.
+ */
+void AWindow::recoverJournal(const QString& project,
+                             const JournalSnapshot& snap,
+                             const std::vector<UndoValue>& steps)
+{
+    newProject();
+    _actHideRegions->setChecked(false);
+    _actLockRegions->setChecked(false);
+    _actLockImages->setChecked(false);
+
+    _journal.suspend(true);
+    _docSize = QSize(snap.model.docW, snap.model.docH);
+    beginBulk();
+    buildScene(snap.model, QFileInfo(project).dir());
+    _serialNo = snap.serialNo;
+
+    if (undo_restore(&_undo.stack, snap.undo.data(),
+                     snap.undoUsed, snap.undoPos)) {
+        const UndoValue* it  = steps.data();
+        const UndoValue* end = it + steps.size();
+        for (; it != end; it += it->op.skipNext) {
+            switch (it->op.code) {
+                case JREC_UNDO:
+                    undo();
+                    break;
+                case JREC_REDO:
+                    redo();
+                    break;
+                default:
+                    undo_record(&_undo.stack, it->op.code, it + 1,
+                                it->op.skipNext - 1);
+                    applyUndoStep(it, true);
+                    break;
             }
-            fprintf(fp, "]\n");
         }
+    } else
+        undoClear();
+    endBulk("Recovery");
+
+    _actUndo->setEnabled(_undo.stack.pos > 0);
+    _actRedo->setEnabled(_undo.stack.pos < _undo.stack.used);
+    _journal.suspend(false);
+
+    _journal.setTarget(project);
+    _journal.touch();       // The recovered changes are still unsaved.
+    journalSnapshot();
+
+    if (! project.isEmpty())
+        updateProjectName(project);
+    if (! _docSize.isEmpty())
+        setupBackground(_scene, _docSize, QBrush(_bgPix));
+}
+
+/*
+ * If a journal exists for the project then ask the user if it should be
+ * replayed.  A declined journal is deleted.
+ *
+ * Return true if the project was recovered.
+ */
+bool AWindow::offerRecovery(const QString& project)
+{
+    QString jpath = Journal::pathFor(project);
+    if (! QFile::exists(jpath))
+        return false;
+
+    JournalSnapshot snap;
+    std::vector<UndoValue> steps;
+    bool recover = false;
+
+    if (Journal::load(jpath, snap, steps)) {
+        QString msg("Unsaved changes were found for ");
+        msg += project.isEmpty() ? QString("an untitled project") : project;
+        msg += ".\n\nRecover them?";
+        recover = (QMessageBox::question(this, "Recover Project", msg) ==
+                   QMessageBox::Yes);
     }
-    done = true;
 
-fail:
-    fclose(fp);
-    return done;
+    if (recover)
+        recoverJournal(project, snap, steps);
+    else
+        QFile::remove(jpath);
+    return recover;
 }
 
 //----------------------------------------------------------------------------
@@ -1912,21 +3995,40 @@ int main( int argc, char **argv )
     app.setOrganizationName( APP_NAME );
     app.setApplicationName( APP_NAME );
 
+    // Chrome trace output is enabled with "--trace <file>" or ATLUSH_TRACE.
+    int argi = 1;
+    QString trace(QString::fromLocal8Bit(qgetenv("ATLUSH_TRACE")));
+    if (argc > 2 && strcmp(argv[1], "--trace") == 0) {
+        trace = QString::fromLocal8Bit(argv[2]);
+        argi = 3;
+    }
+    Profiler::instance().setTraceFile(trace);
+
     AWindow w;
     w.show();
 
-    if (argc > 1) {
-        QFileInfo info(argv[1]);
+    // Offer any crashed untitled session first, as opening a project
+    // retargets (and so deletes) the untitled journal.
+    bool recovered = w.offerRecovery(QString());
+
+    if (argc > argi) {
+        QFileInfo info(argv[argi]);
         QString path(info.filePath());
-        if (info.isDir())
+        if (info.isDir()) {
             w.directoryImport(path);
-        else if(hasImageExt(path))
+        } else if(hasImageExt(path)) {
             w.importImage(path);
-        else
+        } else if (recovered) {
+            // Keep the recovered session until the user saves it.
+            w.statusBar()->showMessage(QString("Recovered untitled project; "
+                                       "%1 was not opened").arg(path));
+        } else
             w.openFile(path);
     }
 
-    return app.exec();
+    int status = app.exec();
+    Profiler::instance().writeTrace();
+    return status;
 }
 
 
@@ -7,19 +7,34 @@
 //============================================================================
 
 
+#include <QElapsedTimer>
+#include <QHash>
 #include <QMainWindow>
 #include <QGraphicsView>
+#include <QProcess>
+#include <QSet>
 #include "RecentFiles.h"
-#include "undo.h"
+#include "Journal.h"
+#include "NameIndex.h"
+#include "PixelCache.h"
+#include "Residency.h"
+#include "Watcher.h"
 
 
 class ARegion;
+class RegionLayer;
 
 struct AUndoSystem
 {
-    AUndoSystem() : region(NULL) {}
+    AUndoSystem() : region(NULL), journal(NULL), grouping(false),
+                    groupStarted(false) {}
     void snapshot(const QList<QGraphicsItem*>& items);
     void commit();
+    void recordRect(uint32_t serial, int dx, int dy, int dw, int dh);
+    void recordValues(int opcode, int stride, std::vector<UndoValue>& vals);
+    void recordStep(int opcode, const UndoValue* vals, int count);
+    void beginGroup() { grouping = true; groupStarted = false; }
+    void endGroup() { grouping = false; }
     bool snapshotInProgress() const {
         return region || ! snap.empty();
     }
@@ -38,19 +53,29 @@ struct AUndoSystem
     std::vector<ItemShapshot> snap;
     std::vector<UndoValue> values;
     QAction* act;
+    Journal* journal;
 
 private:
     void undoRecord(int opcode, int stride);
+
+    bool grouping;          // Steps are joined until endGroup().
+    bool groupStarted;
 };
 
 
 class QComboBox;
+class QDockWidget;
 class QLineEdit;
+class QDir;
+class QListView;
+class QPlainTextEdit;
 class QSpinBox;
+class QTimer;
 class IOWidget;
 class IODialog;
 class CanvasDialog;
-struct AtlRegion;
+class CacheThread;
+class SaveThread;
 
 class AWindow : public QMainWindow
 {
@@ -62,12 +87,14 @@ public:
     ~AWindow();
 
     bool openFile(const QString& file);
+    bool offerRecovery(const QString& project);
     bool directoryImport(const QString& path);
     QGraphicsPixmapItem* importImage(const QString& file);
 
 public slots:
 
     void showAbout();
+    void showProfile();
 
 protected:
 
@@ -93,11 +120,14 @@ private slots:
     void lockRegions(bool);
     void lockImages(bool);
     void showHotspots(bool);
+    void batchRegions(bool);
     void sceneChange();
     void syncSelection();
     void newProject();
     void modName();
     void modSearch();
+    void searchJump();
+    void jumpToResult(const QModelIndex&);
     void stringEdit();
     void modX(int);
     void modY(int);
@@ -110,30 +140,88 @@ private slots:
     void extractRegions();
     void convertToImage();
     void cropImages();
+    void autoSlice();
+    void gridSlice();
     void editDocSize();
     void canvasChanged();
     void editPipelines();
     void pipelinesChanged();
+    void editCacheSize();
+    void usePixelCache(bool);
+    void watchFiles(bool);
+    void editMemoryLimit();
     void execute(int pi, int push);
+    void ioFeed();
+    void ioStdout();
+    void ioStderr();
+    void ioCancel();
+    void ioError(QProcess::ProcessError);
+    void ioFinished(int, QProcess::ExitStatus);
+    void journalTick();
+    void saveFinished();
+    void cacheFinished();
 
 private:
 
-    static void atlElement(int, const AtlRegion*, void*);
-
     void createActions();
     void createMenus();
     void createTools();
     void undoClear();
     void updateProjectName(const QString& path);
+    bool exportSize(int& w, int& h) const;
     bool exportAtlasImage(const QString& path, int w, int h);
+    int packItems(const QList<QGraphicsItem*>* from);
+    void beginBulk();
+    void endBulk(const char* label);
     void removeItems(QGraphicsItem* const* list, int count);
-    QGraphicsPixmapItem* makeImage(const QPixmap&, int x, int y);
+    QGraphicsPixmapItem* makeImage(const QPixmap&, int x, int y,
+                                   const QString& source = QString());
     QGraphicsRectItem* makeRegion(QGraphicsItem* parent, int, int, int, int,
                                   int, int);
+    uint32_t makeRegions(QGraphicsItem* parent, const QRect* rects,
+                         const int* ids, int count, const QString& prefix,
+                         uint32_t firstSerial = 0);
+    void undoGrid(const UndoValue* it, const UndoValue* end, bool redo);
+    void undoSlice(const UndoValue* it, const UndoValue* end, bool redo);
+    void undoRemove(const UndoValue* it, const UndoValue* end, bool redo);
+    void parkItem(QGraphicsItem*);
+    void applyUndoStep(const UndoValue* step, bool redo);
+    void captureModel(AtlasModel&, QList<QGraphicsItem*>* images = NULL,
+                      const QList<QGraphicsItem*>* from = NULL,
+                      bool regions = true) const;
+    void buildScene(const AtlasModel&, const QDir& dir);
     bool loadProject(const QString& path, int* errorLine);
     bool saveProject(const QString& path);
+    void startSave(const QString& path, bool saveAs);
+    void waitForSave();
+    void waitForCache();
     void extractRegionsOp(const QString& file, const QColor& color);
     void updateHotspot(int x, int y);
+    void setItemName(QGraphicsItem*, const QString&);
+    RegionLayer* newLayer(QGraphicsItem* image);
+    void layerFromRegions(QGraphicsItem* image);
+    void regionsFromLayer(QGraphicsItem* image);
+    void requireRegionItems();
+    void highlightHit(int id);
+    void ioLog(QByteArray);
+    void ioDone();
+    void exportBuiltin(const QString& cmd);
+    void importFile(const QString& file);
+    QPixmap loadPixmap(const QDir& dir, const QString& name) const;
+    void updatePixelCache(const QString& project);
+    static QPixmap residencyLoad(const QString& path, void* user);
+    static void profileNotify(const QString& summary, void* user);
+    static void watchNotify(const QStringList& files,
+                            const QStringList& dirs, void* user);
+    void updateWatch();
+    void applyWatch(const QStringList& files, const QStringList& dirs);
+    void mergeModel(const AtlasModel&, const QDir& dir);
+    void mergeRegions(QGraphicsItem* image, const AtlasModel&, int i,
+                      std::vector<UndoValue>& rects);
+    void setProjectReadOnly(bool);
+    void journalSnapshot();
+    void recoverJournal(const QString& project, const JournalSnapshot&,
+                        const std::vector<UndoValue>& steps);
 
     QAction* _actNew;
     QAction* _actOpen;
@@ -153,7 +241,10 @@ private:
     QAction* _actLockRegions;
     QAction* _actLockImages;
     QAction* _actShowHot;
+    QAction* _actBatchRegions;
     QAction* _actPack;
+    QAction* _actPixelCache;
+    QAction* _actWatch;
 
     QToolBar* _tools;
     QToolBar* _propBar;
@@ -172,6 +263,21 @@ private:
     QToolBar* _ioBar;
     IOWidget* _io;
     IODialog* _ioDialog;
+    QDockWidget* _ioDock;
+    QPlainTextEdit* _ioLog;
+    QProcess* _ioProc;          // Running command or NULL.
+    SaveThread* _saveThread;    // Background save or NULL.
+    CacheThread* _cacheThread;  // Background pixel cache write or NULL.
+    AtlasStreamReader* _ioReader;   // Parses output of streamed import.
+    AtlasModel _ioModel;        // Project streamed to or from the command.
+    int _ioNext;                // Next image to stream or -1 when done.
+    QString _ioFile;
+    QString _ioCmd;
+    int _ioPush;
+    bool _ioCanceled;
+    int64_t _ioStart;           // Profiler::now() when command started.
+    int64_t _ioBytes;           // Bytes streamed to or from command.
+    QList<QAction*> _editActs;  // Disabled while the project is read-only.
 
     QToolBar* _packBar;
     QSpinBox* _packPad;
@@ -179,6 +285,11 @@ private:
 
     QToolBar*  _searchBar;
     QLineEdit* _search;
+    QComboBox* _searchMode;
+    QTimer*    _searchTimer;
+    QDockWidget* _resultDock;
+    QListView* _resultList;
+    SearchResults* _results;
 
     QGraphicsScene* _scene;     // Stores our project.
     QGraphicsView* _view;
@@ -187,6 +298,21 @@ private:
     QSize          _docSize;
     AUndoSystem    _undo;
     uint32_t       _serialNo;
+    Journal        _journal;
+    uint32_t       _savedChanges;   // Journal changes() when last saved.
+    QTimer*        _journalTimer;
+    NameIndex      _names;
+    PixelCache     _pixelCache; // Decoded pixels of project images.
+    Residency*     _residency;
+    FileWatcher*   _watcher;    // Image files & imported directories.
+    QStringList    _watchDirs;  // Directories imported into the project.
+    QHash<QString, QSet<QString>> _watchListing;    // Files last seen in
+                                                    // each of _watchDirs.
+    QHash<uint32_t, QGraphicsItem*> _parked;    // Removed by undo steps.
+    QString        _watchExport;    // Image re-exported by watch mode.
+    int            _searchHit;  // NameIndex id of highlighted item.
+    int            _bulkDepth;
+    QElapsedTimer  _bulkTime;
 
     // Settings
     QString _prevProjPath;
@@ -0,0 +1,400 @@
+//============================================================================
+//
+// Atlas Model
+//
+//============================================================================
+
+
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "AtlasModel.h"
+#include "atl_read.h"
+
+void AtlasModel::clear()
+{
+    docW = docH = 0;
+
+    imageX.clear();
+    imageY.clear();
+    imageW.clear();
+    imageH.clear();
+    imageSerial.clear();
+    imageNameId.clear();
+
+    regionX.clear();
+    regionY.clear();
+    regionW.clear();
+    regionH.clear();
+    regionHotX.clear();
+    regionHotY.clear();
+    regionSerial.clear();
+    regionNameId.clear();
+    regionParent.clear();
+
+    _regionStart.clear();
+    _strings.clear();
+    _stringId.clear();
+}
+
+void AtlasModel::reserve(int images, int regions)
+{
+    imageX.reserve(images);
+    imageY.reserve(images);
+    imageW.reserve(images);
+    imageH.reserve(images);
+    imageSerial.reserve(images);
+    imageNameId.reserve(images);
+    _regionStart.reserve(images);
+
+    regionX.reserve(regions);
+    regionY.reserve(regions);
+    regionW.reserve(regions);
+    regionH.reserve(regions);
+    regionHotX.reserve(regions);
+    regionHotY.reserve(regions);
+    regionSerial.reserve(regions);
+    regionNameId.reserve(regions);
+    regionParent.reserve(regions);
+}
+
+/*
+ * Return the id of a name, adding it to the string table if needed.
+ */
+uint32_t AtlasModel::intern(const QByteArray& name)
+{
+    auto it = _stringId.constFind(name);
+    if (it != _stringId.constEnd())
+        return it.value();
+
+    uint32_t id = uint32_t(_strings.size());
+    _strings.push_back(name);
+    _stringId.insert(name, id);
+    return id;
+}
+
+/*
+ * Return index of new image.
+ */
+int AtlasModel::addImage(uint32_t serial, uint32_t name,
+                         int x, int y, int w, int h)
+{
+    int i = imageCount();
+    imageX.push_back(x);
+    imageY.push_back(y);
+    imageW.push_back(w);
+    imageH.push_back(h);
+    imageSerial.push_back(serial);
+    imageNameId.push_back(name);
+    _regionStart.push_back(regionCount());
+    return i;
+}
+
+/*
+ * Add a region to the last image.
+ *
+ * Return index of new region or -1 if there are no images.
+ */
+int AtlasModel::addRegion(uint32_t serial, uint32_t name,
+                          int x, int y, int w, int h, int hotx, int hoty)
+{
+    if (imageX.empty())
+        return -1;
+
+    int i = regionCount();
+    regionX.push_back(x);
+    regionY.push_back(y);
+    regionW.push_back(w);
+    regionH.push_back(h);
+    regionHotX.push_back(hotx);
+    regionHotY.push_back(hoty);
+    regionSerial.push_back(serial);
+    regionNameId.push_back(name);
+    regionParent.push_back(uint32_t(imageX.size() - 1));
+    return i;
+}
+
+static void modelElement(int type, const AtlRegion* reg, void* user)
+{
+    AtlasModel* model = (AtlasModel*) user;
+    switch (type) {
+        case ATL_DOCUMENT:
+            model->docW = reg->w;
+            model->docH = reg->h;
+            break;
+
+        case ATL_IMAGE:
+            model->addImage(0, model->intern(QByteArray(reg->name)),
+                            reg->x, reg->y, reg->w, reg->h);
+            break;
+
+        case ATL_REGION:
+            model->addRegion(0, model->intern(QByteArray(reg->name)),
+                             reg->x, reg->y, reg->w, reg->h,
+                             reg->hotx, reg->hoty);
+            break;
+    }
+}
+
+/*
+ * Append the items of a project file to the model.  Serial numbers of the
+ * new items are zero.
+ *
+ * Return false on error.  In this case errorLine is set to either the line
+ * number where parsing failed or -1 on a file open or read error.
+ */
+bool AtlasModel::load(const char* path, int* errorLine)
+{
+    return atl_read(path, errorLine, modelElement, this) != 0;
+}
+
+static const char digitPairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/*
+ * Write the decimal text of n (same as printf "%d") and return the end.
+ */
+static char* formatInt(char* cp, int n)
+{
+    char tmp[12];
+    char* tp = tmp + sizeof(tmp);
+    unsigned int u = (n < 0) ? 0u - unsigned(n) : unsigned(n);
+
+    while (u >= 100) {
+        const char* pair = digitPairs + (u % 100) * 2;
+        u /= 100;
+        *--tp = pair[1];
+        *--tp = pair[0];
+    }
+    if (u >= 10) {
+        const char* pair = digitPairs + u * 2;
+        *--tp = pair[1];
+        *--tp = pair[0];
+    } else
+        *--tp = char('0' + u);
+
+    if (n < 0)
+        *cp++ = '-';
+    int len = int(tmp + sizeof(tmp) - tp);
+    memcpy(cp, tp, len);
+    return cp + len;
+}
+
+#define ITEM_MAX_NUMBERS    (6 * 12)    // Six ints with separators.
+
+/*
+ * Append '"name" x,y,w,h[,hotx,hoty]\n' to text.  The text is formatted in
+ * place so that no temporary strings are created.
+ */
+static void appendItem(QByteArray& text, const char* indent,
+                       const QByteArray& name,
+                       int x, int y, int w, int h, int hotx, int hoty)
+{
+    int indentLen = int(strlen(indent));
+    int len = text.size();
+    text.resize(len + indentLen + name.size() + 3 + ITEM_MAX_NUMBERS + 1);
+
+    char* cp = text.data() + len;
+    memcpy(cp, indent, indentLen);
+    cp += indentLen;
+    *cp++ = '"';
+    memcpy(cp, name.constData(), name.size());
+    cp += name.size();
+    *cp++ = '"';
+    *cp++ = ' ';
+    cp = formatInt(cp, x);
+    *cp++ = ',';
+    cp = formatInt(cp, y);
+    *cp++ = ',';
+    cp = formatInt(cp, w);
+    *cp++ = ',';
+    cp = formatInt(cp, h);
+    if (hotx || hoty) {
+        *cp++ = ',';
+        cp = formatInt(cp, hotx);
+        *cp++ = ',';
+        cp = formatInt(cp, hoty);
+    }
+    *cp++ = '\n';
+
+    text.resize(int(cp - text.constData()));
+}
+
+void AtlasModel::appendHeader(QByteArray& text) const
+{
+    if (docW > 0 && docH > 0) {
+        char num[48];
+        int len = sprintf(num, "image-atlas 1 %d,%d\n", docW, docH);
+        text.append(num, len);
+    }
+}
+
+/*
+ * Append the .atl text for images [image, end) and their regions.
+ */
+void AtlasModel::appendText(QByteArray& text, int image, int end) const
+{
+    for (int i = image; i < end; ++i) {
+        appendItem(text, "", imageName(i), imageX[i], imageY[i],
+                   imageW[i], imageH[i], 0, 0);
+
+        int r    = regionStart(i);
+        int rend = regionEnd(i);
+        if (r != rend) {
+            text.append("[\n");
+            for (; r != rend; ++r) {
+                appendItem(text, "  ", regionName(r),
+                           regionX[r], regionY[r], regionW[r], regionH[r],
+                           regionHotX[r], regionHotY[r]);
+            }
+            text.append("]\n");
+        }
+    }
+}
+
+#define SAVE_BUFFER     (1024 * 1024)   // Bytes formatted per write.
+
+static bool writeAll(FILE* fp, const QByteArray& text)
+{
+    return fwrite(text.constData(), 1, text.size(), fp) == size_t(text.size());
+}
+
+#ifdef _WIN32
+static bool syncFile(FILE* fp)
+{
+    return _commit(_fileno(fp)) == 0;
+}
+
+static bool replaceFile(const char* tmp, const char* path)
+{
+    return MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING |
+                                  MOVEFILE_WRITE_THROUGH) != 0;
+}
+#else
+static bool syncFile(FILE* fp)
+{
+    return fsync(fileno(fp)) == 0;
+}
+
+// Give the new file the permissions of the one it replaces.
+static void copyMode(FILE* fp, const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) == 0)
+        fchmod(fileno(fp), st.st_mode & 07777);
+}
+
+static bool replaceFile(const char* tmp, const char* path)
+{
+    if (rename(tmp, path) != 0)
+        return false;
+
+    // Sync the directory so the rename itself survives a crash.
+    QByteArray dir(path);
+    int slash = dir.lastIndexOf('/');
+    dir = (slash < 0) ? QByteArray(".") : dir.left(slash > 0 ? slash : 1);
+    int fd = open(dir.constData(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    return true;
+}
+#endif
+
+/*
+ * Replace project file with model contents.
+ *
+ * The text is written to a temporary file which is synced to disk and then
+ * renamed over the project, so a crash never leaves a partial project.  The
+ * text is formatted into a buffer which is written in large blocks, so the
+ * stdio buffer is disabled to avoid copying it again.
+ */
+bool AtlasModel::save(const char* path) const
+{
+    QByteArray tmp(path);
+    tmp += ".tmp";
+
+    FILE* fp = fopen(tmp.constData(), "w");
+    if (! fp)
+        return false;
+    setvbuf(fp, NULL, _IONBF, 0);
+#ifndef _WIN32
+    copyMode(fp, path);
+#endif
+
+    QByteArray text;
+    text.reserve(SAVE_BUFFER + 64 * 1024);
+    appendHeader(text);
+
+    bool done = true;
+    int count = imageCount();
+    for (int i = 0; done && i < count; ++i) {
+        appendText(text, i, i + 1);
+        if (text.size() >= SAVE_BUFFER) {
+            done = writeAll(fp, text);
+            text.resize(0);
+        }
+    }
+    if (done && ! text.isEmpty())
+        done = writeAll(fp, text);
+    if (done)
+        done = syncFile(fp);
+
+    if (fclose(fp) != 0)
+        done = false;
+    if (done)
+        done = replaceFile(tmp.constData(), path);
+    if (! done)
+        remove(tmp.constData());
+    return done;
+}
+
+//----------------------------------------------------------------------------
+
+AtlasStreamReader::AtlasStreamReader(AtlasModel* model)
+    : _reader(new AtlReader)
+{
+    atl_readerInit(_reader, NULL, modelElement, model);
+}
+
+AtlasStreamReader::~AtlasStreamReader()
+{
+    atl_readerFree(_reader);
+    delete _reader;
+}
+
+/*
+ * Parse all complete items in data.
+ *
+ * Return false if a parse error occurs.  The errorLine() is then the line
+ * number of the error.
+ */
+bool AtlasStreamReader::feed(const char* data, int len)
+{
+    return atl_readerFeed(_reader, data, size_t(len)) != 0;
+}
+
+/*
+ * Parse any final item, which need not end with a newline.
+ */
+bool AtlasStreamReader::finish()
+{
+    return atl_readerFinish(_reader) != 0;
+}
+
+int AtlasStreamReader::errorLine() const
+{
+    return _reader->lineCount;
+}
@@ -0,0 +1,100 @@
+#ifndef ATLASMODEL_H
+#define ATLASMODEL_H
+//============================================================================
+//
+// Atlas Model
+//
+//============================================================================
+
+
+#include <stdint.h>
+#include <vector>
+#include <QByteArray>
+#include <QHash>
+
+/*
+ * Project data in flat arrays (one array per field).
+ *
+ * The regions of each image immediately follow those of the previous image,
+ * so image i owns regions [regionStart(i), regionEnd(i)).  Positions are in
+ * document coordinates.  Names are interned UTF-8 strings referenced by id.
+ *
+ * The model has no dependency on the GUI, so a copy can be saved or packed
+ * from any thread.
+ */
+class AtlasModel
+{
+public:
+    AtlasModel() : docW(0), docH(0) {}
+
+    void clear();
+    void reserve(int images, int regions);
+    uint32_t intern(const QByteArray& name);
+    const QByteArray& string(uint32_t id) const { return _strings[id]; }
+
+    int addImage(uint32_t serial, uint32_t name, int x, int y, int w, int h);
+    int addRegion(uint32_t serial, uint32_t name, int x, int y, int w, int h,
+                  int hotx, int hoty);
+
+    int imageCount() const { return int(imageX.size()); }
+    int regionCount() const { return int(regionX.size()); }
+    int regionStart(int i) const { return _regionStart[i]; }
+    int regionEnd(int i) const {
+        return (i + 1 < imageCount()) ? _regionStart[i + 1] : regionCount();
+    }
+    const QByteArray& imageName(int i) const { return _strings[imageNameId[i]]; }
+    const QByteArray& regionName(int i) const {
+        return _strings[regionNameId[i]];
+    }
+
+    bool load(const char* path, int* errorLine);
+    bool save(const char* path) const;
+    void appendHeader(QByteArray& text) const;
+    void appendText(QByteArray& text, int image, int end) const;
+
+    int docW, docH;
+
+    // Images
+    std::vector<int> imageX, imageY, imageW, imageH;
+    std::vector<uint32_t> imageSerial;  // Zero if not yet assigned.
+    std::vector<uint32_t> imageNameId;
+
+    // Regions
+    std::vector<int> regionX, regionY, regionW, regionH;
+    std::vector<int> regionHotX, regionHotY;
+    std::vector<uint32_t> regionSerial;
+    std::vector<uint32_t> regionNameId;
+    std::vector<uint32_t> regionParent; // Image index.
+
+private:
+    std::vector<int> _regionStart;
+    std::vector<QByteArray> _strings;
+    QHash<QByteArray, uint32_t> _stringId;
+};
+
+
+struct AtlReader;
+
+/*
+ * Parser for .atl text which arrives in pieces (e.g. from a pipe).  The text
+ * is parsed by the incremental atl_read reader, so items are appended to the
+ * model as soon as they are complete.
+ */
+class AtlasStreamReader
+{
+public:
+    AtlasStreamReader(AtlasModel* model);
+    ~AtlasStreamReader();
+
+    bool feed(const char* data, int len);
+    bool finish();
+    int errorLine() const;
+
+private:
+    AtlasStreamReader(const AtlasStreamReader&);
+    AtlasStreamReader& operator=(const AtlasStreamReader&);
+
+    AtlReader* _reader;
+};
+
+#endif  // ATLASMODEL_H
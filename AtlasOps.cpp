@@ -0,0 +1,315 @@
+//============================================================================
+//
+// Atlas Operations
+//
+//============================================================================
+
+
+#include <string.h>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QPainter>
+#include <QSet>
+#include "AtlasOps.h"
+#include "ImageCache.h"
+#include "ImageOps.h"
+#include "Packer.h"
+#include "Parallel.h"
+
+#define EXT_COUNT   4
+static const char* imageExt[EXT_COUNT] = { ".png", ".jpeg", ".jpg", ".ppm" };
+
+QStringList imageFilters()
+{
+    QStringList list;
+    char wild[8];
+
+    wild[0] = '*';
+    for (int i = 0; i < EXT_COUNT; ++i) {
+        strcpy(wild + 1, imageExt[i]);
+        list << QString(wild);
+    }
+    return list;
+}
+
+bool hasImageExt(const QString& path)
+{
+    for (int i = 0; i < EXT_COUNT; ++i) {
+        if (path.endsWith(QLatin1String(imageExt[i]), Qt::CaseInsensitive))
+            return true;
+    }
+    return false;
+}
+
+int addDirectoryImages(AtlasModel& model, const QDir& dir,
+                       const QString& imageDir)
+{
+    QSet<QString> present;
+    int count = model.imageCount();
+    for (int i = 0; i < count; ++i) {
+        QString name(QString::fromUtf8(model.imageName(i)));
+        present.insert(QFileInfo(dir.filePath(name)).absoluteFilePath());
+    }
+
+    QDir idir(dir.filePath(imageDir));
+    idir.setNameFilters(imageFilters());
+    const QStringList list = idir.entryList(QDir::Files, QDir::Name);
+    int added = 0;
+
+    for (const QString& fn : list) {
+        QString path(idir.absoluteFilePath(fn));
+        if (present.contains(path))
+            continue;
+        QSize size = QImageReader(path).size();
+        if (! size.isValid())
+            continue;
+        model.addImage(0, model.intern(path.toUtf8()), 0, 0,
+                       size.width(), size.height());
+        ++added;
+    }
+    return added;
+}
+
+int removeMissingImages(AtlasModel& model, const QDir& dir)
+{
+    std::vector<int> keep;
+    int count = model.imageCount();
+    keep.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        QString name(QString::fromUtf8(model.imageName(i)));
+        if (QFileInfo::exists(dir.filePath(name)))
+            keep.push_back(i);
+    }
+    if (int(keep.size()) == count)
+        return 0;
+
+    AtlasModel out;
+    out.docW = model.docW;
+    out.docH = model.docH;
+    for (int i : keep) {
+        out.addImage(model.imageSerial[i], out.intern(model.imageName(i)),
+                     model.imageX[i], model.imageY[i],
+                     model.imageW[i], model.imageH[i]);
+        int end = model.regionEnd(i);
+        for (int r = model.regionStart(i); r < end; ++r) {
+            out.addRegion(model.regionSerial[r],
+                          out.intern(model.regionName(r)),
+                          model.regionX[r], model.regionY[r],
+                          model.regionW[r], model.regionH[r],
+                          model.regionHotX[r], model.regionHotY[r]);
+        }
+    }
+    model = out;
+    return count - int(keep.size());
+}
+
+int updateImageSizes(AtlasModel& model, const QDir& dir, qint64 modifiedAfter)
+{
+    int changed = 0;
+    int count = model.imageCount();
+    for (int i = 0; i < count; ++i) {
+        QString path(dir.filePath(QString::fromUtf8(model.imageName(i))));
+        QFileInfo info(path);
+        if (info.lastModified().toMSecsSinceEpoch() <= modifiedAfter)
+            continue;
+        QSize size = QImageReader(path).size();
+        if (size.isValid() && (size.width() != model.imageW[i] ||
+                               size.height() != model.imageH[i])) {
+            model.imageW[i] = size.width();
+            model.imageH[i] = size.height();
+            ++changed;
+        }
+    }
+    return changed;
+}
+
+QImage loadModelImage(const AtlasModel& model, int i, const QDir& dir)
+{
+    QString name(QString::fromUtf8(model.imageName(i)));
+    return ImageCache::instance().load(dir.filePath(name));
+}
+
+static void placeModelImage(int i, int x, int y, void* user)
+{
+    AtlasModel& model = *(AtlasModel*) user;
+    int dx = x - model.imageX[i];
+    int dy = y - model.imageY[i];
+
+    model.imageX[i] = x;
+    model.imageY[i] = y;
+
+    int end = model.regionEnd(i);
+    for (int r = model.regionStart(i); r < end; ++r) {
+        model.regionX[r] += dx;
+        model.regionY[r] += dy;
+    }
+}
+
+int packModel(AtlasModel& model, int algo, int w, int h, int pad,
+              const std::vector<int>* subset)
+{
+    RectPacker packer(algo);
+
+    if (subset) {
+        for (int i : *subset) {
+            packer.addInput(i, model.imageX[i], model.imageY[i],
+                            model.imageW[i] + pad, model.imageH[i] + pad);
+        }
+    } else {
+        int count = model.imageCount();
+        for (int i = 0; i < count; ++i) {
+            packer.addInput(i, model.imageX[i], model.imageY[i],
+                            model.imageW[i] + pad, model.imageH[i] + pad);
+        }
+    }
+
+    return packer.pack(w, h, placeModelImage, &model);
+}
+
+#define DECODE_CHUNK    64      // Images decoded at once by compositeModel.
+
+struct DecodeJob
+{
+    const AtlasModel* model;
+    const QDir* dir;
+    int first;
+    QImage* images;
+};
+
+static void decodeImage(int i, void* user)
+{
+    DecodeJob& job = *(DecodeJob*) user;
+    job.images[i] = loadModelImage(*job.model, job.first + i, *job.dir);
+}
+
+QImage compositeModel(const AtlasModel& model, const QDir& dir, int* missing)
+{
+    int count = model.imageCount();
+    int w = model.docW;
+    int h = model.docH;
+
+    if (w <= 0 || h <= 0) {
+        w = h = 0;
+        for (int i = 0; i < count; ++i) {
+            w = qMax(w, model.imageX[i] + model.imageW[i]);
+            h = qMax(h, model.imageY[i] + model.imageH[i]);
+        }
+    }
+    if (missing)
+        *missing = 0;
+    if (w <= 0 || h <= 0)
+        return QImage();
+
+    QImage canvas(w, h, QImage::Format_ARGB32_Premultiplied);
+    canvas.fill(0);
+
+    // Images are decoded in parallel a chunk at a time to bound the memory
+    // held outside the ImageCache, then drawn in order.
+    QImage images[DECODE_CHUNK];
+    DecodeJob job;
+    job.model  = &model;
+    job.dir    = &dir;
+    job.images = images;
+
+    QPainter ip(&canvas);
+    for (job.first = 0; job.first < count; job.first += DECODE_CHUNK) {
+        int n = qMin(count - job.first, DECODE_CHUNK);
+        parallelFor(n, decodeImage, &job);
+        for (int c = 0; c < n; ++c) {
+            int i = job.first + c;
+            if (images[c].isNull()) {
+                if (missing)
+                    ++*missing;
+                continue;
+            }
+            ip.drawImage(model.imageX[i], model.imageY[i], images[c]);
+            images[c] = QImage();
+        }
+    }
+    ip.end();
+    return canvas;
+}
+
+enum CropResult { CROP_NONE, CROP_DONE, CROP_FAILED };
+
+struct CropJob
+{
+    const AtlasModel* model;
+    const QDir* dir;
+    QDir out;
+    std::vector<QRect> rects;
+    std::vector<QString> files;
+    std::vector<char> result;   // CropResult
+};
+
+static void cropImage(int i, void* user)
+{
+    CropJob& job = *(CropJob*) user;
+    QImage img = loadModelImage(*job.model, i, *job.dir);
+    QRect rect;
+    if (img.isNull() || ! cropAlpha(img, rect))
+        return;
+
+    job.rects[i] = rect;
+    job.result[i] = img.copy(rect).save(job.files[i]) ? CROP_DONE
+                                                      : CROP_FAILED;
+}
+
+int cropModel(AtlasModel& model, const QDir& dir, const QString& outDir,
+              QString* failedPath)
+{
+    int cropped = 0;
+    int count = model.imageCount();
+
+    // Images are decoded, cropped & encoded in parallel and the model is
+    // updated afterwards.
+    CropJob job;
+    job.model = &model;
+    job.dir   = &dir;
+    job.out   = QDir(dir.absoluteFilePath(outDir));
+    job.rects.resize(count);
+    job.files.resize(count);
+    job.result.resize(count, CROP_NONE);
+
+    // Images from different directories may share a file name, so each is
+    // given a unique output file before any are written.
+    QSet<QString> used;
+    for (int i = 0; i < count; ++i) {
+        QFileInfo info(QString::fromUtf8(model.imageName(i)));
+        QString file(info.fileName());
+        for (int n = 2; used.contains(file.toLower()); ++n) {
+            file = info.completeBaseName() + QChar('_') + QString::number(n);
+            if (! info.suffix().isEmpty())
+                file += QChar('.') + info.suffix();
+        }
+        used.insert(file.toLower());
+        job.files[i] = job.out.absoluteFilePath(file);
+    }
+
+    parallelFor(count, cropImage, &job);
+
+    for (int i = 0; i < count; ++i) {
+        if (job.result[i] == CROP_FAILED) {
+            if (failedPath)
+                *failedPath = job.files[i];
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (job.result[i] != CROP_DONE)
+            continue;
+
+        const QRect& rect = job.rects[i];
+        // Image names are relative to the project directory.
+        QString name(dir.relativeFilePath(job.files[i]));
+        model.imageNameId[i] = model.intern(name.toUtf8());
+        model.imageX[i] += rect.x();
+        model.imageY[i] += rect.y();
+        model.imageW[i] = rect.width();
+        model.imageH[i] = rect.height();
+        ++cropped;
+    }
+    return cropped;
+}
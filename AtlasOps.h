@@ -0,0 +1,92 @@
+#ifndef ATLASOPS_H
+#define ATLASOPS_H
+//============================================================================
+//
+// Atlas Operations
+//
+// The editing operations of Atlush which work on an AtlasModel rather than
+// the scene.  These only need QtGui (for QImage) so they can be used by
+// command line tools and build systems without the editor.
+//
+//============================================================================
+
+
+#include <QDir>
+#include <QImage>
+#include <QString>
+#include <QStringList>
+#include "AtlasModel.h"
+
+extern QStringList imageFilters();
+extern bool hasImageExt(const QString& path);
+
+/*
+ * Append the image files in imageDir which are not already in the model.
+ * Only the image headers are read to get the sizes.
+ *
+ * Return the number of images added.
+ */
+extern int addDirectoryImages(AtlasModel& model, const QDir& dir,
+                              const QString& imageDir);
+
+/*
+ * Remove images (and their regions) whose files no longer exist.
+ *
+ * Return the number of images removed.
+ */
+extern int removeMissingImages(AtlasModel& model, const QDir& dir);
+
+/*
+ * Read the size of images whose files were modified after the given time
+ * (in milliseconds since the epoch).  Only the image headers are read.
+ *
+ * Return the number of images whose size changed.
+ */
+extern int updateImageSizes(AtlasModel& model, const QDir& dir,
+                            qint64 modifiedAfter);
+
+/*
+ * Load the pixels of image i.  Relative image names are found in dir.
+ * Return a null image if the file cannot be read.
+ */
+extern QImage loadModelImage(const AtlasModel& model, int i, const QDir& dir);
+
+/*
+ * Pack images into the top-left corner of a w by h canvas.  The regions of
+ * each image move with it.
+ *
+ * \param algo      PackAlgorithm.
+ * \param pad       Pixels added to the right & bottom of each image.
+ * \param subset    Image indices to pack, or NULL for all images.
+ *
+ * Return the number of images which did not fit (these are not moved).
+ */
+extern int packModel(AtlasModel& model, int algo, int w, int h, int pad,
+                     const std::vector<int>* subset = NULL);
+
+/*
+ * Return an image of all the model images drawn at their positions.  The
+ * image is the document size, or the bounds of the images if the model has
+ * no document size.
+ *
+ * \param missing   If non-NULL, set to the number of image files which
+ *                  could not be read.
+ */
+extern QImage compositeModel(const AtlasModel& model, const QDir& dir,
+                             int* missing = NULL);
+
+/*
+ * Remove the transparent edges of each image.  Cropped images are written
+ * to outDir (with the same file name) and the model is changed to refer to
+ * the new files.  Images whose file names clash get a "_2", "_3", etc.
+ * suffix.  A relative outDir is found in dir, like the image names.  Image
+ * positions are adjusted so that the pixels and the regions do not move in
+ * the document.
+ *
+ * Return the number of images cropped, or -1 if a cropped image could not
+ * be written, in which case failedPath (if non-NULL) is set to the file name.
+ */
+extern int cropModel(AtlasModel& model, const QDir& dir, const QString& outDir,
+                     QString* failedPath = NULL);
+
+#endif  // ATLASOPS_H
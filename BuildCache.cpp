@@ -0,0 +1,174 @@
+//============================================================================
+//
+// Build Cache
+//
+//============================================================================
+
+
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include "BuildCache.h"
+
+#define CACHE_VERSION   "atlush-build-1"
+
+BuildCache::BuildCache(const QString& dir)
+    : _dir(dir), _hash(QCryptographicHash::Sha256)
+{
+}
+
+/*
+ * Start a new key.  Operations with different names never share entries.
+ */
+void BuildCache::begin(const char* operation)
+{
+    _hash.reset();
+    _key.clear();
+    _hash.addData(CACHE_VERSION, sizeof(CACHE_VERSION));
+    _hash.addData(operation, int(strlen(operation)) + 1);
+}
+
+void BuildCache::addData(const QByteArray& data)
+{
+    addInt(data.size());
+    _hash.addData(data);
+}
+
+void BuildCache::addInt(int64_t n)
+{
+    _hash.addData((const char*) &n, sizeof(n));
+}
+
+/*
+ * Add the name and content of a file.  Return false if it cannot be read,
+ * in which case the key will not match any stored entry.
+ */
+bool BuildCache::addFile(const QString& path)
+{
+    addData(path.toUtf8());
+
+    QFile file(path);
+    if (! file.open(QIODevice::ReadOnly)) {
+        addInt(-1);
+        return false;
+    }
+    addInt(file.size());
+    bool ok = _hash.addData(&file);
+    if (! ok)
+        addInt(-1);
+    return ok;
+}
+
+/*
+ * Return the hex digest of the inputs added since begin().
+ */
+QString BuildCache::key()
+{
+    if (_key.isEmpty())
+        _key = QString::fromLatin1(_hash.result().toHex());
+    return _key;
+}
+
+QString BuildCache::entryPath()
+{
+    // Two level layout keeps directories small with many entries.
+    QString k = key();
+    return _dir + '/' + k.left(2) + '/' + k.mid(2);
+}
+
+static QString entryFile(const QString& entry, int i, const QString& output)
+{
+    return entry + '/' + QString::number(i) + '-' +
+           QFileInfo(output).fileName();
+}
+
+/*
+ * Replace dst with a hard link to src, or a copy if linking fails (e.g. the
+ * cache is on another file system).
+ */
+static bool placeFile(const QString& src, const QString& dst)
+{
+    QFile::remove(dst);
+#ifdef _WIN32
+    if (CreateHardLinkW((LPCWSTR) dst.utf16(), (LPCWSTR) src.utf16(), NULL))
+        return true;
+#else
+    if (link(QFile::encodeName(src).constData(),
+             QFile::encodeName(dst).constData()) == 0)
+        return true;
+#endif
+    return QFile::copy(src, dst);
+}
+
+/*
+ * Place the stored outputs of the current key at the output paths.
+ *
+ * \param status    Set to the status saved with the entry.
+ *
+ * Return false if there is no entry for the key.
+ */
+bool BuildCache::fetch(const QStringList& outputs, int* status)
+{
+    QString entry = entryPath();
+    QFile sfile(entry + "/status");
+    if (! sfile.open(QIODevice::ReadOnly))
+        return false;
+    *status = sfile.readAll().trimmed().toInt();
+
+    for (int i = 0; i < outputs.size(); ++i) {
+        QString src = entryFile(entry, i, outputs[i]);
+        if (! QFileInfo::exists(src))
+            return false;
+    }
+    for (int i = 0; i < outputs.size(); ++i) {
+        if (! placeFile(entryFile(entry, i, outputs[i]), outputs[i]))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Save copies of the output files under the current key.  The entry is
+ * built in a temporary directory and renamed into place so that concurrent
+ * builds never see a partial entry.
+ */
+bool BuildCache::store(const QStringList& outputs, int status)
+{
+    QString entry = entryPath();
+    if (QFileInfo::exists(entry))
+        return true;
+
+    // Batch builds may store the same entry from several threads.
+    static QAtomicInt serial;
+    QString tmp = entry + ".tmp" +
+                  QString::number(QCoreApplication::applicationPid()) + "-" +
+                  QString::number(serial.fetchAndAddRelaxed(1));
+    QDir dir;
+    if (! dir.mkpath(tmp))
+        return false;
+
+    bool ok = true;
+    for (int i = 0; ok && i < outputs.size(); ++i)
+        ok = QFile::copy(outputs[i], entryFile(tmp, i, outputs[i]));
+
+    if (ok) {
+        QFile sfile(tmp + "/status");
+        ok = sfile.open(QIODevice::WriteOnly) &&
+             sfile.write(QByteArray::number(status)) > 0;
+        sfile.close();
+    }
+
+    if (! ok || ! dir.rename(tmp, entry)) {
+        QDir(tmp).removeRecursively();
+        return QFileInfo::exists(entry);    // Another build may have won.
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef BUILDCACHE_H
+#define BUILDCACHE_H
+//============================================================================
+//
+// Build Cache
+//
+//============================================================================
+
+
+#include <stdint.h>
+#include <QCryptographicHash>
+#include <QStringList>
+
+/*
+ * Content addressed store of build outputs.  The inputs of an operation
+ * (settings, project text & image files) are hashed to form a key, and the
+ * output files are kept in a directory named by that key.  When the same
+ * inputs are seen again the outputs are hard linked (or copied) into place
+ * rather than being built.
+ *
+ * Entries are never modified once stored, so outputs must be replaced
+ * rather than written in place.
+ */
+class BuildCache
+{
+public:
+    BuildCache(const QString& dir);
+
+    const QString& directory() const { return _dir; }
+
+    void begin(const char* operation);
+    void addData(const QByteArray& data);
+    void addInt(int64_t n);
+    bool addFile(const QString& path);
+    QString key();
+
+    bool fetch(const QStringList& outputs, int* status);
+    bool store(const QStringList& outputs, int status);
+
+private:
+    QString entryPath();
+
+    QString _dir;
+    QString _key;
+    QCryptographicHash _hash;
+};
+
+#endif  // BUILDCACHE_H
@@ -0,0 +1,563 @@
+//============================================================================
+//
+// Atlas Data Exporters
+//
+//============================================================================
+
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QtEndian>
+#include "DataExport.h"
+#include "FrameHash.h"
+
+#define WRITE_BUFFER    (1024 * 1024)   // Bytes formatted per write.
+
+static const char* formatNames[DF_Count] = {
+    "json-hash", "json-array", "c-header", "lua", "hash-c", "hash-bin",
+    "atlas-bin"
+};
+
+const char* dataFormatName(int format)
+{
+    return (format >= 0 && format < DF_Count) ? formatNames[format] : NULL;
+}
+
+int dataFormatByName(const char* name)
+{
+    for (int i = 0; i < DF_Count; ++i) {
+        if (strcmp(name, formatNames[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void modelFrames(const AtlasModel& model, std::vector<AtlasFrame>& frames)
+{
+    AtlasFrame fr;
+    int count = model.imageCount();
+
+    frames.clear();
+    frames.reserve(model.regionCount() + count);
+    for (int i = 0; i < count; ++i) {
+        int r   = model.regionStart(i);
+        int end = model.regionEnd(i);
+        if (r == end) {
+            QFileInfo info(QString::fromUtf8(model.imageName(i)));
+            fr.name = info.completeBaseName().toUtf8();
+            fr.x = model.imageX[i];
+            fr.y = model.imageY[i];
+            fr.w = model.imageW[i];
+            fr.h = model.imageH[i];
+            fr.hotx = fr.hoty = 0;
+            frames.push_back(fr);
+        }
+        for (; r < end; ++r) {
+            fr.name = model.regionName(r);
+            fr.x = model.regionX[r];
+            fr.y = model.regionY[r];
+            fr.w = model.regionW[r];
+            fr.h = model.regionH[r];
+            fr.hotx = model.regionHotX[r];
+            fr.hoty = model.regionHotY[r];
+            frames.push_back(fr);
+        }
+    }
+}
+
+/*
+ * The document size, or the bounds of the images if it is not set.
+ */
+static void atlasSize(const AtlasModel& model, int& w, int& h)
+{
+    w = model.docW;
+    h = model.docH;
+    if (w <= 0 || h <= 0) {
+        w = h = 0;
+        int count = model.imageCount();
+        for (int i = 0; i < count; ++i) {
+            w = qMax(w, model.imageX[i] + model.imageW[i]);
+            h = qMax(h, model.imageY[i] + model.imageH[i]);
+        }
+    }
+}
+
+struct DataWriter
+{
+    DataWriter(const QString& path) : file(path) {
+        ok = file.open(QIODevice::WriteOnly);
+        text.reserve(WRITE_BUFFER + 64 * 1024);
+    }
+
+    void format(const char* fmt, ...);
+    void flush(bool force = false) {
+        if (ok && (force || text.size() >= WRITE_BUFFER)) {
+            ok = (file.write(text) == text.size());
+            text.resize(0);
+        }
+    }
+    bool commit() {
+        flush(true);
+        return ok && file.commit();
+    }
+
+    QSaveFile file;
+    QByteArray text;
+    bool ok;
+};
+
+void DataWriter::format(const char* fmt, ...)
+{
+    char buf[256];
+    va_list args, copy;
+    va_start(args, fmt);
+    va_copy(copy, args);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    if (len < int(sizeof(buf))) {
+        text.append(buf, len);
+    } else {
+        int size = text.size();
+        text.resize(size + len + 1);
+        vsnprintf(text.data() + size, len + 1, fmt, copy);
+        text.resize(size + len);
+    }
+    va_end(copy);
+    va_end(args);
+}
+
+static void appendJsonString(QByteArray& text, const QByteArray& str)
+{
+    char esc[8];
+    text += '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            text += '\\';
+            text += c;
+        } else if ((unsigned char) c < 0x20) {
+            sprintf(esc, "\\u%04x", (unsigned char) c);
+            text += esc;
+        } else
+            text += c;
+    }
+    text += '"';
+}
+
+/*
+ * C & Lua strings.  Octal (C) and decimal (Lua) escapes are always three
+ * digits so that a following digit is not taken as part of them.
+ */
+static void appendCString(QByteArray& text, const QByteArray& str, bool lua)
+{
+    char esc[8];
+    text += '"';
+    for (char c : str) {
+        unsigned char uc = (unsigned char) c;
+        if (c == '"' || c == '\\') {
+            text += '\\';
+            text += c;
+        } else if (uc < 0x20 || uc == 0x7f || (! lua && c == '?')) {
+            // '?' is escaped to avoid C trigraphs.
+            sprintf(esc, lua ? "\\%03d" : "\\%03o", uc);
+            text += esc;
+        } else
+            text += c;
+    }
+    text += '"';
+}
+
+static void writeJson(DataWriter& out, const std::vector<AtlasFrame>& frames,
+                      bool hash, const QByteArray& image, int w, int h)
+{
+    out.text += hash ? "{\"frames\":{\n" : "{\"frames\":[\n";
+    size_t count = frames.size();
+    for (size_t i = 0; i < count; ++i) {
+        const AtlasFrame& fr = frames[i];
+        if (hash) {
+            appendJsonString(out.text, fr.name);
+            out.text += ":{";
+        } else {
+            out.text += "{\"filename\":";
+            appendJsonString(out.text, fr.name);
+            out.text += ',';
+        }
+        out.format("\"frame\":{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},"
+                   "\"rotated\":false,\"trimmed\":false,",
+                   fr.x, fr.y, fr.w, fr.h);
+        out.format("\"spriteSourceSize\":{\"x\":0,\"y\":0,"
+                   "\"w\":%d,\"h\":%d},\"sourceSize\":{\"w\":%d,\"h\":%d},",
+                   fr.w, fr.h, fr.w, fr.h);
+        // QByteArray::number ignores the locale, unlike printf %g.
+        out.text += "\"pivot\":{\"x\":";
+        out.text += QByteArray::number(fr.w ? double(fr.hotx) / fr.w : 0.0);
+        out.text += ",\"y\":";
+        out.text += QByteArray::number(fr.h ? double(fr.hoty) / fr.h : 0.0);
+        out.text += (i + 1 < count) ? "}},\n" : "}}\n";
+        out.flush();
+    }
+    out.text += hash ? "},\n" : "],\n";
+
+    out.text += "\"meta\":{\"app\":\"atlush\",\"version\":\"1.0\",\"image\":";
+    appendJsonString(out.text, image);
+    out.format(",\"format\":\"RGBA8888\",\"size\":{\"w\":%d,\"h\":%d},"
+               "\"scale\":\"1\"}\n}\n", w, h);
+}
+
+/*
+ * Return name as a C identifier.
+ */
+static QByteArray identifier(const QString& name)
+{
+    QByteArray id = name.toLatin1();
+    for (char& c : id) {
+        if (! ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+               (c >= '0' && c <= '9')))
+            c = '_';
+    }
+    if (id.isEmpty() || (id[0] >= '0' && id[0] <= '9'))
+        id.prepend("atlas_");
+    return id;
+}
+
+/*
+ * Write the start of a C header up to the frame table.
+ */
+static void writeCStart(DataWriter& out, const QByteArray& uid,
+                        const QByteArray& image, int w, int h, int count)
+{
+    out.format("#ifndef %s_H\n#define %s_H\n\n",
+               uid.constData(), uid.constData());
+    out.text +=
+        "#ifndef ATLUSH_FRAME_DEFINED\n"
+        "#define ATLUSH_FRAME_DEFINED\n"
+        "typedef struct {\n"
+        "    const char* name;\n"
+        "    int x, y, w, h;\n"
+        "    int hotx, hoty;\n"
+        "} AtlushFrame;\n\n"
+        "#ifdef __cplusplus\n"
+        "#define ATLUSH_TABLE constexpr\n"
+        "#else\n"
+        "#define ATLUSH_TABLE static const\n"
+        "#endif\n"
+        "#endif\n\n";
+
+    out.format("#define %s_IMAGE ", uid.constData());
+    appendCString(out.text, image, false);
+    out.format("\n\nenum {\n    %s_WIDTH = %d,\n    %s_HEIGHT = %d,\n"
+               "    %s_FRAME_COUNT = %d\n};\n\n",
+               uid.constData(), w, uid.constData(), h,
+               uid.constData(), count);
+}
+
+/*
+ * Write the frame table, in the order of slots if it is non-NULL.
+ */
+static void writeCFrames(DataWriter& out, const QByteArray& lid,
+                         const std::vector<AtlasFrame>& frames,
+                         const std::vector<uint32_t>* slots)
+{
+    out.format("ATLUSH_TABLE AtlushFrame %s_frames[] = {\n", lid.constData());
+    size_t count = frames.size();
+    for (size_t i = 0; i < count; ++i) {
+        const AtlasFrame& fr = frames[slots ? (*slots)[i] : i];
+        out.text += "    { ";
+        appendCString(out.text, fr.name, false);
+        out.format(", %d, %d, %d, %d, %d, %d },\n",
+                   fr.x, fr.y, fr.w, fr.h, fr.hotx, fr.hoty);
+        out.flush();
+    }
+    if (frames.empty())
+        out.text += "    { 0, 0, 0, 0, 0, 0, 0 }\n";     // No empty arrays.
+    out.text += "};\n\n";
+}
+
+static void writeCHeader(DataWriter& out,
+                         const std::vector<AtlasFrame>& frames,
+                         const QString& path, const QByteArray& image,
+                         int w, int h)
+{
+    QByteArray id = identifier(QFileInfo(path).completeBaseName());
+    QByteArray uid = id.toUpper();
+
+    out.text += "/* Atlas frames generated by Atlush. */\n";
+    writeCStart(out, uid, image, w, h, int(frames.size()));
+    writeCFrames(out, id.toLower(), frames, NULL);
+    out.format("#endif  /* %s_H */\n", uid.constData());
+}
+
+/*
+ * A C header with the frames in perfect hash order and a find function.
+ * The hash function must match frameHash().
+ */
+static void writeHashHeader(DataWriter& out,
+                            const std::vector<AtlasFrame>& frames,
+                            const FrameHash& hash, const QString& path,
+                            const QByteArray& image, int w, int h)
+{
+    QByteArray id = identifier(QFileInfo(path).completeBaseName());
+    QByteArray lid = id.toLower();
+    QByteArray uid = id.toUpper();
+    const char* l = lid.constData();
+    const char* u = uid.constData();
+
+    out.text += "/* Atlas frame lookup generated by Atlush. */\n"
+                "#include <stdint.h>\n#include <string.h>\n\n";
+    writeCStart(out, uid, image, w, h, int(frames.size()));
+    out.format("enum { %s_BUCKET_COUNT = %u };\n\n", u, hash.bucketCount);
+
+    out.format("ATLUSH_TABLE int32_t %s_seeds[] = {", l);
+    for (uint32_t b = 0; b < hash.bucketCount; ++b) {
+        if (b % 10)
+            out.format(" %d,", hash.seeds[b]);
+        else
+            out.format("\n    %d,", hash.seeds[b]);
+        out.flush();
+    }
+    out.text += "\n};\n\n";
+    writeCFrames(out, lid, frames, &hash.slots);
+
+    out.text +=
+        "#ifndef ATLUSH_HASH_DEFINED\n"
+        "#define ATLUSH_HASH_DEFINED\n"
+        "static inline uint32_t atlush_hash(const char* name, size_t len,\n"
+        "                                   uint32_t seed)\n"
+        "{\n"
+        "    const unsigned char* cp = (const unsigned char*) name;\n"
+        "    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);\n"
+        "    size_t i;\n"
+        "    for (i = 0; i < len; ++i) {\n"
+        "        h ^= cp[i];\n"
+        "        h *= 16777619u;\n"
+        "    }\n"
+        "    h ^= h >> 16;\n"
+        "    h *= 0x85ebca6bu;\n"
+        "    h ^= h >> 13;\n"
+        "    h *= 0xc2b2ae35u;\n"
+        "    h ^= h >> 16;\n"
+        "    return h;\n"
+        "}\n"
+        "#endif\n\n";
+
+    out.format(
+        "/* Return the frame with the given name, or NULL if there is\n"
+        "   none. */\n"
+        "static inline const AtlushFrame* %s_find(const char* name)\n"
+        "{\n"
+        "    size_t len = strlen(name);\n"
+        "    uint32_t i;\n"
+        "    int32_t seed;\n"
+        "    if (%s_FRAME_COUNT == 0)\n"
+        "        return 0;\n", l, u);
+    out.format(
+        "    seed = %s_seeds[atlush_hash(name, len, 0) %% %s_BUCKET_COUNT];\n"
+        "    if (seed < 0)\n"
+        "        i = (uint32_t) (-(int64_t) seed - 1);\n"
+        "    else\n"
+        "        i = atlush_hash(name, len, (uint32_t) seed) %% "
+        "%s_FRAME_COUNT;\n", l, u, u);
+    out.format(
+        "    return strcmp(%s_frames[i].name, name) ? 0 : &%s_frames[i];\n"
+        "}\n\n"
+        "#endif  /* %s_H */\n", l, l, u);
+}
+
+static void writeLua(DataWriter& out, const std::vector<AtlasFrame>& frames,
+                     const QByteArray& image, int w, int h)
+{
+    out.text += "-- Atlas frames generated by Atlush.\nreturn {\n  image = ";
+    appendCString(out.text, image, true);
+    out.format(",\n  width = %d,\n  height = %d,\n  frames = {\n", w, h);
+    for (const AtlasFrame& fr : frames) {
+        out.text += "    [";
+        appendCString(out.text, fr.name, true);
+        out.format("] = { x = %d, y = %d, w = %d, h = %d, "
+                   "hotx = %d, hoty = %d },\n",
+                   fr.x, fr.y, fr.w, fr.h, fr.hotx, fr.hoty);
+        out.flush();
+    }
+    out.text += "  },\n}\n";
+}
+
+static void appendWord(QByteArray& data, uint32_t v)
+{
+    uchar le[4];
+    qToLittleEndian(v, le);
+    data.append((const char*) le, 4);
+}
+
+struct StringTable
+{
+    uint32_t add(const QByteArray& str) {
+        auto it = offsets.constFind(str);
+        if (it != offsets.constEnd())
+            return *it;
+        uint32_t off = uint32_t(text.size());
+        text.append(str.constData(), str.size() + 1);   // With NUL.
+        offsets.insert(str, off);
+        return off;
+    }
+
+    QByteArray text;
+    QHash<QByteArray, uint32_t> offsets;
+};
+
+#define ATLB_HEADER_SIZE    64
+#define ATLB_PAGE_SIZE      16
+#define ATLB_ITEM_SIZE      32      // AtlbImage & AtlbRegion.
+
+/*
+ * Write the .atlb format read by atl_bin.h.  Region names are hashed if
+ * they are unique.
+ */
+static void writeAtlasBin(QByteArray& data, const AtlasModel& model,
+                          const QByteArray& image, int w, int h)
+{
+    uint32_t icount = uint32_t(model.imageCount());
+    uint32_t rcount = uint32_t(model.regionCount());
+
+    StringTable strings;
+    uint32_t pageName = strings.add(image);
+
+    std::vector<AtlasFrame> frames(rcount);
+    for (uint32_t r = 0; r < rcount; ++r)
+        frames[r].name = model.regionName(r);
+
+    FrameHash hash;
+    bool hashed = rcount && buildFrameHash(frames, hash) &&
+                  verifyFrameHash(frames, hash);
+    uint32_t buckets = hashed ? hash.bucketCount : 0;
+
+    uint32_t pageOffset   = ATLB_HEADER_SIZE;
+    uint32_t imageOffset  = pageOffset + ATLB_PAGE_SIZE;
+    uint32_t regionOffset = imageOffset + ATLB_ITEM_SIZE * icount;
+    uint32_t hashOffset   = regionOffset + ATLB_ITEM_SIZE * rcount;
+    uint32_t stringOffset = hashOffset + (buckets ? 4 * (buckets + rcount)
+                                                  : 0);
+
+    // Names are interned before the header is written as the string table
+    // size is needed.
+    std::vector<uint32_t> names(icount + rcount);
+    for (uint32_t i = 0; i < icount; ++i)
+        names[i] = strings.add(model.imageName(i));
+    for (uint32_t r = 0; r < rcount; ++r)
+        names[icount + r] = strings.add(model.regionName(r));
+    uint32_t stringBytes = uint32_t(strings.text.size());
+
+    data.reserve(int(stringOffset + stringBytes));
+    data.append("ATLB", 4);
+    appendWord(data, 1);
+    appendWord(data, stringOffset + stringBytes);
+    appendWord(data, 1);            // pageCount
+    appendWord(data, icount);
+    appendWord(data, rcount);
+    appendWord(data, buckets);
+    appendWord(data, stringBytes);
+    appendWord(data, pageOffset);
+    appendWord(data, imageOffset);
+    appendWord(data, regionOffset);
+    appendWord(data, hashOffset);
+    appendWord(data, stringOffset);
+    for (int i = 0; i < 3; ++i)
+        appendWord(data, 0);
+
+    appendWord(data, pageName);
+    appendWord(data, uint32_t(w));
+    appendWord(data, uint32_t(h));
+    appendWord(data, 0);
+
+    for (uint32_t i = 0; i < icount; ++i) {
+        uint32_t first = uint32_t(model.regionStart(i));
+        appendWord(data, names[i]);
+        appendWord(data, 0);        // page
+        appendWord(data, uint32_t(model.imageX[i]));
+        appendWord(data, uint32_t(model.imageY[i]));
+        appendWord(data, uint32_t(model.imageW[i]));
+        appendWord(data, uint32_t(model.imageH[i]));
+        appendWord(data, first);
+        appendWord(data, uint32_t(model.regionEnd(i)) - first);
+    }
+
+    for (uint32_t r = 0; r < rcount; ++r) {
+        appendWord(data, names[icount + r]);
+        appendWord(data, model.regionParent[r]);
+        appendWord(data, uint32_t(model.regionX[r]));
+        appendWord(data, uint32_t(model.regionY[r]));
+        appendWord(data, uint32_t(model.regionW[r]));
+        appendWord(data, uint32_t(model.regionH[r]));
+        appendWord(data, uint32_t(model.regionHotX[r]));
+        appendWord(data, uint32_t(model.regionHotY[r]));
+    }
+
+    if (buckets) {
+        for (int32_t seed : hash.seeds)
+            appendWord(data, uint32_t(seed));
+        for (uint32_t slot : hash.slots)
+            appendWord(data, slot);
+    }
+
+    data.append(strings.text);
+}
+
+bool exportData(const AtlasModel& model, int format, const QString& path,
+                const QString& imageFile, QString* error)
+{
+    std::vector<AtlasFrame> frames;
+    modelFrames(model, frames);
+
+    int w, h;
+    atlasSize(model, w, h);
+    QByteArray image = imageFile.toUtf8();
+
+    FrameHash hash;
+    if (format == DF_HashC || format == DF_HashBin) {
+        QByteArray dup;
+        QString msg;
+        if (! buildFrameHash(frames, hash, &dup))
+            msg = dup.isNull() ? QString("Cannot build frame hash")
+                    : "Duplicate frame name " + QString::fromUtf8(dup);
+        else
+            verifyFrameHash(frames, hash, &msg);
+        if (! msg.isEmpty()) {
+            if (error)
+                *error = msg;
+            return false;
+        }
+    }
+
+    DataWriter out(path);
+    switch (format) {
+        case DF_JsonHash:
+        case DF_JsonArray:
+            writeJson(out, frames, format == DF_JsonHash, image, w, h);
+            break;
+        case DF_CHeader:
+            writeCHeader(out, frames, path, image, w, h);
+            break;
+        case DF_Lua:
+            writeLua(out, frames, image, w, h);
+            break;
+        case DF_HashC:
+            writeHashHeader(out, frames, hash, path, image, w, h);
+            break;
+        case DF_HashBin:
+            appendFrameHashFile(out.text, frames, hash, w, h);
+            break;
+        case DF_AtlasBin:
+            writeAtlasBin(out.text, model, image, w, h);
+            break;
+        default:
+            if (error)
+                *error = QString("Unknown data format %1").arg(format);
+            return false;
+    }
+    if (! out.commit()) {
+        if (error)
+            *error = "Cannot write " + path + ": " + out.file.errorString();
+        return false;
+    }
+    return true;
+}
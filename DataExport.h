@@ -0,0 +1,62 @@
+#ifndef DATAEXPORT_H
+#define DATAEXPORT_H
+//============================================================================
+//
+// Atlas Data Exporters
+//
+// Built-in writers for formats which runtimes read directly, so that common
+// exports need no external pipeline command.
+//
+//============================================================================
+
+
+#include <vector>
+#include <QByteArray>
+#include <QString>
+#include "AtlasModel.h"
+
+enum DataFormat {
+    DF_JsonHash,        // TexturePacker JSON with frames keyed by name.
+    DF_JsonArray,       // TexturePacker JSON with a frames array.
+    DF_CHeader,         // C/C++ header with a constant region table.
+    DF_Lua,             // Lua table returned by the chunk.
+    DF_HashC,           // C header with a perfect hash name lookup.
+    DF_HashBin,         // Binary perfect hash table (see FrameHash.h).
+    DF_AtlasBin,        // Binary atlas read in place by atl_bin.h.
+    DF_Count
+};
+
+/*
+ * An exported sprite.  The frames of a model are its regions, plus each
+ * image which has no regions (named by its file name without extension).
+ * Positions are in document (atlas image) coordinates and the hotspot is
+ * relative to the frame.
+ */
+struct AtlasFrame {
+    QByteArray name;
+    int x, y, w, h;
+    int hotx, hoty;
+};
+
+extern void modelFrames(const AtlasModel& model,
+                        std::vector<AtlasFrame>& frames);
+
+extern const char* dataFormatName(int format);
+extern int dataFormatByName(const char* name);
+
+/*
+ * Write the frames of a model in one of the DataFormats.  The text is
+ * formatted in large blocks and the file is replaced atomically.  The
+ * perfect hash formats are verified before they are written.
+ *
+ * \param imageFile  Atlas image name recorded in the file.
+ * \param error      If non-NULL, set to a message on failure.
+ *
+ * Return false if the file could not be written, or if frame names are not
+ * unique in the hash formats.
+ */
+extern bool exportData(const AtlasModel& model, int format,
+                       const QString& path, const QString& imageFile,
+                       QString* error = NULL);
+
+#endif  // DATAEXPORT_H
@@ -0,0 +1,279 @@
+//============================================================================
+//
+// Frame Name Perfect Hash
+//
+//============================================================================
+
+
+#include <string.h>
+#include <algorithm>
+#include <QSet>
+#include <QtEndian>
+#include "DataExport.h"
+#include "FrameHash.h"
+
+#define BUCKET_SIZE     4           // Average names per bucket.
+#define MAX_SEED        (1 << 24)   // Give up on a bucket after this.
+#define HEADER_WORDS    8
+#define FRAME_WORDS     8
+
+/*
+ * FNV-1a with the seed mixed into the basis, followed by the MurmurHash3
+ * finalizer so that nearby seeds give unrelated slots.
+ */
+uint32_t frameHash(const char* name, int len, uint32_t seed)
+{
+    const unsigned char* cp = (const unsigned char*) name;
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (int i = 0; i < len; ++i) {
+        h ^= cp[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+uint32_t FrameHash::slot(const char* name, int len) const
+{
+    int32_t seed = seeds[frameHash(name, len, 0) % bucketCount];
+    if (seed < 0)
+        return uint32_t(-seed - 1);
+    return frameHash(name, len, uint32_t(seed)) % count;
+}
+
+bool buildFrameHash(const std::vector<AtlasFrame>& frames, FrameHash& hash,
+                    QByteArray* duplicate)
+{
+    uint32_t n = uint32_t(frames.size());
+    uint32_t r = (n + BUCKET_SIZE - 1) / BUCKET_SIZE;
+    if (r < 1)
+        r = 1;
+
+    {
+    QSet<QByteArray> names;
+    names.reserve(int(n));
+    for (const AtlasFrame& fr : frames) {
+        if (names.contains(fr.name)) {
+            if (duplicate)
+                *duplicate = fr.name;
+            return false;
+        }
+        names.insert(fr.name);
+    }
+    }
+
+    // Group the frames by bucket (counting sort).
+    std::vector<uint32_t> bucketStart(r + 1, 0);
+    std::vector<uint32_t> bucketOf(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        const QByteArray& name = frames[i].name;
+        bucketOf[i] = frameHash(name.constData(), name.size(), 0) % r;
+        ++bucketStart[bucketOf[i] + 1];
+    }
+    for (uint32_t b = 0; b < r; ++b)
+        bucketStart[b + 1] += bucketStart[b];
+    std::vector<uint32_t> members(n);
+    {
+    std::vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+    for (uint32_t i = 0; i < n; ++i)
+        members[fill[bucketOf[i]]++] = i;
+    }
+
+    // Place the largest buckets first while most slots are free.
+    std::vector<uint32_t> order(r);
+    for (uint32_t b = 0; b < r; ++b)
+        order[b] = b;
+    std::stable_sort(order.begin(), order.end(),
+        [&bucketStart](uint32_t a, uint32_t b) {
+            return bucketStart[a + 1] - bucketStart[a] >
+                   bucketStart[b + 1] - bucketStart[b];
+        });
+
+    hash.count = n;
+    hash.bucketCount = r;
+    hash.seeds.assign(r, 0);
+    hash.slots.assign(n, 0);
+
+    std::vector<char> taken(n, 0);
+    std::vector<uint32_t> trial;
+    uint32_t nextFree = 0;
+
+    for (uint32_t b : order) {
+        uint32_t first = bucketStart[b];
+        uint32_t size  = bucketStart[b + 1] - first;
+        if (size == 0)
+            break;
+
+        if (size == 1) {
+            while (taken[nextFree])
+                ++nextFree;
+            taken[nextFree] = 1;
+            hash.seeds[b] = -int32_t(nextFree) - 1;
+            hash.slots[nextFree] = members[first];
+            continue;
+        }
+
+        uint32_t seed;
+        for (seed = 1; seed < MAX_SEED; ++seed) {
+            trial.clear();
+            uint32_t k;
+            for (k = 0; k < size; ++k) {
+                const QByteArray& name = frames[members[first + k]].name;
+                uint32_t s = frameHash(name.constData(), name.size(), seed) % n;
+                if (taken[s] ||
+                    std::find(trial.begin(), trial.end(), s) != trial.end())
+                    break;
+                trial.push_back(s);
+            }
+            if (k == size)
+                break;
+        }
+        if (seed == MAX_SEED)
+            return false;       // Not seen in practice.
+
+        hash.seeds[b] = int32_t(seed);
+        for (uint32_t k = 0; k < size; ++k) {
+            taken[trial[k]] = 1;
+            hash.slots[trial[k]] = members[first + k];
+        }
+    }
+    return true;
+}
+
+bool verifyFrameHash(const std::vector<AtlasFrame>& frames,
+                     const FrameHash& hash, QString* error)
+{
+    uint32_t n = uint32_t(frames.size());
+    if (hash.count != n || hash.slots.size() != n || hash.bucketCount < 1 ||
+        hash.seeds.size() != hash.bucketCount) {
+        if (error)
+            *error = "Hash tables do not match the frames";
+        return false;
+    }
+
+    std::vector<char> used(n, 0);
+    for (uint32_t i = 0; i < n; ++i) {
+        const QByteArray& name = frames[i].name;
+        uint32_t s = hash.slot(name.constData(), name.size());
+        if (s >= n || used[s] || hash.slots[s] != i) {
+            if (error)
+                *error = QString("Collision for frame %1 in slot %2")
+                            .arg(QString::fromUtf8(name)).arg(s);
+            return false;
+        }
+        used[s] = 1;
+    }
+    return true;
+}
+
+static void appendWord(QByteArray& data, uint32_t v)
+{
+    uchar le[4];
+    qToLittleEndian(v, le);
+    data.append((const char*) le, 4);
+}
+
+void appendFrameHashFile(QByteArray& data,
+                         const std::vector<AtlasFrame>& frames,
+                         const FrameHash& hash, int width, int height)
+{
+    uint32_t stringBytes = 0;
+    for (const AtlasFrame& fr : frames)
+        stringBytes += uint32_t(fr.name.size()) + 1;
+
+    data.reserve(data.size() + 4 * (HEADER_WORDS + hash.bucketCount +
+                                    FRAME_WORDS * hash.count) + stringBytes);
+    data.append("ATLH", 4);
+    appendWord(data, 1);
+    appendWord(data, hash.count);
+    appendWord(data, hash.bucketCount);
+    appendWord(data, uint32_t(width));
+    appendWord(data, uint32_t(height));
+    appendWord(data, stringBytes);
+    appendWord(data, 0);
+
+    for (int32_t seed : hash.seeds)
+        appendWord(data, uint32_t(seed));
+
+    uint32_t offset = 0;
+    for (uint32_t i : hash.slots) {
+        const AtlasFrame& fr = frames[i];
+        appendWord(data, offset);
+        appendWord(data, uint32_t(fr.name.size()));
+        appendWord(data, uint32_t(fr.x));
+        appendWord(data, uint32_t(fr.y));
+        appendWord(data, uint32_t(fr.w));
+        appendWord(data, uint32_t(fr.h));
+        appendWord(data, uint32_t(fr.hotx));
+        appendWord(data, uint32_t(fr.hoty));
+        offset += uint32_t(fr.name.size()) + 1;
+    }
+
+    for (uint32_t i : hash.slots) {
+        const QByteArray& name = frames[i].name;
+        data.append(name.constData(), name.size() + 1);     // With NUL.
+    }
+}
+
+static bool hashFileError(QString* error, const char* msg)
+{
+    if (error)
+        *error = msg;
+    return false;
+}
+
+bool verifyFrameHashFile(const QByteArray& data, QString* error)
+{
+    const uchar* base = (const uchar*) data.constData();
+    size_t size = size_t(data.size());
+    if (size < 4 * HEADER_WORDS || memcmp(base, "ATLH", 4) != 0)
+        return hashFileError(error, "Not a frame hash file");
+    if (qFromLittleEndian<uint32_t>(base + 4) != 1)
+        return hashFileError(error, "Unknown frame hash version");
+
+    FrameHash hash;
+    hash.count       = qFromLittleEndian<uint32_t>(base + 8);
+    hash.bucketCount = qFromLittleEndian<uint32_t>(base + 12);
+    uint32_t stringBytes = qFromLittleEndian<uint32_t>(base + 24);
+
+    uint64_t expect = 4 * (uint64_t(HEADER_WORDS) + hash.bucketCount +
+                           uint64_t(FRAME_WORDS) * hash.count) + stringBytes;
+    if (hash.bucketCount < 1 || expect != size)
+        return hashFileError(error, "Frame hash file has the wrong size");
+
+    const uchar* cp = base + 4 * HEADER_WORDS;
+    hash.seeds.resize(hash.bucketCount);
+    for (uint32_t b = 0; b < hash.bucketCount; ++b, cp += 4)
+        hash.seeds[b] = int32_t(qFromLittleEndian<uint32_t>(cp));
+
+    const uchar* frames = cp;
+    const char* strings = (const char*) (frames + 4 * FRAME_WORDS * hash.count);
+
+    // Each frame must hash to its own slot, which also means that no two
+    // names are the same.
+    for (uint32_t i = 0; i < hash.count; ++i) {
+        const uchar* fp = frames + 4 * FRAME_WORDS * i;
+        uint32_t offset = qFromLittleEndian<uint32_t>(fp);
+        uint32_t len    = qFromLittleEndian<uint32_t>(fp + 4);
+        if (uint64_t(offset) + len >= stringBytes || strings[offset + len])
+            return hashFileError(error, "Frame name is out of bounds");
+
+        int32_t seed = hash.seeds[frameHash(strings + offset, int(len), 0) %
+                                  hash.bucketCount];
+        if (seed < 0 && uint32_t(-int64_t(seed) - 1) >= hash.count)
+            return hashFileError(error, "Seed is out of range");
+
+        if (hash.slot(strings + offset, int(len)) != i) {
+            if (error)
+                *error = QString("Collision for frame %1 in slot %2")
+                    .arg(QString::fromUtf8(strings + offset, int(len)))
+                    .arg(i);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef FRAMEHASH_H
+#define FRAMEHASH_H
+//============================================================================
+//
+// Frame Name Perfect Hash
+//
+//============================================================================
+
+
+#include <stdint.h>
+#include <vector>
+#include <QByteArray>
+#include <QString>
+
+struct AtlasFrame;
+
+/*
+ * Minimal perfect hash of frame names (CHD style hash & displace).
+ *
+ * A name is placed in bucket frameHash(name, 0) % bucketCount.  A
+ * non-negative seed for the bucket gives the slot frameHash(name, seed) %
+ * count, and a negative seed gives the slot -seed - 1 directly (used for
+ * buckets holding a single name).  Every name has its own slot from 0 to
+ * count-1, so a runtime needs one table lookup and one string compare to
+ * find a frame or to reject an unknown name.
+ */
+struct FrameHash
+{
+    uint32_t count;
+    uint32_t bucketCount;
+    std::vector<int32_t> seeds;     // Per bucket.
+    std::vector<uint32_t> slots;    // Frame index of each slot.
+
+    uint32_t slot(const char* name, int len) const;
+};
+
+extern uint32_t frameHash(const char* name, int len, uint32_t seed);
+
+/*
+ * Return false if the names are not unique, in which case duplicate (if
+ * non-NULL) is set to the first repeated name.
+ */
+extern bool buildFrameHash(const std::vector<AtlasFrame>& frames,
+                           FrameHash& hash, QByteArray* duplicate = NULL);
+
+/*
+ * Check that each frame is found in its own slot and that every slot is
+ * used once.  Return false and set error (if non-NULL) if not.
+ */
+extern bool verifyFrameHash(const std::vector<AtlasFrame>& frames,
+                            const FrameHash& hash, QString* error = NULL);
+
+/*
+ * Append the hash-bin data format: a header, the seeds, the frames in slot
+ * order, and the NUL terminated names.  All fields are little endian 32-bit
+ * integers:
+ *
+ *   Header     "ATLH", version (1), count, bucketCount, width, height,
+ *              stringBytes, zero
+ *   Seeds      int32[bucketCount]
+ *   Frames     [count] { nameOffset, nameLen, x, y, w, h, hotx, hoty }
+ *   Strings    char[stringBytes]
+ */
+extern void appendFrameHashFile(QByteArray& data,
+                                const std::vector<AtlasFrame>& frames,
+                                const FrameHash& hash, int width, int height);
+
+/*
+ * Check the tables of a file written with the hash-bin data format.
+ */
+extern bool verifyFrameHashFile(const QByteArray& data,
+                                QString* error = NULL);
+
+#endif  // FRAMEHASH_H
@@ -4,6 +4,7 @@
 #include <QFormLayout>
 #include <QLabel>
 #include <QLineEdit>
+#include <QProgressBar>
 #include <QPushButton>
 #include <QToolButton>
 #include "IOWidget.h"
@@ -26,11 +27,22 @@ IOWidget::IOWidget()
     _out = new QPushButton(QString::fromUtf8("Export \xc2\xbb"));
     connect(_out, SIGNAL(clicked(bool)), SLOT(emitExec()));
 
+    _busy = new QProgressBar;
+    _busy->setRange(0, 0);      // Busy indicator; commands report no progress.
+    _busy->setMaximumWidth(80);
+    _busy->hide();
+
+    _cancel = new QPushButton("Cancel");
+    _cancel->hide();
+    connect(_cancel, SIGNAL(clicked(bool)), SIGNAL(cancel()));
+
     QBoxLayout* lo = new QHBoxLayout(this);
     lo->addWidget(new QLabel("I/O:"));
     lo->addWidget(_pipeline);
     lo->addWidget(_in);
     lo->addWidget(_out);
+    lo->addWidget(_busy);
+    lo->addWidget(_cancel);
 }
 
 void IOWidget::emitExec()
@@ -52,6 +64,18 @@ void IOWidget::setSpec(const QString& spec)
     setEnabled(_pipeline->count() > 0);
 }
 
+/*
+ * Show the busy indicator & cancel button while a command is running.
+ */
+void IOWidget::setRunning(bool running)
+{
+    _pipeline->setEnabled(! running);
+    _in->setEnabled(! running);
+    _out->setEnabled(! running);
+    _busy->setVisible(running);
+    _cancel->setVisible(running);
+}
+
 //----------------------------------------------------------------------------
 
 IODialog::IODialog(QWidget* parent) : QDialog(parent)
@@ -205,7 +229,6 @@ void IODialog::cmdChanged()
 
 //----------------------------------------------------------------------------
 
-#include <stdlib.h>
 #include <QRegularExpression>
 
 static QString expandEnv(const QString& cmd)
@@ -228,26 +251,42 @@ static QString expandEnv(const QString& cmd)
 }
 
 /*
+ * Get the shell command to run for a pipeline.
+ *
  * \param spec      Pipeline specifications (name, import, & export).
  * \param pipeline  Pipeline index in spec.
- * \param push      Non-zero to run export comamnd, othersize do import.
+ * \param push      Non-zero to get export comamnd, othersize get import.
+ * \param cmd       Set to the command with environment variables expanded,
+ *                  or to an error description if false is returned.
+ * \param stream    Set to true if the command starts with a '|', in which
+ *                  case the marker is removed and the .atl text is passed
+ *                  through stdin or stdout rather than the $ATL file.
  */
-int io_execute(const QString& spec, int pipeline, int push, QString& cmd)
+bool io_command(const QString& spec, int pipeline, int push, QString& cmd,
+                bool* stream)
 {
     QStringList list = spec.split('\n');
     int count = list.size() / SPEC_SIZE;
     if (pipeline < 0 || pipeline >= count) {
         cmd = "<invalid pipeline>";
-        return -1;
+        return false;
     }
 
     push = push ? SPEC_EXPORT : SPEC_IMPORT;
     QString raw(list[pipeline * SPEC_SIZE + push]);
     if (raw.isEmpty()) {
         cmd = "<empty command>";
-        return -1;
+        return false;
     }
 
+    *stream = raw.startsWith('|');
+    if (*stream) {
+        raw = raw.mid(1).trimmed();
+        if (raw.isEmpty()) {
+            cmd = "<empty command>";
+            return false;
+        }
+    }
     cmd = expandEnv(raw);
-    return system(cmd.toUtf8().constData());
+    return true;
 }
@@ -10,6 +10,7 @@
 #include <QDialog>
 
 class QComboBox;
+class QProgressBar;
 class QPushButton;
 
 class IOWidget : public QWidget
@@ -19,9 +20,11 @@ class IOWidget : public QWidget
 public:
     IOWidget();
     void setSpec(const QString& spec);
+    void setRunning(bool);
 
 signals:
     void execute(int, int);
+    void cancel();
 
 private slots:
     void emitExec();
@@ -30,6 +33,8 @@ private:
     QComboBox* _pipeline;
     QPushButton* _in;
     QPushButton* _out;
+    QProgressBar* _busy;
+    QPushButton* _cancel;
 };
 
 
@@ -61,7 +66,8 @@ private:
 };
 
 
-int io_execute(const QString& spec, int pipeline, int push, QString&);
+bool io_command(const QString& spec, int pipeline, int push, QString& cmd,
+                bool* stream);
 
 
 #endif  // IOWIDGET_H
@@ -0,0 +1,78 @@
+//============================================================================
+//
+// Decoded Image Cache
+//
+//============================================================================
+
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include "ImageCache.h"
+
+#define DEFAULT_BUDGET  256     // MiB
+
+ImageCache& ImageCache::instance()
+{
+    static ImageCache cache;
+    return cache;
+}
+
+ImageCache::ImageCache()
+{
+    _cache.setMaxCost(DEFAULT_BUDGET * 1024);
+}
+
+void ImageCache::setBudget(int megabytes)
+{
+    QMutexLocker lock(&_mutex);
+    _cache.setMaxCost(megabytes * 1024);
+}
+
+int ImageCache::budget() const
+{
+    QMutexLocker lock(&_mutex);
+    return _cache.maxCost() / 1024;
+}
+
+void ImageCache::clear()
+{
+    QMutexLocker lock(&_mutex);
+    _cache.clear();
+}
+
+/*
+ * Return the decoded image of a file, or a null image if it cannot be read.
+ */
+QImage ImageCache::load(const QString& path)
+{
+    QFileInfo info(path);
+    if (! info.exists())
+        return QImage();
+
+    QString key = info.canonicalFilePath();
+    qint64 mtime = info.lastModified().toMSecsSinceEpoch();
+    qint64 size  = info.size();
+
+    {
+    QMutexLocker lock(&_mutex);
+    Entry* ent = _cache.object(key);        // Marks entry as recently used.
+    if (ent && ent->mtime == mtime && ent->size == size)
+        return ent->image;
+    }
+
+    // Decode without holding the lock so other threads are not blocked.
+    Entry* ent = new Entry;
+    ent->mtime = mtime;
+    ent->size  = size;
+    if (! ent->image.load(path)) {
+        delete ent;
+        return QImage();
+    }
+    QImage image = ent->image;
+
+    QMutexLocker lock(&_mutex);
+    int cost = int(qint64(image.bytesPerLine()) * image.height() / 1024) + 1;
+    _cache.insert(key, ent, cost);  // Deletes ent if cost exceeds budget.
+    return image;
+}
@@ -0,0 +1,44 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+//============================================================================
+//
+// Decoded Image Cache
+//
+//============================================================================
+
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QString>
+
+/*
+ * Process-wide cache of decoded image files.  Entries are keyed by
+ * canonical path and are only used while the file modification time & size
+ * are unchanged.  The least recently used images are dropped when the
+ * memory budget is exceeded.
+ */
+class ImageCache
+{
+public:
+    static ImageCache& instance();
+
+    QImage load(const QString& path);
+    void setBudget(int megabytes);
+    int budget() const;
+    void clear();
+
+private:
+    ImageCache();
+
+    struct Entry {
+        QImage image;
+        qint64 mtime;
+        qint64 size;
+    };
+
+    QCache<QString, Entry> _cache;  // Cost is in KiB.
+    mutable QMutex _mutex;
+};
+
+#endif  // IMAGECACHE_H
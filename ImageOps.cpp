@@ -0,0 +1,454 @@
+//============================================================================
+//
+// Image Operations
+//
+//============================================================================
+
+
+#include "ImageOps.h"
+#include "Parallel.h"
+
+static int testRowAlpha(QImage& img, int y, int w) {
+    QRgb rgb;
+    int x;
+    for (x = 0; x < w; ++x) {
+        rgb = img.pixel(x, y);
+        if (qAlpha(rgb) != 0)
+            return x;
+    }
+    return x;
+}
+
+static int testRowAlphaEnd(QImage& img, int y, int w) {
+    QRgb rgb;
+    int x;
+    for (x = w - 1; x > 0; --x) {
+        rgb = img.pixel(x, y);
+        if (qAlpha(rgb) != 0)
+            return x;
+    }
+    return x;
+}
+
+/*
+ * Find the smallest rectangle which holds all the non-transparent pixels.
+ *
+ * Return false if the image has no alpha channel, is completely transparent,
+ * or there is nothing to crop.
+ */
+bool cropAlpha(QImage& img, QRect& rect)
+{
+    if (! img.hasAlphaChannel() || img.isNull())
+        return false;
+
+    int x = 0;
+    int y, r;
+    int lx, hx;
+    int w = img.width();
+    int h = img.height();
+
+    for (y = 0; y < h; ++y) {
+        x = testRowAlpha(img, y, w);
+        if (x < w)
+            break;
+    }
+    if (y == h)
+        return false;   // Completely empty.
+    lx = x;
+
+    for (--h; h > y; --h) {
+        x = testRowAlpha(img, h, w);
+        if (x < w)
+            break;
+    }
+    if (y == 0 && h == (img.height() - 1))
+        return false;
+    if (x < lx)
+        lx = x;
+
+    // Find minimum X.
+    if (lx > 0) {
+        for (r = y+1; r < h; ++r) {
+            x = testRowAlpha(img, r, w);
+            if (x < lx) {
+                lx = x;
+                if (lx == 0)
+                    break;
+            }
+        }
+    }
+
+    // Find maximum X.
+    hx = 0;
+    for (r = y; r <= h; ++r) {
+        x = testRowAlphaEnd(img, r, w);
+        if (x > hx) {
+            hx = x;
+            if (hx == w-1)
+                break;
+        }
+    }
+
+    rect.setCoords(lx, y, hx, h);
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Connected components
+
+#define BLOB_BAND   64      // Rows scanned for runs per parallel task.
+
+struct BlobRun {
+    int x0, x1;             // Inclusive.
+};
+
+struct BlobScan {
+    const QImage* img;
+    int threshold;
+    int merge;
+    std::vector< std::vector<BlobRun> > bandRuns;
+    std::vector<int> rowRuns;   // Run count of each row.
+};
+
+/*
+ * Find the runs of opaque pixels in a band of rows.  Runs separated by no
+ * more than merge pixels are joined.
+ */
+static void scanBlobBand(int band, void* user)
+{
+    BlobScan& bs = *(BlobScan*) user;
+    std::vector<BlobRun>& runs = bs.bandRuns[band];
+    int w = bs.img->width();
+    int y0 = band * BLOB_BAND;
+    int y1 = qMin(y0 + BLOB_BAND, bs.img->height());
+    uint32_t limit = (uint32_t(bs.threshold) << 24) | 0xffffff;
+
+    for (int y = y0; y < y1; ++y) {
+        const uint32_t* row = (const uint32_t*) bs.img->constScanLine(y);
+        size_t first = runs.size();
+        BlobRun run;
+        int x = 0;
+        while (x < w) {
+            // Alpha is the top byte of ARGB32 pixels.
+            while (x < w && row[x] <= limit)
+                ++x;
+            if (x == w)
+                break;
+            run.x0 = x;
+            while (x < w && row[x] > limit)
+                ++x;
+            run.x1 = x - 1;
+
+            if (runs.size() > first &&
+                run.x0 - runs.back().x1 - 1 <= bs.merge)
+                runs.back().x1 = run.x1;
+            else
+                runs.push_back(run);
+        }
+        bs.rowRuns[y] = int(runs.size() - first);
+    }
+}
+
+static int findRoot(std::vector<int>& parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];      // Path halving.
+        i = parent[i];
+    }
+    return i;
+}
+
+static void unite(std::vector<int>& parent, int a, int b)
+{
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b)
+        parent[b] = a;
+    else if (b < a)
+        parent[a] = b;
+}
+
+/*
+ * A run grown right by the merge distance.  Spans of a grown row are the
+ * union of the runs of several rows.
+ */
+struct BlobSpan {
+    int x0, x1;             // Inclusive.
+    int run;                // Any run of the span.
+};
+
+typedef std::vector<BlobSpan> SpanList;
+
+static void rowSpans(const std::vector<BlobRun>& runs,
+                     const std::vector<int>& rowStart, int y, int merge,
+                     SpanList& out)
+{
+    out.clear();
+    for (int i = rowStart[y]; i < rowStart[y + 1]; ++i) {
+        BlobSpan sp = { runs[i].x0, runs[i].x1 + merge, i };
+        out.push_back(sp);
+    }
+}
+
+/*
+ * Set out to the union of two sorted span lists.  Spans which overlap or
+ * touch are joined, as are their blobs.
+ */
+static void unionSpans(const SpanList& a, const SpanList& b,
+                       std::vector<int>& parent, SpanList& out)
+{
+    size_t i = 0;
+    size_t j = 0;
+    out.clear();
+    while (i < a.size() || j < b.size()) {
+        const BlobSpan& sp = (j == b.size() ||
+                              (i < a.size() && a[i].x0 <= b[j].x0))
+                           ? a[i++] : b[j++];
+        if (! out.empty() && sp.x0 <= out.back().x1 + 1) {
+            BlobSpan& last = out.back();
+            if (sp.x1 > last.x1)
+                last.x1 = sp.x1;
+            unite(parent, last.run, sp.run);
+        } else
+            out.push_back(sp);
+    }
+}
+
+int findBlobs(const QImage& img, int threshold, int merge,
+              std::vector<QRect>& blobs)
+{
+    blobs.clear();
+    if (img.isNull())
+        return 0;
+
+    QImage conv;
+    const QImage* src = &img;
+    if (img.format() != QImage::Format_ARGB32 &&
+        img.format() != QImage::Format_ARGB32_Premultiplied) {
+        conv = img.convertToFormat(QImage::Format_ARGB32);
+        src = &conv;
+    }
+
+    int h = src->height();
+    int bands = (h + BLOB_BAND - 1) / BLOB_BAND;
+    BlobScan bs;
+    bs.img = src;
+    bs.threshold = qBound(0, threshold, 255);
+    bs.merge = qMax(0, merge);
+    bs.bandRuns.resize(bands);
+    bs.rowRuns.resize(h);
+    parallelFor(bands, scanBlobBand, &bs);
+
+    // Gather the runs with the index of the first run of each row.
+    std::vector<BlobRun> runs;
+    std::vector<int> rowStart(h + 1);
+    {
+    size_t total = 0;
+    for (const std::vector<BlobRun>& br : bs.bandRuns)
+        total += br.size();
+    runs.reserve(total);
+    for (std::vector<BlobRun>& br : bs.bandRuns) {
+        runs.insert(runs.end(), br.begin(), br.end());
+        std::vector<BlobRun>().swap(br);
+    }
+    rowStart[0] = 0;
+    for (int y = 0; y < h; ++y)
+        rowStart[y + 1] = rowStart[y] + bs.rowRuns[y];
+    }
+
+    // Join runs which are within merge pixels of each other.  Growing each
+    // run merge pixels right & down makes such runs touch, so only adjacent
+    // rows of the grown image need to be compared.  Grown row y is the union
+    // of rows y - merge to y.  It is made from the prefix unions of its block
+    // of merge + 1 rows and the suffix unions of the block before, so the
+    // work per row does not depend on merge.
+    int count = int(runs.size());
+    std::vector<int> parent(count);
+    for (int i = 0; i < count; ++i)
+        parent[i] = i;
+
+    int k = bs.merge + 1;
+    std::vector<SpanList> suffix(k);
+    SpanList prefix, row, window, above, tmp;
+
+    for (int start = 0; start < h; start += k) {
+        int prev = start - k;
+        if (prev >= 0 && k > 1) {
+            rowSpans(runs, rowStart, start - 1, bs.merge, suffix[k - 1]);
+            for (int j = k - 2; j > 0; --j) {
+                rowSpans(runs, rowStart, prev + j, bs.merge, row);
+                unionSpans(row, suffix[j + 1], parent, suffix[j]);
+            }
+        }
+
+        prefix.clear();
+        int end = qMin(start + k, h);
+        for (int y = start; y < end; ++y) {
+            rowSpans(runs, rowStart, y, bs.merge, row);
+            if (prefix.empty()) {
+                prefix.swap(row);
+            } else {
+                unionSpans(prefix, row, parent, tmp);
+                prefix.swap(tmp);
+            }
+
+            SpanList* grown = &prefix;
+            int j = y - start + 1;
+            if (prev >= 0 && j < k) {
+                unionSpans(suffix[j], prefix, parent, window);
+                grown = &window;
+            }
+
+            // Join with the grown row above (8-connected).
+            size_t i = 0;
+            size_t n = 0;
+            while (i < grown->size() && n < above.size()) {
+                const BlobSpan& sa = (*grown)[i];
+                const BlobSpan& sb = above[n];
+                if (sa.x0 <= sb.x1 + 1 && sb.x0 <= sa.x1 + 1)
+                    unite(parent, sa.run, sb.run);
+                if (sa.x1 < sb.x1)
+                    ++i;
+                else
+                    ++n;
+            }
+            // The prefix is still needed unless this ends the block.
+            if (grown != &prefix || y == end - 1)
+                above.swap(*grown);
+            else
+                above = *grown;
+        }
+    }
+
+    // Roots are the first run of each blob, so blob order follows the
+    // scan order.
+    std::vector<int> blobOf(count, -1);
+    for (int y = 0; y < h; ++y) {
+        for (int i = rowStart[y]; i < rowStart[y + 1]; ++i) {
+            int root = findRoot(parent, i);
+            int b = blobOf[root];
+            if (b < 0) {
+                b = blobOf[root] = int(blobs.size());
+                blobs.push_back(QRect(runs[i].x0, y, 1, 1));
+            }
+            QRect& rect = blobs[b];
+            if (runs[i].x0 < rect.left())
+                rect.setLeft(runs[i].x0);
+            if (runs[i].x1 > rect.right())
+                rect.setRight(runs[i].x1);
+            rect.setBottom(y);
+        }
+    }
+    return int(blobs.size());
+}
+
+
+//----------------------------------------------------------------------------
+// Cell grids
+
+/*
+ * Set cols & rows to the number of whole cells which fit in an image.  A
+ * cell dimension of zero spans the image (less the margins), which gives a
+ * single row or column strip.
+ */
+void CellGrid::fit(int width, int height)
+{
+    if (cellW < 1)
+        cellW = width - 2 * margin;
+    if (cellH < 1)
+        cellH = height - 2 * margin;
+    cols = rows = 0;
+    if (cellW > 0 && cellH > 0) {
+        cols = qMax(0, (width  - 2 * margin + spacing) / (cellW + spacing));
+        rows = qMax(0, (height - 2 * margin + spacing) / (cellH + spacing));
+    }
+}
+
+#define SCAN_BLOCK  16      // Pixels tested without a branch.
+
+/*
+ * Return true if any pixel in the span has an alpha above the limit.  The
+ * pixels are compared in blocks so that the inner loop has no early exit
+ * and can be vectorized.
+ */
+static bool spanOpaque(const uint32_t* px, int count, uint32_t limit)
+{
+    int i = 0;
+    for (; i + SCAN_BLOCK <= count; i += SCAN_BLOCK) {
+        uint32_t hit = 0;
+        for (int k = 0; k < SCAN_BLOCK; ++k)
+            hit |= uint32_t(px[i + k] > limit);
+        if (hit)
+            return true;
+    }
+    for (; i < count; ++i) {
+        if (px[i] > limit)
+            return true;
+    }
+    return false;
+}
+
+struct CellScan {
+    const QImage* img;
+    const CellGrid* grid;
+    uint32_t limit;
+    uint8_t* occupied;
+};
+
+// Test the cells of one grid row, a scanline at a time.
+static void scanCellRow(int row, void* user)
+{
+    const CellScan& cs = *(const CellScan*) user;
+    const CellGrid& grid = *cs.grid;
+    uint8_t* occ = cs.occupied + row * grid.cols;
+    int remain = grid.cols;
+    int y0 = grid.cell(0, row).y();
+
+    for (int y = y0; y < y0 + grid.cellH && remain; ++y) {
+        const uint32_t* line = (const uint32_t*) cs.img->constScanLine(y);
+        for (int col = 0; col < grid.cols; ++col) {
+            if (! occ[col] &&
+                spanOpaque(line + grid.margin + col * (grid.cellW +
+                                                       grid.spacing),
+                           grid.cellW, cs.limit)) {
+                occ[col] = 1;
+                --remain;
+            }
+        }
+    }
+}
+
+int markOccupiedCells(const QImage& img, const CellGrid& grid, int threshold,
+                      std::vector<uint8_t>& occupied)
+{
+    occupied.assign(size_t(grid.cols) * grid.rows, 0);
+    if (occupied.empty())
+        return 0;
+
+    QImage conv;
+    const QImage* src = &img;
+    if (img.format() != QImage::Format_ARGB32 &&
+        img.format() != QImage::Format_ARGB32_Premultiplied) {
+        conv = img.convertToFormat(QImage::Format_ARGB32);
+        src = &conv;
+    }
+
+    // The grid must lie within the image.
+    QRect last = grid.cell(grid.cols - 1, grid.rows - 1);
+    if (grid.margin < 0 || last.right() >= src->width() ||
+        last.bottom() >= src->height())
+        return 0;
+
+    CellScan cs;
+    cs.img = src;
+    cs.grid = &grid;
+    cs.limit = (uint32_t(qBound(0, threshold, 255)) << 24) | 0xffffff;
+    cs.occupied = occupied.data();
+    parallelFor(grid.rows, scanCellRow, &cs);
+
+    int count = 0;
+    for (uint8_t o : occupied)
+        count += o;
+    return count;
+}
@@ -0,0 +1,57 @@
+#ifndef IMAGEOPS_H
+#define IMAGEOPS_H
+//============================================================================
+//
+// Image Operations
+//
+//============================================================================
+
+
+#include <vector>
+#include <QImage>
+#include <QRect>
+
+extern bool cropAlpha(QImage& img, QRect& rect);
+
+/*
+ * Find the bounding rectangles of groups of connected opaque pixels
+ * (8-connected).
+ *
+ * \param threshold  Pixels with an alpha above this are opaque.
+ * \param merge      Groups separated by no more than this many transparent
+ *                   pixels are joined.
+ *
+ * Return the number of groups.  The rectangles are ordered by their top
+ * edge, then by the left edge of their first row.
+ */
+extern int findBlobs(const QImage& img, int threshold, int merge,
+                     std::vector<QRect>& blobs);
+
+/*
+ * Uniform cells of a tile or font sheet.  Cell (col, row) has its top left
+ * corner at margin + col * (cellW + spacing), margin + row * (cellH +
+ * spacing).
+ */
+struct CellGrid {
+    int cellW, cellH;
+    int spacing;
+    int margin;
+    int cols, rows;
+
+    void fit(int width, int height);
+    QRect cell(int col, int row) const {
+        return QRect(margin + col * (cellW + spacing),
+                     margin + row * (cellH + spacing), cellW, cellH);
+    }
+};
+
+/*
+ * Set occupied[row * cols + col] to 1 for each grid cell containing a pixel
+ * with an alpha above threshold, and to 0 for empty cells.
+ *
+ * Return the number of occupied cells.
+ */
+extern int markOccupiedCells(const QImage& img, const CellGrid& grid,
+                             int threshold, std::vector<uint8_t>& occupied);
+
+#endif  // IMAGEOPS_H
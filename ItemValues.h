@@ -4,11 +4,13 @@
 
 #define GIT_PIXMAP  QGraphicsPixmapItem::Type
 #define GIT_RECT    QGraphicsRectItem::Type
+#define GIT_LAYER   (QGraphicsItem::UserType + 1)   // RegionLayer::Type
 
 #define BG_Z        -1.0
 #define IS_IMAGE(gi)    (gi->type() == GIT_PIXMAP)
 #define IS_REGION(gi)   (gi->type() == GIT_RECT && gi->zValue() >= 0.0)
 #define IS_CANVAS(gi)   (gi->type() == GIT_RECT && gi->zValue() == BG_Z)
+#define IS_LAYER(gi)    (gi->type() == GIT_LAYER)
 
 // QGraphicsItem::data() key.
 enum ItemDataKey {
@@ -22,6 +24,7 @@ struct ItemValues {
 };
 
 extern void itemValues(ItemValues& iv, const QGraphicsItem* item);
+extern int regionHandleAt(const QRectF& br, const QPointF& pos);
 
 typedef QList<QGraphicsItem*> ItemList;
 
@@ -0,0 +1,360 @@
+/*
+  The journal is an append-only sidecar file which streams each undo step as
+  it is committed.  Changes which are not recorded as undo steps (adding,
+  removing, & renaming items) only mark the journal dirty, and a periodic
+  snapshot of the whole project is then written.  Each snapshot truncates
+  the file so it never grows far beyond the project size.
+
+  File layout (native byte order):
+
+    "ATJ1"
+    Records, each starting with an UndoValue header:
+      undo step     op.code = opcode, op.skipNext = values + 1, values...
+      undo/redo     op.code = JREC_UNDO/JREC_REDO, op.skipNext = 1
+      snapshot      op.code = JREC_SNAPSHOT, op.skipNext = 1,
+                    uint32_t byte size, payload...
+*/
+
+
+#include <string.h>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include "Journal.h"
+
+#define JOURNAL_MAGIC       "ATJ1"
+#define JOURNAL_BUFSIZE     (64 * 1024)
+#define COMPACT_STEPS       1024
+
+Journal::Journal()
+    : _fp(NULL), _stepCount(0), _changes(0), _dirty(false),
+      _unflushed(false), _suspended(false)
+{
+}
+
+Journal::~Journal()
+{
+    close();
+}
+
+/*
+ * Return the journal file path for a project.  Untitled projects are
+ * journaled in the application data directory.
+ */
+QString Journal::pathFor(const QString& projectPath)
+{
+    if (projectPath.isEmpty()) {
+        QString dir = QStandardPaths::writableLocation(
+                                        QStandardPaths::AppDataLocation);
+        QDir().mkpath(dir);
+        return dir + "/untitled.atl.journal";
+    }
+    return projectPath + ".journal";
+}
+
+void Journal::close()
+{
+    if (_fp) {
+        fclose(_fp);
+        _fp = NULL;
+    }
+    _unflushed = false;
+}
+
+/*
+ * Remove any current journal file and begin journaling for a new project
+ * path.  No file is created until the first change is recorded.
+ */
+void Journal::setTarget(const QString& projectPath)
+{
+    discard();
+    _path = pathFor(projectPath);
+}
+
+/*
+ * Close and delete the journal file.
+ */
+void Journal::discard()
+{
+    close();
+    if (! _path.isEmpty())
+        QFile::remove(_path);
+    _stepCount = 0;
+    _dirty = false;
+}
+
+bool Journal::wantSnapshot() const
+{
+    return ! _suspended && (_dirty || _stepCount >= COMPACT_STEPS);
+}
+
+/*
+ * Append an undo step.  This only copies into the stdio buffer; flush() is
+ * called periodically to push the data to the file.
+ */
+void Journal::step(uint16_t opcode, const UndoValue* data, int count)
+{
+    if (_suspended)
+        return;
+    ++_changes;
+    if (! _fp) {
+        // There is no base snapshot yet; the next one will contain the step.
+        _dirty = true;
+        return;
+    }
+
+    UndoValue head;
+    head.op.code = opcode;
+    head.op.skipNext = count + 1;
+    head.op.skipPrev = 0;
+    fwrite(&head, sizeof(UndoValue), 1, _fp);
+    fwrite(data, sizeof(UndoValue), count, _fp);
+    ++_stepCount;
+    _unflushed = true;
+}
+
+/*
+ * Append an undo or redo marker.
+ */
+void Journal::mark(uint16_t code)
+{
+    step(code, NULL, 0);
+}
+
+void Journal::flush()
+{
+    if (_unflushed) {
+        fflush(_fp);
+        _unflushed = false;
+    }
+}
+
+static void appendU32(QByteArray& buf, uint32_t n)
+{
+    buf.append((const char*) &n, sizeof(n));
+}
+
+static void appendStr(QByteArray& buf, const QByteArray& str)
+{
+    appendU32(buf, str.size());
+    buf.append(str);
+}
+
+/*
+ * Replace the journal contents with a snapshot of the whole project.
+ *
+ * The snapshot is written to a temporary file which is then renamed over
+ * the journal so that a crash here never leaves an empty journal behind.
+ */
+bool Journal::snapshot(const JournalSnapshot& snap)
+{
+    if (_path.isEmpty())
+        return false;
+
+    const AtlasModel& model = snap.model;
+    int images  = model.imageCount();
+    int regions = model.regionCount();
+    QByteArray buf;
+    buf.reserve(64 + (images + regions) * 48 +
+                snap.undo.size() * sizeof(UndoValue));
+    appendU32(buf, model.docW);
+    appendU32(buf, model.docH);
+    appendU32(buf, snap.serialNo);
+    appendU32(buf, images + regions);
+
+    // Items are written as (serial, parent serial, x, y, w, h, hotx, hoty,
+    // name) with each image followed by its regions.  Images have a zero
+    // parent.
+    for (int i = 0; i < images; ++i) {
+        appendU32(buf, model.imageSerial[i]);
+        appendU32(buf, 0);
+        appendU32(buf, model.imageX[i]);
+        appendU32(buf, model.imageY[i]);
+        appendU32(buf, model.imageW[i]);
+        appendU32(buf, model.imageH[i]);
+        appendU32(buf, 0);
+        appendU32(buf, 0);
+        appendStr(buf, model.imageName(i));
+
+        int end = model.regionEnd(i);
+        for (int r = model.regionStart(i); r != end; ++r) {
+            appendU32(buf, model.regionSerial[r]);
+            appendU32(buf, model.imageSerial[i]);
+            appendU32(buf, model.regionX[r]);
+            appendU32(buf, model.regionY[r]);
+            appendU32(buf, model.regionW[r]);
+            appendU32(buf, model.regionH[r]);
+            appendU32(buf, model.regionHotX[r]);
+            appendU32(buf, model.regionHotY[r]);
+            appendStr(buf, model.regionName(r));
+        }
+    }
+    appendU32(buf, snap.undoUsed);
+    appendU32(buf, snap.undoPos);
+    buf.append((const char*) snap.undo.data(),
+               snap.undo.size() * sizeof(UndoValue));
+
+    QByteArray file(QFile::encodeName(_path));
+    QByteArray tmp(file + ".tmp");
+    FILE* fp = fopen(tmp.constData(), "wb");
+    if (! fp)
+        return false;
+
+    UndoValue head;
+    head.op.code = JREC_SNAPSHOT;
+    head.op.skipNext = 1;
+    head.op.skipPrev = 0;
+    uint32_t size = buf.size();
+
+    bool ok = (fwrite(JOURNAL_MAGIC, 1, 4, fp) == 4 &&
+               fwrite(&head, sizeof(head), 1, fp) == 1 &&
+               fwrite(&size, sizeof(size), 1, fp) == 1 &&
+               fwrite(buf.constData(), 1, size, fp) == size);
+    if (fclose(fp) != 0)
+        ok = false;
+    if (! ok) {
+        remove(tmp.constData());
+        return false;
+    }
+
+    close();
+#ifdef _WIN32
+    remove(file.constData());
+#endif
+    if (rename(tmp.constData(), file.constData()) != 0)
+        return false;
+
+    _fp = fopen(file.constData(), "ab");
+    if (_fp)
+        setvbuf(_fp, NULL, _IOFBF, JOURNAL_BUFSIZE);
+    _stepCount = 0;
+    _dirty = false;
+    return _fp != NULL;
+}
+
+struct JournalReader {
+    const char* it;
+    const char* end;
+
+    bool u32(uint32_t& n) {
+        if (end - it < 4)
+            return false;
+        memcpy(&n, it, 4);
+        it += 4;
+        return true;
+    }
+
+    bool i32(int& n) {
+        uint32_t u;
+        if (! u32(u))
+            return false;
+        n = int32_t(u);
+        return true;
+    }
+
+    bool str(QByteArray& s) {
+        uint32_t len;
+        if (! u32(len) || uint32_t(end - it) < len)
+            return false;
+        s = QByteArray(it, len);
+        it += len;
+        return true;
+    }
+};
+
+static bool readSnapshot(JournalReader& rd, JournalSnapshot& snap)
+{
+    AtlasModel& model = snap.model;
+    uint32_t count;
+    uint32_t serial, parent;
+    int x, y, w, h, hotx, hoty;
+    QByteArray name;
+
+    model.clear();
+    if (! rd.i32(model.docW) || ! rd.i32(model.docH) ||
+        ! rd.u32(snap.serialNo) || ! rd.u32(count))
+        return false;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (! rd.u32(serial) || ! rd.u32(parent) ||
+            ! rd.i32(x) || ! rd.i32(y) || ! rd.i32(w) || ! rd.i32(h) ||
+            ! rd.i32(hotx) || ! rd.i32(hoty) || ! rd.str(name))
+            return false;
+
+        if (! parent)
+            model.addImage(serial, model.intern(name), x, y, w, h);
+        else if (model.imageCount() &&
+                 model.imageSerial.back() == parent)
+            model.addRegion(serial, model.intern(name), x, y, w, h,
+                            hotx, hoty);
+    }
+
+    if (! rd.u32(snap.undoUsed) || ! rd.u32(snap.undoPos))
+        return false;
+    size_t bytes = (snap.undoUsed + 1) * sizeof(UndoValue);
+    if (size_t(rd.end - rd.it) < bytes)
+        return false;
+    snap.undo.resize(snap.undoUsed + 1);
+    memcpy(snap.undo.data(), rd.it, bytes);
+    rd.it += bytes;
+    return true;
+}
+
+/*
+ * Read the last snapshot in a journal and the records which follow it.
+ *
+ * The steps vector is filled with records in the undo stack layout (an
+ * op header followed by op.skipNext - 1 values).  A truncated record at the
+ * end of the file (from a crash mid-write) is ignored.
+ *
+ * Return false if the file cannot be read or contains no snapshot.
+ */
+bool Journal::load(const QString& path, JournalSnapshot& snap,
+                   std::vector<UndoValue>& steps)
+{
+    QFile file(path);
+    if (! file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray data = file.readAll();
+    if (data.size() < 4 || memcmp(data.constData(), JOURNAL_MAGIC, 4) != 0)
+        return false;
+
+    JournalReader rd;
+    rd.it  = data.constData() + 4;
+    rd.end = data.constData() + data.size();
+
+    bool haveSnap = false;
+    UndoValue head;
+    steps.clear();
+
+    while (size_t(rd.end - rd.it) >= sizeof(UndoValue)) {
+        memcpy(&head, rd.it, sizeof(UndoValue));
+        if (head.op.skipNext < 1)
+            break;
+
+        if (head.op.code == JREC_SNAPSHOT) {
+            uint32_t size;
+            rd.it += sizeof(UndoValue);
+            if (! rd.u32(size) || uint32_t(rd.end - rd.it) < size)
+                break;
+            JournalReader sub;
+            sub.it  = rd.it;
+            sub.end = rd.it + size;
+            if (! readSnapshot(sub, snap))
+                break;
+            rd.it += size;
+            haveSnap = true;
+            steps.clear();
+        } else {
+            size_t bytes = head.op.skipNext * sizeof(UndoValue);
+            if (size_t(rd.end - rd.it) < bytes)
+                break;
+            size_t n = steps.size();
+            steps.resize(n + head.op.skipNext);
+            memcpy(steps.data() + n, rd.it, bytes);
+            rd.it += bytes;
+        }
+    }
+    return haveSnap;
+}
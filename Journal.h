@@ -0,0 +1,66 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+//============================================================================
+//
+// Crash Recovery Journal
+//
+//============================================================================
+
+
+#include <stdio.h>
+#include <vector>
+#include <QByteArray>
+#include <QString>
+#include "AtlasModel.h"
+#include "undo.h"
+
+// Journal record codes which are not undo opcodes.
+enum JournalRecord {
+    JREC_REDO     = 0xfffd,
+    JREC_UNDO     = 0xfffe,
+    JREC_SNAPSHOT = 0xffff
+};
+
+struct JournalSnapshot {
+    AtlasModel model;                   // Includes serial numbers.
+    uint32_t serialNo;
+    uint32_t undoUsed;
+    uint32_t undoPos;
+    std::vector<UndoValue> undo;        // Stack values & terminator.
+};
+
+class Journal
+{
+public:
+    Journal();
+    ~Journal();
+
+    void setTarget(const QString& projectPath);
+    void discard();
+    void touch() { _dirty = true; ++_changes; }
+    void suspend(bool on) { _suspended = on; }
+    bool wantSnapshot() const;
+    void step(uint16_t opcode, const UndoValue* data, int count);
+    void mark(uint16_t code);
+    bool snapshot(const JournalSnapshot&);
+    void flush();
+    const QString& path() const { return _path; }
+    uint32_t changes() const { return _changes; }
+
+    static QString pathFor(const QString& projectPath);
+    static bool load(const QString& path, JournalSnapshot& snap,
+                     std::vector<UndoValue>& steps);
+
+private:
+    void close();
+
+    FILE* _fp;
+    QString _path;
+    uint32_t _stepCount;    // Steps written since last snapshot.
+    uint32_t _changes;      // Count of steps & touches.
+    bool _dirty;            // Changes were made which steps don't cover.
+    bool _unflushed;
+    bool _suspended;
+};
+
+#endif  // JOURNAL_H
@@ -0,0 +1,265 @@
+/*
+  NameIndex keeps the names of scene items in a flat array with a trigram
+  index so that searches do not need to walk the scene.  Entries of removed
+  or renamed items are only marked dead and are compacted away later.
+*/
+
+
+#include <QBrush>
+#include <QGraphicsItem>
+#include <QRegularExpression>
+#include "ItemValues.h"
+#include "NameIndex.h"
+#include "RegionLayer.h"
+
+#define GRAM_KEY(cp) \
+    ((quint64(cp[0].unicode()) << 32) | (quint64(cp[1].unicode()) << 16) | \
+     quint64(cp[2].unicode()))
+
+void NameIndex::clear()
+{
+    _entries.clear();
+    _lookup.clear();
+    _grams.clear();
+    _dead = 0;
+}
+
+void NameIndex::addGrams(int id)
+{
+    const QString& name = _entries[id].name;
+    const QChar* cp = name.constData();
+    int count = name.size() - 2;
+
+    for (int i = 0; i < count; ++i, ++cp) {
+        std::vector<int>& list = _grams[GRAM_KEY(cp)];
+        if (list.empty() || list.back() != id)
+            list.push_back(id);
+    }
+}
+
+/*
+ * Add item or update the name or item of a serial number already in the
+ * index.
+ */
+void NameIndex::insert(QGraphicsItem* item, uint32_t serial,
+                       const QString& name)
+{
+    remove(serial);
+
+    Entry ent;
+    ent.name = name;
+    ent.item = item;
+    ent.serial = serial;
+
+    int id = int(_entries.size());
+    _entries.push_back(ent);
+    _lookup.insert(serial, id);
+    addGrams(id);
+}
+
+void NameIndex::remove(uint32_t serial)
+{
+    auto it = _lookup.find(serial);
+    if (it != _lookup.end()) {
+        _entries[it.value()].item = NULL;
+        _lookup.erase(it);
+        ++_dead;
+    }
+}
+
+/*
+ * Remove item and all of its children (which the scene deletes with it).
+ */
+void NameIndex::removeTree(QGraphicsItem* item)
+{
+    for (QGraphicsItem* ch : item->childItems()) {
+        if (IS_LAYER(ch)) {
+            const RegionLayer* layer = static_cast<const RegionLayer*>(ch);
+            for (int i = 0; i < layer->count(); ++i)
+                remove(layer->region(i).serial);
+        } else
+            remove(ch->data(ID_SERIAL).toUInt());
+    }
+    remove(item->data(ID_SERIAL).toUInt());
+}
+
+/*
+ * Add item and all of its children (the reverse of removeTree).
+ */
+void NameIndex::insertTree(QGraphicsItem* item)
+{
+    insert(item, item->data(ID_SERIAL).toUInt(),
+           item->data(ID_NAME).toString());
+    for (QGraphicsItem* ch : item->childItems()) {
+        if (IS_LAYER(ch)) {
+            RegionLayer* layer = static_cast<RegionLayer*>(ch);
+            for (int i = 0; i < layer->count(); ++i)
+                insert(layer, layer->region(i).serial, layer->name(i));
+        } else
+            insert(ch, ch->data(ID_SERIAL).toUInt(),
+                   ch->data(ID_NAME).toString());
+    }
+}
+
+void NameIndex::compact()
+{
+    std::vector<Entry> live;
+    live.reserve(_entries.size() - _dead);
+    for (const Entry& ent : _entries) {
+        if (ent.item)
+            live.push_back(ent);
+    }
+    _entries.swap(live);
+
+    _lookup.clear();
+    _grams.clear();
+    _dead = 0;
+    int count = int(_entries.size());
+    for (int id = 0; id < count; ++id) {
+        _lookup.insert(_entries[id].serial, id);
+        addGrams(id);
+    }
+}
+
+/*
+ * Return the shortest posting list for the trigrams of literal, or NULL if
+ * any trigram is not present (no name can contain the literal).
+ */
+const std::vector<int>* NameIndex::candidates(const QString& literal) const
+{
+    static const std::vector<int> none;
+    const std::vector<int>* best = NULL;
+    const QChar* cp = literal.constData();
+    int count = literal.size() - 2;
+
+    for (int i = 0; i < count; ++i, ++cp) {
+        auto it = _grams.constFind(GRAM_KEY(cp));
+        if (it == _grams.constEnd())
+            return &none;
+        if (! best || it.value().size() < best->size())
+            best = &it.value();
+    }
+    return best;
+}
+
+// Convert shell wildcards to a regular expression.  Unlike
+// QRegularExpression::wildcardToRegularExpression(), '*' also matches '/'
+// as image names are usually file paths.
+static QString globToRegex(const QString& glob, QString& literal)
+{
+    QString rx("^");
+    QString run;
+    bool inClass = false;
+
+    for (QChar ch : glob) {
+        if (inClass) {
+            rx.append(ch);
+            if (ch == ']')
+                inClass = false;
+            continue;
+        }
+        switch (ch.unicode()) {
+            case '*':
+                rx.append(".*");
+                break;
+            case '?':
+                rx.append('.');
+                break;
+            case '[':
+                rx.append(ch);
+                inClass = true;
+                break;
+            default:
+                rx.append(QRegularExpression::escape(QString(ch)));
+                run.append(ch);
+                if (run.size() > literal.size())
+                    literal = run;
+                continue;
+        }
+        run.clear();
+    }
+    rx.append('$');
+    return rx;
+}
+
+/*
+ * Find the names which match pattern.
+ *
+ * \param mode      SearchMode.
+ * \param results   Set to the entry ids of all matching items.
+ *
+ * Return false if the pattern is not a valid regular expression.
+ */
+bool NameIndex::search(const QString& pattern, int mode,
+                       std::vector<int>& results)
+{
+    QRegularExpression rx;
+    QString literal;
+
+    if (_dead > 1024 && _dead > int(_entries.size() / 2))
+        compact();
+    results.clear();
+
+    switch (mode) {
+        case SEARCH_GLOB:
+            rx.setPattern(globToRegex(pattern, literal));
+            break;
+        case SEARCH_REGEX:
+            rx.setPattern(pattern);
+            if (! rx.isValid())
+                return false;
+            break;
+        default:
+            literal = pattern;
+            break;
+    }
+
+    const std::vector<int>* list = NULL;
+    if (literal.size() >= 3)
+        list = candidates(literal);
+
+    if (list) {
+        for (int id : *list) {
+            const Entry& ent = _entries[id];
+            if (! ent.item || ! ent.name.contains(literal))
+                continue;
+            if (mode == SEARCH_TEXT || rx.match(ent.name).hasMatch())
+                results.push_back(id);
+        }
+    } else {
+        int count = int(_entries.size());
+        for (int id = 0; id < count; ++id) {
+            const Entry& ent = _entries[id];
+            if (! ent.item)
+                continue;
+            if (mode == SEARCH_TEXT ? ent.name.contains(literal)
+                                    : rx.match(ent.name).hasMatch())
+                results.push_back(id);
+        }
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void SearchResults::setResults(std::vector<int>& ids)
+{
+    beginResetModel();
+    _ids.swap(ids);
+    endResetModel();
+}
+
+int SearchResults::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : int(_ids.size());
+}
+
+QVariant SearchResults::data(const QModelIndex& index, int role) const
+{
+    int id = _ids[index.row()];
+    if (role == Qt::DisplayRole)
+        return _index->name(id);
+    if (role == Qt::ForegroundRole && ! _index->item(id))
+        return QBrush(Qt::gray);    // Item was removed.
+    return QVariant();
+}
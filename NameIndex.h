@@ -0,0 +1,76 @@
+#ifndef NAMEINDEX_H
+#define NAMEINDEX_H
+//============================================================================
+//
+// Item Name Index
+//
+//============================================================================
+
+
+#include <vector>
+#include <QAbstractListModel>
+#include <QHash>
+
+class QGraphicsItem;
+
+class NameIndex
+{
+public:
+    enum SearchMode {
+        SEARCH_TEXT,
+        SEARCH_GLOB,
+        SEARCH_REGEX
+    };
+
+    NameIndex() : _dead(0) {}
+
+    void clear();
+    void insert(QGraphicsItem*, uint32_t serial, const QString& name);
+    void remove(uint32_t serial);
+    void removeTree(QGraphicsItem*);
+    void insertTree(QGraphicsItem*);
+    bool search(const QString& pattern, int mode, std::vector<int>& results);
+
+    // Return item for entry id or NULL if it has been removed.
+    // For regions held by a RegionLayer the item is the layer.
+    QGraphicsItem* item(int id) const { return _entries[id].item; }
+    uint32_t serial(int id) const { return _entries[id].serial; }
+    const QString& name(int id) const { return _entries[id].name; }
+
+private:
+    struct Entry {
+        QString name;
+        QGraphicsItem* item;
+        uint32_t serial;
+    };
+
+    void addGrams(int id);
+    const std::vector<int>* candidates(const QString& literal) const;
+    void compact();
+
+    std::vector<Entry> _entries;
+    QHash<uint32_t, int> _lookup;     // Serial number to entry id.
+    QHash<quint64, std::vector<int>> _grams;
+    int _dead;
+};
+
+
+// Virtual list of search results for a QListView.
+class SearchResults : public QAbstractListModel
+{
+public:
+    SearchResults(const NameIndex* index, QObject* parent = nullptr)
+        : QAbstractListModel(parent), _index(index) {}
+
+    void setResults(std::vector<int>& ids);
+    int id(int row) const { return _ids[row]; }
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    QVariant data(const QModelIndex& index, int role) const;
+
+private:
+    const NameIndex* _index;
+    std::vector<int> _ids;
+};
+
+#endif  // NAMEINDEX_H
@@ -0,0 +1,123 @@
+//============================================================================
+//
+// Rectangle Packer
+//
+//============================================================================
+
+
+#include <vector>
+#include "Packer.h"
+#include "binpack2d.h"
+
+#define STB_RECT_PACK_IMPLEMENTATION
+#define STBRP_STATIC
+#include "stb_rect_pack.h"
+
+using namespace BinPack2D;
+
+typedef Content<int>::Vector::iterator BinPackIter;
+
+struct RectPackerBP {
+    ContentAccumulator<int> input;
+    ContentAccumulator<int> output;
+    ContentAccumulator<int> leftover;
+
+    int pack(int w, int h, bool sort)
+    {
+        CanvasArray<int> canvases =
+            UniformCanvasArrayBuilder<int>(w, h, 1).Build();
+        if (sort)
+            input.Sort();
+        canvases.Place(input, leftover);
+        canvases.CollectContent(output);
+        return leftover.Get().size();
+    }
+};
+
+struct RectPackerSL {
+    std::vector<stbrp_rect> input;
+    stbrp_context ctx;
+
+    int pack(int w, int h, bool bestFit)
+    {
+        stbrp_node* nodes = new stbrp_node[w];
+        if (! nodes)
+            return 0;
+
+        stbrp_init_target(&ctx, w, h, nodes, w);
+        stbrp_setup_heuristic(&ctx,
+                        bestFit ? STBRP_HEURISTIC_Skyline_BF_sortHeight
+                                : STBRP_HEURISTIC_Skyline_BL_sortHeight);
+        int allPacked = stbrp_pack_rects(&ctx, input.data(), input.size());
+
+        delete[] nodes;
+        return allPacked;
+    }
+};
+
+RectPacker::RectPacker(int algo) : _bp(NULL), _sl(NULL), _algo(algo)
+{
+    if (algo >= PA_SkyLine)
+        _sl = new RectPackerSL;
+    else
+        _bp = new RectPackerBP;
+}
+
+RectPacker::~RectPacker()
+{
+    delete _bp;
+    delete _sl;
+}
+
+/*
+ * \param x,y   Current position (only used by the BinPack methods).
+ */
+void RectPacker::addInput(int id, int x, int y, int w, int h)
+{
+    if (_bp) {
+        _bp->input += Content<int>(id, Coord(x, y), Size(w, h), false);
+    } else {
+        stbrp_rect rect;
+        rect.id = id;
+        rect.w = w;
+        rect.h = h;
+        rect.was_packed = 0;
+        _sl->input.push_back(rect);
+    }
+}
+
+int RectPacker::inputCount() const
+{
+    return _bp ? int(_bp->input.Get().size()) : int(_sl->input.size());
+}
+
+/*
+ * Pack the input rectangles into a w by h canvas.  The place function is
+ * called with the position of each rectangle which fits.
+ *
+ * Return the number of rectangles which did not fit.
+ */
+int RectPacker::pack(int w, int h, PlaceFunc place, void* user)
+{
+    int leftover;
+    if (_bp) {
+        leftover = _bp->pack(w, h, (_algo == PA_BinPackSort));
+
+        BinPackIter it;
+        for (it = _bp->output.Get().begin();
+             it != _bp->output.Get().end(); it++) {
+            const Content<int>& con = *it;
+            place(con.content, con.coord.x, con.coord.y, user);
+        }
+    } else {
+        _sl->pack(w, h, (_algo == PA_SkyLineBF));
+        leftover = 0;
+        for (const auto& it : _sl->input) {
+            if (it.was_packed)
+                place(it.id, it.x, it.y, user);
+            else
+                ++leftover;
+        }
+    }
+    return leftover;
+}
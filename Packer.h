@@ -0,0 +1,46 @@
+#ifndef PACKER_H
+#define PACKER_H
+//============================================================================
+//
+// Rectangle Packer
+//
+//============================================================================
+
+
+enum PackAlgorithm {
+    PA_BinPack,
+    PA_BinPackSort,
+    PA_SkyLine,
+    PA_SkyLineBF
+};
+
+struct RectPackerBP;
+struct RectPackerSL;
+
+/*
+ * Packs rectangles into a canvas using one of the PackAlgorithm methods.
+ * Rectangles are identified by a caller defined id.
+ */
+class RectPacker
+{
+public:
+    typedef void (*PlaceFunc)(int id, int x, int y, void* user);
+
+    RectPacker(int algo);
+    ~RectPacker();
+
+    void addInput(int id, int x, int y, int w, int h);
+    int inputCount() const;
+    int pack(int w, int h, PlaceFunc place, void* user);
+
+private:
+    RectPackerBP* _bp;
+    RectPackerSL* _sl;
+    int _algo;
+
+    // Disabled copy constructor and operator=
+    RectPacker(const RectPacker&);
+    RectPacker& operator=(const RectPacker&);
+};
+
+#endif  // PACKER_H
@@ -0,0 +1,84 @@
+//============================================================================
+//
+// Parallel Loops
+//
+//============================================================================
+
+
+#include <vector>
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include "Parallel.h"
+
+struct LoopState
+{
+    ParallelFunc func;
+    void* user;
+    int count;
+    QAtomicInt next;
+    QSemaphore done;        // Released by each helper when it returns.
+};
+
+static void runIterations(LoopState* loop)
+{
+    int i;
+    while ((i = loop->next.fetchAndAddRelaxed(1)) < loop->count)
+        loop->func(i, loop->user);
+}
+
+class LoopHelper : public QRunnable
+{
+public:
+    LoopHelper(LoopState* loop) : _loop(loop) { setAutoDelete(false); }
+
+    void run() {
+        runIterations(_loop);
+        _loop->done.release();
+    }
+
+private:
+    LoopState* _loop;
+};
+
+void parallelFor(int count, ParallelFunc func, void* user, int maxThreads)
+{
+    QThreadPool* pool = QThreadPool::globalInstance();
+    int threads = pool->maxThreadCount();
+    if (maxThreads > 0 && maxThreads < threads)
+        threads = maxThreads;
+    if (threads > count)
+        threads = count;
+
+    if (threads < 2) {
+        for (int i = 0; i < count; ++i)
+            func(i, user);
+        return;
+    }
+
+    LoopState loop;
+    loop.func  = func;
+    loop.user  = user;
+    loop.count = count;
+
+    std::vector<LoopHelper*> helpers;
+    for (int t = 1; t < threads; ++t) {
+        helpers.push_back(new LoopHelper(&loop));
+        pool->start(helpers.back());
+    }
+
+    runIterations(&loop);
+
+    // Withdraw the helpers which have not started, then wait for the rest
+    // to finish the iterations they claimed.
+    int running = 0;
+    for (LoopHelper* helper : helpers) {
+        if (! pool->tryTake(helper))
+            ++running;
+    }
+    loop.done.acquire(running);
+
+    for (LoopHelper* helper : helpers)
+        delete helper;
+}
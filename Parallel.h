@@ -0,0 +1,27 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+//============================================================================
+//
+// Parallel Loops
+//
+//============================================================================
+
+
+typedef void (*ParallelFunc)(int i, void* user);
+
+/*
+ * Call func for each index from 0 to count-1 using the global QThreadPool.
+ * The calling thread also runs iterations, and pool threads claim the next
+ * index as they become free, so uneven iterations balance themselves.
+ *
+ * Loops may be nested.  Helpers which no pool thread has picked up by the
+ * time the caller runs out of work are withdrawn, so an inner loop started
+ * while the pool is busy runs on the caller alone rather than waiting.
+ *
+ * \param maxThreads  Limit on the threads used (including the caller), or
+ *                    zero for the pool size.
+ */
+extern void parallelFor(int count, ParallelFunc func, void* user,
+                        int maxThreads = 0);
+
+#endif  // PARALLEL_H
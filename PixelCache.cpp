@@ -0,0 +1,263 @@
+//============================================================================
+//
+// Project Pixel Cache File
+//
+//============================================================================
+
+
+#include <string.h>
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include "PixelCache.h"
+
+#define CACHE_VERSION   1
+#define PIXEL_ALIGN     64
+
+// Shared by the cache and the images which use its pixels.
+struct PixelCacheMap {
+    QFile file;             // Closing the file unmaps it.
+    const uchar* base;
+    qint64 size;
+    QAtomicInt refs;
+};
+
+static void releaseMap(void* info)
+{
+    PixelCacheMap* map = (PixelCacheMap*) info;
+    if (! map->refs.deref())
+        delete map;
+}
+
+static uint64_t hashPath(const QByteArray& path)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char ch : path) {
+        hash ^= uint8_t(ch);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static qint64 alignPixels(qint64 pos)
+{
+    return (pos + PIXEL_ALIGN - 1) & ~qint64(PIXEL_ALIGN - 1);
+}
+
+/*
+ * Return the cache file path used for a project.
+ */
+QString PixelCache::pathFor(const QString& projectPath)
+{
+    QFileInfo info(projectPath);
+    return info.dir().filePath(info.completeBaseName() + ".atlcache");
+}
+
+/*
+ * Map a cache file.  Return false if it does not exist or is invalid.
+ */
+bool PixelCache::open(const QString& cachePath)
+{
+    close();
+
+    PixelCacheMap* map = new PixelCacheMap;
+    map->file.setFileName(cachePath);
+    map->refs.store(1);
+    map->base = NULL;
+    if (map->file.open(QIODevice::ReadOnly)) {
+        map->size = map->file.size();
+        if (map->size >= qint64(sizeof(PixelCacheHeader)))
+            map->base = map->file.map(0, map->size);
+    }
+    if (! map->base) {
+        delete map;
+        return false;
+    }
+
+    const PixelCacheHeader* hdr = (const PixelCacheHeader*) map->base;
+    if (memcmp(hdr->magic, "ATLC", 4) != 0 ||
+        hdr->version != CACHE_VERSION ||
+        qint64(sizeof(PixelCacheHeader)) +
+            qint64(hdr->count) * qint64(sizeof(PixelCacheEntry)) > map->size) {
+        delete map;
+        return false;
+    }
+
+    _map = map;
+    _entries = (const PixelCacheEntry*) (hdr + 1);
+    _lookup.reserve(int(hdr->count));
+
+    for (uint32_t i = 0; i < hdr->count; ++i) {
+        const PixelCacheEntry& ent = _entries[i];
+        qint64 bytes = qint64(ent.bytesPerLine) * ent.height;
+        if (ent.encoding != 0 ||
+            ent.bytesPerLine < ent.width * 4 ||
+            ent.pixels % PIXEL_ALIGN ||
+            qint64(ent.pixels) + bytes > map->size ||
+            qint64(ent.pathOffset) + ent.pathLen > map->size)
+            continue;                   // Skip damaged entry.
+        _lookup.insert(ent.pathHash, int(i));
+    }
+    return true;
+}
+
+void PixelCache::close()
+{
+    if (_map) {
+        releaseMap(_map);
+        _map = NULL;
+        _entries = NULL;
+        _lookup.clear();
+    }
+}
+
+/*
+ * Return the entry index for an image file or -1 if the file is not cached
+ * or has been modified since the cache was written.
+ */
+int PixelCache::find(const QFileInfo& source) const
+{
+    if (! _map)
+        return -1;
+
+    QByteArray path(source.canonicalFilePath().toUtf8());
+    if (path.isEmpty())
+        return -1;
+
+    auto it = _lookup.constFind(hashPath(path));
+    if (it == _lookup.constEnd())
+        return -1;
+
+    const PixelCacheEntry& ent = _entries[it.value()];
+    if (ent.pathLen != uint32_t(path.size()) ||
+        memcmp(_map->base + ent.pathOffset, path.constData(), ent.pathLen) ||
+        ent.mtime != source.lastModified().toMSecsSinceEpoch() ||
+        ent.size != source.size())
+        return -1;
+    return it.value();
+}
+
+/*
+ * Return the pixels of an entry as a read-only image.  No pixel data is
+ * copied unless the image is modified.
+ */
+QImage PixelCache::image(int i) const
+{
+    const PixelCacheEntry& ent = _entries[i];
+    _map->refs.ref();
+    return QImage(_map->base + ent.pixels, int(ent.width), int(ent.height),
+                  int(ent.bytesPerLine), QImage::Format_ARGB32_Premultiplied,
+                  releaseMap, _map);
+}
+
+/*
+ * Return the cached image of a file, or a null image if it is not cached.
+ */
+QImage PixelCache::image(const QString& sourcePath) const
+{
+    int i = find(QFileInfo(sourcePath));
+    return (i < 0) ? QImage() : image(i);
+}
+
+//----------------------------------------------------------------------------
+
+/*
+ * Write the header, entry table and source paths.
+ */
+bool PixelCacheWriter::begin(const std::vector<PixelCacheSource>& sources)
+{
+    PixelCacheHeader hdr;
+    memcpy(hdr.magic, "ATLC", 4);
+    hdr.version  = CACHE_VERSION;
+    hdr.count    = uint32_t(sources.size());
+    hdr.reserved = 0;
+
+    std::vector<QByteArray> paths;
+    paths.reserve(sources.size());
+    _entries.resize(sources.size());
+    _next = 0;
+
+    qint64 pos = sizeof(PixelCacheHeader) +
+                 sources.size() * sizeof(PixelCacheEntry);
+    for (size_t i = 0; i < sources.size(); ++i) {
+        const PixelCacheSource& src = sources[i];
+        PixelCacheEntry& ent = _entries[i];
+        paths.push_back(src.path.toUtf8());
+        ent.pathHash   = hashPath(paths.back());
+        ent.mtime      = src.mtime;
+        ent.size       = src.size;
+        ent.pathOffset = uint32_t(pos);
+        ent.pathLen    = uint32_t(paths.back().size());
+        pos += ent.pathLen;
+    }
+
+    for (size_t i = 0; i < sources.size(); ++i) {
+        const PixelCacheSource& src = sources[i];
+        PixelCacheEntry& ent = _entries[i];
+        pos = alignPixels(pos);
+        ent.pixels       = uint64_t(pos);
+        ent.width        = uint32_t(src.width);
+        ent.height       = uint32_t(src.height);
+        ent.bytesPerLine = uint32_t(src.width) * 4;
+        ent.encoding     = 0;
+        pos += qint64(ent.bytesPerLine) * ent.height;
+    }
+
+    if (! _file.open(QIODevice::WriteOnly))
+        return false;
+    if (_file.write((const char*) &hdr, sizeof(hdr)) != qint64(sizeof(hdr)))
+        return false;
+    qint64 len = qint64(_entries.size() * sizeof(PixelCacheEntry));
+    if (len && _file.write((const char*) &_entries[0], len) != len)
+        return false;
+    for (const QByteArray& path : paths) {
+        if (_file.write(path) != path.size())
+            return false;
+    }
+    return true;
+}
+
+bool PixelCacheWriter::pad(qint64 pos)
+{
+    static const char zero[PIXEL_ALIGN] = { 0 };
+    qint64 len = pos - _file.pos();
+    return len == 0 || _file.write(zero, len) == len;
+}
+
+/*
+ * Write the pixels of the next source.  The image must have the size
+ * declared in begin().
+ */
+bool PixelCacheWriter::append(const QImage& image)
+{
+    if (_next >= _entries.size())
+        return false;
+    const PixelCacheEntry& ent = _entries[_next++];
+    if (image.width() != int(ent.width) || image.height() != int(ent.height))
+        return false;
+
+    QImage pix = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    if (! pad(qint64(ent.pixels)))
+        return false;
+    for (uint32_t y = 0; y < ent.height; ++y) {
+        if (_file.write((const char*) pix.constScanLine(int(y)),
+                        ent.bytesPerLine) != qint64(ent.bytesPerLine))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Replace the cache file.  Return false (and leave any existing file intact)
+ * if not all images were appended or a write failed.
+ */
+bool PixelCacheWriter::commit()
+{
+    if (_next != _entries.size()) {
+        _file.cancelWriting();
+        return false;
+    }
+    return _file.commit();
+}
@@ -0,0 +1,109 @@
+#ifndef PIXELCACHE_H
+#define PIXELCACHE_H
+//============================================================================
+//
+// Project Pixel Cache File
+//
+//============================================================================
+
+
+#include <stdint.h>
+#include <vector>
+#include <QHash>
+#include <QImage>
+#include <QSaveFile>
+#include <QString>
+
+class QFileInfo;
+struct PixelCacheMap;
+
+/*
+ * Cache file header.  All values are in host byte order; a file written on
+ * a machine of different endianness has a byte swapped version, which does
+ * not match CACHE_VERSION, so the file is ignored.
+ */
+struct PixelCacheHeader {
+    char     magic[4];      // "ATLC"
+    uint32_t version;
+    uint32_t count;         // Number of PixelCacheEntry following header.
+    uint32_t reserved;
+};
+
+struct PixelCacheEntry {
+    uint64_t pathHash;      // FNV-1a of UTF-8 canonical source path.
+    int64_t  mtime;         // Source file modification time (ms).
+    int64_t  size;          // Source file size.
+    uint64_t pixels;        // File offset of pixel rows (64 byte aligned).
+    uint32_t pathOffset;    // File offset of path (not NUL terminated).
+    uint32_t pathLen;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerLine;
+    uint32_t encoding;      // 0 = Raw ARGB32 premultiplied.
+};
+
+/*
+ * Read-only view of a .atlcache file, which holds the decoded pixels of the
+ * images used by a project.  The file is memory mapped and the images it
+ * returns use the mapped pixels directly.  The mapping stays valid until
+ * both the cache is closed and all returned images are destroyed.
+ *
+ * Images skip decoding but are still copied once when converted to a
+ * QPixmap for the scene.
+ */
+class PixelCache
+{
+public:
+    PixelCache() : _map(NULL), _entries(NULL) {}
+    ~PixelCache() { close(); }
+
+    bool open(const QString& cachePath);
+    void close();
+    bool isOpen() const { return _map != NULL; }
+    int count() const { return _lookup.size(); }
+    int find(const QFileInfo& source) const;
+    QSize size(int i) const {
+        return QSize(int(_entries[i].width), int(_entries[i].height));
+    }
+    QImage image(int i) const;
+    QImage image(const QString& sourcePath) const;
+
+    static QString pathFor(const QString& projectPath);
+
+private:
+    PixelCacheMap* _map;
+    const PixelCacheEntry* _entries;
+    QHash<uint64_t, int> _lookup;
+};
+
+struct PixelCacheSource {
+    QString path;           // Canonical path.
+    qint64 mtime;
+    qint64 size;
+    int width;
+    int height;
+};
+
+/*
+ * Writes a new cache file.  The sources are declared with begin() and then
+ * their images are passed to append() in the same order.  The existing
+ * file is only replaced when commit() succeeds.
+ */
+class PixelCacheWriter
+{
+public:
+    PixelCacheWriter(const QString& cachePath) : _file(cachePath), _next(0) {}
+
+    bool begin(const std::vector<PixelCacheSource>& sources);
+    bool append(const QImage& image);
+    bool commit();
+
+private:
+    bool pad(qint64 pos);
+
+    QSaveFile _file;
+    std::vector<PixelCacheEntry> _entries;
+    size_t _next;
+};
+
+#endif  // PIXELCACHE_H
@@ -0,0 +1,300 @@
+//============================================================================
+//
+// Profiler
+//
+//============================================================================
+
+
+#include <stdio.h>
+#include <string.h>
+#include <QCoreApplication>
+#include <QStringList>
+#include <QThread>
+#include "Profiler.h"
+
+#define MAX_EVENTS  200000      // Later scopes are only added to totals.
+
+Profiler& Profiler::instance()
+{
+    static Profiler prof;
+    return prof;
+}
+
+Profiler::Profiler() : _full(false), _notify(NULL), _user(NULL), _depth(0)
+{
+    _clock.start();
+}
+
+void Profiler::clear()
+{
+    _events.clear();
+    _totals.clear();
+    _full = false;
+    _lastSummary.clear();
+}
+
+/*
+ * Events are only recorded on the main thread.  Scopes in pool threads
+ * (such as per-project work of a batch) are timed by their callers.
+ */
+static bool mainThread()
+{
+    QCoreApplication* app = QCoreApplication::instance();
+    return ! app || QThread::currentThread() == app->thread();
+}
+
+/*
+ * Return true if no more events can be recorded.  A warning is printed the
+ * first time this happens.
+ */
+bool Profiler::bufferFull()
+{
+    if (_events.size() < MAX_EVENTS)
+        return false;
+    if (! _full) {
+        _full = true;
+        fprintf(stderr, "Profiler: event buffer is full (%d events); later "
+                        "scopes are only added to the totals\n", MAX_EVENTS);
+    }
+    return true;
+}
+
+/*
+ * Return event id or -1 if the event buffer is full or the scope is not
+ * on the main thread.
+ *
+ * \param start  Start time from now().
+ */
+int Profiler::begin(const char* name, int64_t start)
+{
+    if (! mainThread())
+        return -1;
+
+    int depth = _depth++;
+    total(name, depth);
+    if (bufferFull())
+        return -1;
+
+    Event ev;
+    ev.name  = name;
+    ev.start = start;
+    ev.dur   = -1;
+    ev.items = 0;
+    ev.bytes = 0;
+    ev.depth = depth;
+    _events.push_back(ev);
+    return int(_events.size() - 1);
+}
+
+void Profiler::end(int id, const char* name, int64_t start, int64_t items,
+                   int64_t bytes)
+{
+    if (! mainThread())
+        return;
+
+    --_depth;
+    if (id >= 0 && size_t(id) < _events.size()) {
+        Event& ev = _events[id];
+        ev.dur   = now() - ev.start;
+        ev.items = items;
+        ev.bytes = bytes;
+        finished(ev, id + 1);
+    } else {
+        // Not recorded (or cleared); the time still counts in the totals.
+        Event ev;
+        ev.name  = name;
+        ev.start = start;
+        ev.dur   = now() - start;
+        ev.items = items;
+        ev.bytes = bytes;
+        ev.depth = _depth;
+        finished(ev, _events.size());
+    }
+}
+
+/*
+ * Add an event which has already completed.  This is used for activities
+ * such as background commands which do not fit in a single scope.
+ *
+ * \param start  Start time from now().
+ */
+void Profiler::record(const char* name, int64_t start, int64_t items,
+                      int64_t bytes)
+{
+    if (! mainThread())
+        return;
+
+    Event ev;
+    ev.name  = name;
+    ev.start = start;
+    ev.dur   = now() - start;
+    ev.items = items;
+    ev.bytes = bytes;
+    ev.depth = _depth;
+    if (! bufferFull())
+        _events.push_back(ev);
+    finished(ev, _events.size());
+}
+
+/*
+ * Return the totals of a scope name, adding them if the name is new.  Names
+ * are added as scopes begin so that the report lists operations before
+ * their phases.
+ */
+Profiler::Total* Profiler::total(const char* name, int depth)
+{
+    for (Total& t : _totals) {
+        if (t.name == name || strcmp(t.name, name) == 0)
+            return &t;
+    }
+    Total t = { name, depth, 0, 0, 0, 0, 0 };
+    _totals.push_back(t);
+    return &_totals.back();
+}
+
+/*
+ * Add a completed event to the totals and summarize it if it is an
+ * operation.
+ *
+ * \param phases  Index of the first event which may be a phase of ev.
+ */
+void Profiler::finished(const Event& ev, size_t phases)
+{
+    Total* tot = total(ev.name, ev.depth);
+    ++tot->calls;
+    tot->dur   += ev.dur;
+    tot->items += ev.items;
+    tot->bytes += ev.bytes;
+    if (ev.dur > tot->max)
+        tot->max = ev.dur;
+
+    if (ev.depth == 0) {
+        _lastSummary = summarize(ev, phases);
+        if (_notify)
+            _notify(_lastSummary, _user);
+    }
+}
+
+static QString formatMs(int64_t usec)
+{
+    return QString::number(double(usec) / 1000.0, 'f', usec < 10000 ? 1 : 0)
+           + " ms";
+}
+
+static QString formatCounts(int64_t items, int64_t bytes)
+{
+    QString str;
+    if (items)
+        str += QString(", %1 items").arg(items);
+    if (bytes >= 1024 * 1024)
+        str += QString(", %1 MiB").arg(double(bytes) / (1024.0 * 1024.0),
+                                       0, 'f', 1);
+    else if (bytes)
+        str += QString(", %1 KiB").arg((bytes + 1023) / 1024);
+    return str;
+}
+
+/*
+ * Return a one line summary of an operation and its phases.  Phases which
+ * run more than once (e.g. per image) are added together.
+ *
+ * \param phases  Index of the first recorded event after op.
+ */
+QString Profiler::summarize(const Event& op, size_t phases) const
+{
+    QString str(op.name);
+    str += ' ';
+    str += formatMs(op.dur);
+
+    std::vector<const char*> names;
+    std::vector<int64_t> durs;
+    for (size_t i = phases; i < _events.size(); ++i) {
+        const Event& ev = _events[i];
+        if (ev.depth != 1 || ev.dur < 0)
+            continue;
+        size_t n = 0;
+        while (n < names.size() && strcmp(names[n], ev.name) != 0)
+            ++n;
+        if (n == names.size()) {
+            names.push_back(ev.name);
+            durs.push_back(0);
+        }
+        durs[n] += ev.dur;
+    }
+    if (! names.empty()) {
+        QStringList phases;
+        for (size_t n = 0; n < names.size(); ++n)
+            phases << QString("%1 %2").arg(names[n]).arg(formatMs(durs[n]));
+        str += " (" + phases.join(", ") + ')';
+    }
+
+    str += formatCounts(op.items, op.bytes);
+    return str;
+}
+
+/*
+ * Return a table of the total time, items & bytes of each scope name.
+ */
+QString Profiler::report() const
+{
+    QString str;
+    str += QString("%1 %2 %3 %4 %5 %6\n")
+                .arg("Scope", -24).arg("Calls", 6).arg("Total ms", 10)
+                .arg("Max ms", 10).arg("Items", 9).arg("KiB", 9);
+    for (const Total& t : _totals) {
+        QString name(QString(2 * t.depth, ' ') + t.name);
+        str += QString("%1 %2 %3 %4 %5 %6\n")
+                .arg(name, -24).arg(t.calls, 6)
+                .arg(double(t.dur) / 1000.0, 10, 'f', 1)
+                .arg(double(t.max) / 1000.0, 10, 'f', 1)
+                .arg(t.items, 9).arg((t.bytes + 1023) / 1024, 9);
+    }
+    if (_full)
+        str += "\nEvent buffer is full; later scopes are in the totals but "
+               "not the trace.\n";
+    return str;
+}
+
+static void writeJsonString(FILE* fp, const char* str)
+{
+    fputc('"', fp);
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', fp);
+        fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * Write the events to the trace file in Chrome trace-event format.
+ */
+bool Profiler::writeTrace() const
+{
+    if (_tracePath.isEmpty())
+        return false;
+
+    FILE* fp = fopen(_tracePath.toLocal8Bit().constData(), "w");
+    if (! fp)
+        return false;
+
+    long long pid = QCoreApplication::applicationPid();
+    fprintf(fp, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (const Event& ev : _events) {
+        if (ev.dur < 0)
+            continue;
+        if (! first)
+            fprintf(fp, ",\n");
+        first = false;
+        fprintf(fp, "{\"name\":");
+        writeJsonString(fp, ev.name);
+        fprintf(fp, ",\"cat\":\"atlush\",\"ph\":\"X\",\"ts\":%lld,"
+                    "\"dur\":%lld,\"pid\":%lld,\"tid\":1,"
+                    "\"args\":{\"items\":%lld,\"bytes\":%lld}}",
+                (long long) ev.start, (long long) ev.dur, pid,
+                (long long) ev.items, (long long) ev.bytes);
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(fp) == 0;
+}
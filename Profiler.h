@@ -0,0 +1,111 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+//============================================================================
+//
+// Profiler
+//
+//============================================================================
+
+
+#include <stdint.h>
+#include <vector>
+#include <QElapsedTimer>
+#include <QString>
+
+/*
+ * Records the time spent in named scopes along with the number of items
+ * and bytes each one processed.  Scopes may nest; the outermost scopes are
+ * operations (e.g. "Load") and inner ones are their phases.
+ *
+ * Events can be written as Chrome trace-event JSON for viewing in
+ * chrome://tracing or Perfetto.  Only the main thread is profiled.  Once
+ * the event buffer is full, later scopes are still added to the report
+ * totals but are left out of the trace.
+ */
+class Profiler
+{
+public:
+    struct Event {
+        const char* name;       // Static string.
+        int64_t start;          // Microseconds.
+        int64_t dur;
+        int64_t items;
+        int64_t bytes;
+        int depth;
+    };
+
+    typedef void (*Notify)(const QString& summary, void* user);
+
+    static Profiler& instance();
+
+    void setTraceFile(const QString& path) { _tracePath = path; }
+    const QString& traceFile() const { return _tracePath; }
+    void setNotify(Notify func, void* user) { _notify = func; _user = user; }
+    int64_t now() const { return _clock.nsecsElapsed() / 1000; }
+    void record(const char* name, int64_t start, int64_t items,
+                int64_t bytes);
+    bool writeTrace() const;
+    QString report() const;
+    const QString& lastSummary() const { return _lastSummary; }
+    void clear();
+
+private:
+    struct Total {
+        const char* name;
+        int depth;
+        int calls;
+        int64_t dur, max, items, bytes;
+    };
+
+    Profiler();
+    int begin(const char* name, int64_t start);
+    void end(int id, const char* name, int64_t start, int64_t items,
+             int64_t bytes);
+    bool bufferFull();
+    Total* total(const char* name, int depth);
+    void finished(const Event& ev, size_t phases);
+    QString summarize(const Event& op, size_t phases) const;
+
+    QElapsedTimer _clock;
+    std::vector<Event> _events;
+    std::vector<Total> _totals; // Every finished scope, even unrecorded ones.
+    bool _full;                 // Event buffer filled since clear().
+    QString _tracePath;
+    QString _lastSummary;
+    Notify _notify;
+    void* _user;
+    int _depth;
+
+    friend class ProfileScope;
+};
+
+/*
+ * Times the enclosing block.
+ */
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name)
+        : _name(name), _items(0), _bytes(0) {
+        Profiler& prof = Profiler::instance();
+        _start = prof.now();
+        _id = prof.begin(name, _start);
+    }
+    ~ProfileScope() {
+        Profiler::instance().end(_id, _name, _start, _items, _bytes);
+    }
+
+    void addItems(int64_t n) { _items += n; }
+    void addBytes(int64_t n) { _bytes += n; }
+
+private:
+    const char* _name;
+    int _id;
+    int64_t _start;
+    int64_t _items;
+    int64_t _bytes;
+};
+
+#define PROFILE(var, name)  ProfileScope var(name)
+
+#endif  // PROFILER_H
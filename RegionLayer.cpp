@@ -0,0 +1,316 @@
+//============================================================================
+//
+// RegionLayer
+//
+//============================================================================
+
+
+#include <math.h>
+#include <QGraphicsScene>
+#include <QGraphicsSceneMouseEvent>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include "AWindow.h"
+#include "ItemValues.h"
+#include "RegionLayer.h"
+
+#define CELL_SHIFT  7       // 128 pixel grid cells.
+
+RegionLayer::RegionLayer(QGraphicsItem* parent, AUndoSystem* undo)
+    : QGraphicsItem(parent), _undo(undo), _queryId(0),
+      _gridX(0), _gridY(0), _cols(0), _rows(0), _gridDirty(true),
+      _current(-1), _drag(-1), _handle(0)
+{
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    setAcceptedMouseButtons(Qt::LeftButton);
+}
+
+void RegionLayer::expandBounds(const LayerRegion& r)
+{
+    QRectF rect(r.x, r.y, r.w, r.h);
+    if (! _bounds.contains(rect)) {
+        prepareGeometryChange();
+        _bounds = _bounds.isEmpty() ? rect : _bounds.united(rect);
+    }
+}
+
+void RegionLayer::append(const LayerRegion& reg, const QString& name)
+{
+    _index.insert(reg.serial, int(_regions.size()));
+    _regions.push_back(reg);
+    _names.push_back(name);
+    expandBounds(reg);
+    _gridDirty = true;
+}
+
+int RegionLayer::find(uint32_t serial) const
+{
+    return _index.value(serial, -1);
+}
+
+QRectF RegionLayer::regionRect(int i) const
+{
+    const LayerRegion& r = _regions[i];
+    return QRectF(r.x, r.y, r.w, r.h);
+}
+
+/*
+ * Move region i and change its size.  This is used by undo/redo.
+ */
+void RegionLayer::adjustRegion(int i, int dx, int dy, int dw, int dh)
+{
+    LayerRegion& r = _regions[i];
+    r.x += dx;
+    r.y += dy;
+    r.w += dw;
+    r.h += dh;
+    expandBounds(r);
+    _gridDirty = true;
+    update();
+}
+
+void RegionLayer::setCurrent(int i)
+{
+    if (i != _current) {
+        _current = i;
+        update();
+    }
+}
+
+/*
+ * Rebuild the spatial index.  Each region is listed in every cell that it
+ * overlaps.
+ */
+void RegionLayer::updateGrid()
+{
+    if (! _gridDirty)
+        return;
+    _gridDirty = false;
+
+    QRect area = _bounds.toAlignedRect();
+    _gridX = area.x() >> CELL_SHIFT;
+    _gridY = area.y() >> CELL_SHIFT;
+    _cols = ((area.x() + area.width())  >> CELL_SHIFT) - _gridX + 1;
+    _rows = ((area.y() + area.height()) >> CELL_SHIFT) - _gridY + 1;
+
+    size_t cellCount = size_t(_cols) * _rows;
+    _cellStart.assign(cellCount + 1, 0);
+    _stamp.assign(_regions.size(), 0);
+    _queryId = 0;
+
+    int cx0, cy0, cx1, cy1, x, y;
+#define CELL_RANGE(r) \
+    cx0 = (r.x >> CELL_SHIFT) - _gridX; \
+    cy0 = (r.y >> CELL_SHIFT) - _gridY; \
+    cx1 = ((r.x + r.w - 1) >> CELL_SHIFT) - _gridX; \
+    cy1 = ((r.y + r.h - 1) >> CELL_SHIFT) - _gridY
+
+    // Count, prefix sum, then fill.
+    for (const LayerRegion& r : _regions) {
+        CELL_RANGE(r);
+        for (y = cy0; y <= cy1; ++y)
+            for (x = cx0; x <= cx1; ++x)
+                ++_cellStart[y * _cols + x + 1];
+    }
+    for (size_t i = 1; i <= cellCount; ++i)
+        _cellStart[i] += _cellStart[i - 1];
+
+    std::vector<int> fill(_cellStart.begin(), _cellStart.end() - 1);
+    _cellList.resize(_cellStart[cellCount]);
+
+    int count = int(_regions.size());
+    for (int i = 0; i < count; ++i) {
+        const LayerRegion& r = _regions[i];
+        CELL_RANGE(r);
+        for (y = cy0; y <= cy1; ++y)
+            for (x = cx0; x <= cx1; ++x)
+                _cellList[ fill[y * _cols + x]++ ] = i;
+    }
+}
+
+/*
+ * Append the indices of regions which may overlap area to out.
+ */
+void RegionLayer::gather(const QRect& area, std::vector<int>& out)
+{
+    int cx0 = qMax((area.x() >> CELL_SHIFT) - _gridX, 0);
+    int cy0 = qMax((area.y() >> CELL_SHIFT) - _gridY, 0);
+    int cx1 = qMin(((area.x() + area.width())  >> CELL_SHIFT) - _gridX,
+                   _cols - 1);
+    int cy1 = qMin(((area.y() + area.height()) >> CELL_SHIFT) - _gridY,
+                   _rows - 1);
+
+    if (++_queryId == 0) {
+        std::fill(_stamp.begin(), _stamp.end(), 0);
+        _queryId = 1;
+    }
+
+    for (int y = cy0; y <= cy1; ++y) {
+        for (int x = cx0; x <= cx1; ++x) {
+            int cell = y * _cols + x;
+            for (int n = _cellStart[cell]; n < _cellStart[cell + 1]; ++n) {
+                int i = _cellList[n];
+                if (_stamp[i] != _queryId) {
+                    _stamp[i] = _queryId;
+                    out.push_back(i);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Return index of the topmost region at pos or -1 if there is none.
+ */
+int RegionLayer::regionAt(const QPointF& pos)
+{
+    std::vector<int> list;
+    int px = int(floor(pos.x()));
+    int py = int(floor(pos.y()));
+
+    updateGrid();
+    gather(QRect(px, py, 1, 1), list);
+
+    int top = -1;
+    for (int i : list) {
+        const LayerRegion& r = _regions[i];
+        if (px >= r.x && px < r.x + r.w && py >= r.y && py < r.y + r.h) {
+            if (i > top)
+                top = i;
+        }
+    }
+    return top;
+}
+
+void RegionLayer::paint(QPainter* painter,
+                        const QStyleOptionGraphicsItem* option, QWidget*)
+{
+    std::vector<int> list;
+    QVector<QRect> rects;
+
+    // During a drag the grid is stale for the dragged region so it is
+    // drawn separately.
+    updateGrid();
+    gather(option->exposedRect.toAlignedRect(), list);
+
+    rects.reserve(int(list.size()));
+    for (int i : list) {
+        if (i != _current && i != _drag) {
+            const LayerRegion& r = _regions[i];
+            rects.append(QRect(r.x, r.y, r.w, r.h));
+        }
+    }
+
+    painter->setPen(Qt::NoPen);
+    painter->setBrush(QColor(255, 20, 20, 128));
+    painter->drawRects(rects);
+
+    int hi = (_drag >= 0) ? _drag : _current;
+    if (hi >= 0) {
+        painter->setBrush(QColor(255, 255, 70, 128));
+        painter->drawRect(regionRect(hi));
+    }
+
+    const QGraphicsScene* gs = scene();
+    if (gs && gs->property("shot").toBool()) {
+        painter->setPen(Qt::black);
+        for (int i : list) {
+            const LayerRegion& r = _regions[i];
+            if (r.hotx || r.hoty) {
+                int hx = r.x + r.hotx;
+                int hy = r.y + r.hoty;
+                painter->drawLine(hx - 4, hy, hx + 4, hy);
+                painter->drawLine(hx, hy - 4, hx, hy + 4);
+            }
+        }
+    }
+}
+
+void RegionLayer::mousePressEvent(QGraphicsSceneMouseEvent* ev)
+{
+    static const Qt::CursorShape dragCursor[5] = {
+        Qt::DragMoveCursor,
+        Qt::SizeFDiagCursor, Qt::SizeBDiagCursor,
+        Qt::SizeBDiagCursor, Qt::SizeFDiagCursor
+    };
+
+    int i = (ev->button() == Qt::LeftButton) ? regionAt(ev->pos()) : -1;
+    if (i < 0) {
+        ev->ignore();       // Pass to the image below.
+        return;
+    }
+
+    const LayerRegion& r = _regions[i];
+    _drag = i;
+    _dragStart = r;
+    _handle = regionHandleAt(QRectF(0, 0, r.w, r.h),
+                             ev->pos() - QPointF(r.x, r.y));
+    setCurrent(i);
+    setCursor(dragCursor[_handle]);
+}
+
+void RegionLayer::mouseMoveEvent(QGraphicsSceneMouseEvent* ev)
+{
+    if (_drag < 0)
+        return;
+
+    QPointF delta = ev->scenePos() - ev->buttonDownScenePos(Qt::LeftButton);
+    int dx = int(round(delta.x()));
+    int dy = int(round(delta.y()));
+    const LayerRegion& s = _dragStart;
+    LayerRegion& r = _regions[_drag];
+    QRectF prev = regionRect(_drag);
+
+    switch (_handle) {
+        case 0:
+            r.x = s.x + dx;
+            r.y = s.y + dy;
+            break;
+        case 1:
+            r.x = s.x + dx;
+            r.y = s.y + dy;
+            r.w = s.w - dx;
+            r.h = s.h - dy;
+            break;
+        case 2:
+            r.y = s.y + dy;
+            r.w = s.w + dx;
+            r.h = s.h - dy;
+            break;
+        case 3:
+            r.x = s.x + dx;
+            r.w = s.w - dx;
+            r.h = s.h + dy;
+            break;
+        case 4:
+            r.w = s.w + dx;
+            r.h = s.h + dy;
+            break;
+    }
+    if (r.w < 1)
+        r.w = 1;
+    if (r.h < 1)
+        r.h = 1;
+
+    expandBounds(r);
+    update(prev.united(regionRect(_drag)));
+}
+
+void RegionLayer::mouseReleaseEvent(QGraphicsSceneMouseEvent* ev)
+{
+    if (_drag >= 0 && ev->button() == Qt::LeftButton) {
+        const LayerRegion& s = _dragStart;
+        const LayerRegion& r = _regions[_drag];
+        int dx = r.x - s.x;
+        int dy = r.y - s.y;
+        int dw = r.w - s.w;
+        int dh = r.h - s.h;
+        if (dx || dy || dw || dh)
+            _undo->recordRect(r.serial, dx, dy, dw, dh);
+
+        _drag = -1;
+        _gridDirty = true;
+        setCursor(Qt::ArrowCursor);
+        update();
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef REGIONLAYER_H
+#define REGIONLAYER_H
+//============================================================================
+//
+// RegionLayer
+//
+//============================================================================
+
+
+#include <vector>
+#include <QGraphicsItem>
+#include <QHash>
+
+struct AUndoSystem;
+
+struct LayerRegion {
+    int x, y, w, h;
+    int hotx, hoty;
+    uint32_t serial;
+};
+
+/*
+ * A single graphics item which holds all the regions of an image in flat
+ * arrays.  This avoids the memory & scene index cost of one ARegion item per
+ * region in very large projects.
+ */
+class RegionLayer : public QGraphicsItem
+{
+public:
+    enum { Type = UserType + 1 };
+
+    RegionLayer(QGraphicsItem* parent, AUndoSystem* undo);
+
+    int type() const { return Type; }
+    QRectF boundingRect() const { return _bounds; }
+    void paint(QPainter*, const QStyleOptionGraphicsItem*, QWidget*);
+
+    void append(const LayerRegion&, const QString& name);
+    int count() const { return int(_regions.size()); }
+    const LayerRegion& region(int i) const { return _regions[i]; }
+    const QString& name(int i) const { return _names[i]; }
+    int find(uint32_t serial) const;
+    int regionAt(const QPointF& pos);
+    void adjustRegion(int i, int dx, int dy, int dw, int dh);
+    void setCurrent(int i);
+    QRectF regionRect(int i) const;
+
+protected:
+    void mousePressEvent(QGraphicsSceneMouseEvent*);
+    void mouseMoveEvent(QGraphicsSceneMouseEvent*);
+    void mouseReleaseEvent(QGraphicsSceneMouseEvent*);
+
+private:
+    void expandBounds(const LayerRegion&);
+    void updateGrid();
+    void gather(const QRect& area, std::vector<int>& out);
+
+    std::vector<LayerRegion> _regions;
+    std::vector<QString> _names;
+    QHash<uint32_t, int> _index;    // Serial number to region index.
+    AUndoSystem* _undo;
+    QRectF _bounds;
+
+    // Spatial index; a uniform grid in compressed row form.
+    std::vector<int> _cellStart;    // Offset into _cellList for each cell.
+    std::vector<int> _cellList;     // Region indices.
+    std::vector<uint32_t> _stamp;   // Per region query stamp for gather().
+    uint32_t _queryId;
+    int _gridX, _gridY, _cols, _rows;
+    bool _gridDirty;
+
+    int _current;
+    int _drag;
+    int _handle;
+    LayerRegion _dragStart;
+};
+
+#endif  // REGIONLAYER_H
@@ -0,0 +1,249 @@
+//============================================================================
+//
+// Image Residency
+//
+//============================================================================
+
+
+#include <algorithm>
+#include <vector>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QGraphicsView>
+#include <QPainter>
+#include <QTimer>
+#include "ItemValues.h"
+#include "Residency.h"
+
+#define UPDATE_DELAY    250     // Milliseconds.
+#define TRIM_PERCENT    90      // Evict down to this much of the limit.
+
+static qint64 pixelBytes(const QSize& size)
+{
+    return qint64(size.width()) * size.height() * 4;
+}
+
+void ResidentImage::setSource(const QString& source)
+{
+    QFileInfo info(source);
+    if (! source.isEmpty() && info.exists()) {
+        _source   = info.absoluteFilePath();
+        _mtime    = info.lastModified().toMSecsSinceEpoch();
+        _fileSize = info.size();
+    } else
+        _source.clear();
+}
+
+/*
+ * Replace the pixmap.
+ *
+ * \param source  Image file which holds these pixels.  If empty the image
+ *                is never evicted.
+ */
+void ResidentImage::setPixels(const QPixmap& pix, const QString& source)
+{
+    setSource(source);
+    _evicted = false;
+    setPixmap(pix);
+    _residency->schedule();
+}
+
+/*
+ * Return true if the source file has been modified since the pixels were
+ * set.  Images with no source file (or a missing one) are not changed.
+ */
+bool ResidentImage::sourceChanged() const
+{
+    if (_source.isEmpty())
+        return false;
+    QFileInfo info(_source);
+    return info.exists() &&
+           (info.lastModified().toMSecsSinceEpoch() != _mtime ||
+            info.size() != _fileSize);
+}
+
+/*
+ * Create the image in the evicted state so that the file is only loaded
+ * when needed.
+ */
+void ResidentImage::setPlaceholder(const QSize& size, const QString& source)
+{
+    setSource(source);
+    if (_source.isEmpty()) {
+        setPixels(_residency->load(source));
+        return;
+    }
+    prepareGeometryChange();
+    _size = size;
+    _evicted = true;
+    setPixmap(QPixmap());
+}
+
+/*
+ * Return the pixmap, loading it first if the image is evicted.
+ */
+const QPixmap& ResidentImage::pixels() const
+{
+    if (_evicted)
+        const_cast<ResidentImage*>(this)->restore();
+    return pixmap();
+}
+
+/*
+ * Drop the pixmap.  Return false if the image has no unmodified source file
+ * to restore it from.
+ */
+bool ResidentImage::evict()
+{
+    if (_evicted || _source.isEmpty())
+        return false;
+
+    QFileInfo info(_source);
+    if (! info.exists() ||
+        info.lastModified().toMSecsSinceEpoch() != _mtime ||
+        info.size() != _fileSize)
+        return false;
+
+    _size = pixmap().size();
+    _evicted = true;
+    setPixmap(QPixmap());
+    return true;
+}
+
+void ResidentImage::restore()
+{
+    if (_evicted) {
+        _evicted = false;
+        setPixmap(_residency->load(_source));
+        _residency->schedule();
+    }
+}
+
+QRectF ResidentImage::boundingRect() const
+{
+    if (! _evicted)
+        return QGraphicsPixmapItem::boundingRect();
+
+    // Match QGraphicsPixmapItem which adds the selection pen width.
+    QRectF rect(offset(), QSizeF(_size));
+    if (flags() & ItemIsSelectable)
+        rect.adjust(-0.5, -0.5, 0.5, 0.5);
+    return rect;
+}
+
+QPainterPath ResidentImage::shape() const
+{
+    if (! _evicted)
+        return QGraphicsPixmapItem::shape();
+    QPainterPath path;
+    path.addRect(QRectF(offset(), QSizeF(_size)));
+    return path;
+}
+
+bool ResidentImage::contains(const QPointF& pos) const
+{
+    if (! _evicted)
+        return QGraphicsPixmapItem::contains(pos);
+    return QRectF(offset(), QSizeF(_size)).contains(pos);
+}
+
+void ResidentImage::paint(QPainter* painter,
+                          const QStyleOptionGraphicsItem* option,
+                          QWidget* widget)
+{
+    _lastUse = _residency->touch();
+    if (_evicted) {
+        // Draw a placeholder and load the pixels after this paint.
+        painter->fillRect(QRectF(offset(), QSizeF(_size)), QColor(96,96,96));
+        _residency->schedule();
+        return;
+    }
+    QGraphicsPixmapItem::paint(painter, option, widget);
+}
+
+//----------------------------------------------------------------------------
+
+Residency::Residency(QGraphicsView* view, Loader loader, void* user)
+    : _view(view), _loader(loader), _user(user), _limitMB(0), _clock(0)
+{
+    _timer = new QTimer(this);
+    _timer->setSingleShot(true);
+    _timer->setInterval(UPDATE_DELAY);
+    connect(_timer, SIGNAL(timeout()), SLOT(update()));
+}
+
+void Residency::setLimit(int megabytes)
+{
+    _limitMB = megabytes;
+    schedule();
+}
+
+void Residency::schedule()
+{
+    if (! _timer->isActive())
+        _timer->start();
+}
+
+static bool lessRecent(const ResidentImage* a, const ResidentImage* b)
+{
+    return a->lastUse() < b->lastUse();
+}
+
+/*
+ * Load the visible images which are evicted and then evict the least
+ * recently used images until the memory limit is met.
+ */
+void Residency::update()
+{
+    QGraphicsScene* scene = _view->scene();
+    if (! scene)
+        return;
+
+    QRectF visible = _view->mapToScene(_view->viewport()->rect())
+                          .boundingRect();
+    for (QGraphicsItem* it : scene->items(visible)) {
+        if (IS_IMAGE(it))
+            static_cast<ResidentImage*>(it)->restore();
+    }
+
+    std::vector<ResidentImage*> idle;
+    qint64 bytes = 0;
+    int total = 0;
+    int resident = 0;
+
+    for (QGraphicsItem* it : scene->items()) {
+        if (! IS_IMAGE(it))
+            continue;
+        ResidentImage* img = static_cast<ResidentImage*>(it);
+        ++total;
+        if (! img->isResident())
+            continue;
+        ++resident;
+        bytes += pixelBytes(img->size());
+        if (! it->isSelected() &&
+            ! visible.intersects(it->sceneBoundingRect()))
+            idle.push_back(img);
+    }
+
+    qint64 limit = limitBytes();
+    if (limit && bytes > limit) {
+        std::sort(idle.begin(), idle.end(), lessRecent);
+        qint64 target = limit / 100 * TRIM_PERCENT;
+        for (ResidentImage* img : idle) {
+            if (bytes <= target)
+                break;
+            qint64 size = pixelBytes(img->size());
+            if (img->evict()) {
+                bytes -= size;
+                --resident;
+            }
+        }
+    }
+
+    QString text = QString("%1/%2 images, %3 MiB")
+                        .arg(resident).arg(total)
+                        .arg((bytes + 512 * 1024) / (1024 * 1024));
+    if (_limitMB)
+        text += QString(" of %1").arg(_limitMB);
+    emit readout(text);
+}
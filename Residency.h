@@ -0,0 +1,96 @@
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+//============================================================================
+//
+// Image Residency
+//
+//============================================================================
+
+
+#include <stdint.h>
+#include <QGraphicsPixmapItem>
+#include <QObject>
+
+class QGraphicsView;
+class QTimer;
+class Residency;
+
+/*
+ * Pixmap item whose pixels can be dropped while it is off-screen.  An
+ * evicted image keeps its size and is reloaded from its source file when
+ * it is painted or when pixels() is called.  Only images which have an
+ * unmodified source file are evicted.
+ */
+class ResidentImage : public QGraphicsPixmapItem
+{
+public:
+    ResidentImage(Residency* res)
+        : _residency(res), _mtime(0), _fileSize(0), _lastUse(0),
+          _evicted(false) {}
+
+    void setPixels(const QPixmap& pix, const QString& source = QString());
+    void setPlaceholder(const QSize& size, const QString& source);
+    const QPixmap& pixels() const;
+    QSize size() const { return _evicted ? _size : pixmap().size(); }
+    const QString& source() const { return _source; }
+    bool sourceChanged() const;
+    bool isResident() const { return ! _evicted; }
+    uint32_t lastUse() const { return _lastUse; }
+    bool evict();
+    void restore();
+
+    QRectF boundingRect() const;
+    QPainterPath shape() const;
+    bool contains(const QPointF& pos) const;
+    void paint(QPainter*, const QStyleOptionGraphicsItem*, QWidget*);
+
+private:
+    void setSource(const QString& source);
+
+    Residency* _residency;
+    QString _source;        // Image file or empty if pixels were generated.
+    qint64 _mtime;
+    qint64 _fileSize;
+    QSize _size;            // Size while evicted.
+    uint32_t _lastUse;
+    bool _evicted;
+};
+
+/*
+ * Keeps the pixel memory of the scene images under a limit by evicting the
+ * least recently painted images which are not visible or selected.
+ */
+class Residency : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef QPixmap (*Loader)(const QString& path, void* user);
+
+    Residency(QGraphicsView* view, Loader loader, void* user);
+
+    void setLimit(int megabytes);
+    int limit() const { return _limitMB; }
+    qint64 limitBytes() const { return qint64(_limitMB) * 1024 * 1024; }
+    QPixmap load(const QString& path) { return _loader(path, _user); }
+    uint32_t touch() { return ++_clock; }
+    void schedule();
+
+public slots:
+
+    void update();
+
+signals:
+
+    void readout(const QString&);
+
+private:
+    QGraphicsView* _view;
+    QTimer* _timer;
+    Loader _loader;
+    void* _user;
+    int _limitMB;           // Zero is no limit.
+    uint32_t _clock;
+};
+
+#endif  // RESIDENCY_H
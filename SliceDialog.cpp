@@ -0,0 +1,125 @@
+#include <QBoxLayout>
+#include <QCheckBox>
+#include <QDialogButtonBox>
+#include <QFormLayout>
+#include <QSettings>
+#include <QSpinBox>
+#include "ImageOps.h"
+#include "SliceDialog.h"
+
+
+static QSpinBox* pixelSpin(int min, const QString& special = QString())
+{
+    QSpinBox* spin = new QSpinBox;
+    spin->setRange(min, 8192);
+    spin->setSuffix(QObject::tr(" px"));
+    if (! special.isEmpty())
+        spin->setSpecialValueText(special);
+    return spin;
+}
+
+SliceDialog::SliceDialog(int mode, QWidget* parent)
+    : QDialog(parent), _mode(mode),
+      _merge(nullptr), _cellW(nullptr), _cellH(nullptr),
+      _spacing(nullptr), _margin(nullptr), _skipEmpty(nullptr)
+{
+    QSettings settings;
+    QFormLayout* form = new QFormLayout;
+
+    _threshold = new QSpinBox;
+    _threshold->setRange(0, 254);
+    _threshold->setToolTip(tr("Pixels with a greater alpha are opaque"));
+
+    if (mode == SLICE_GRID) {
+        setWindowTitle("Grid Slice");
+
+        // A zero cell size spans the image to make a strip.
+        _cellW   = pixelSpin(0, tr("Image"));
+        _cellH   = pixelSpin(0, tr("Image"));
+        _spacing = pixelSpin(0);
+        _margin  = pixelSpin(0);
+        _skipEmpty = new QCheckBox(tr("Skip empty cells"));
+        connect(_skipEmpty, &QCheckBox::toggled,
+                _threshold, &QWidget::setEnabled);
+
+        form->addRow(tr("Cell Width:"), _cellW);
+        form->addRow(tr("Cell Height:"), _cellH);
+        form->addRow(tr("Spacing:"), _spacing);
+        form->addRow(tr("Margin:"), _margin);
+        form->addRow(nullptr, _skipEmpty);
+        form->addRow(tr("Alpha Threshold:"), _threshold);
+
+        _cellW->setValue( settings.value("grid-cell-w", 32).toInt() );
+        _cellH->setValue( settings.value("grid-cell-h", 32).toInt() );
+        _spacing->setValue( settings.value("grid-spacing", 0).toInt() );
+        _margin->setValue( settings.value("grid-margin", 0).toInt() );
+        _skipEmpty->setChecked( settings.value("grid-skip", true).toBool() );
+        _threshold->setEnabled(_skipEmpty->isChecked());
+    } else {
+        setWindowTitle("Auto Slice");
+
+        _merge = pixelSpin(0);
+        _merge->setMaximum(256);
+        _merge->setToolTip(tr("Join sprites separated by this many pixels"));
+
+        form->addRow(tr("Alpha Threshold:"), _threshold);
+        form->addRow(tr("Merge Distance:"), _merge);
+
+        _merge->setValue( settings.value("slice-merge", 0).toInt() );
+    }
+    _threshold->setValue( settings.value("slice-threshold", 0).toInt() );
+
+    QDialogButtonBox* bbox =
+        new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
+    connect(bbox, &QDialogButtonBox::accepted, this, &QDialog::accept);
+    connect(bbox, &QDialogButtonBox::rejected, this, &QDialog::reject);
+
+    QBoxLayout* lo = new QVBoxLayout(this);
+    lo->addLayout(form);
+    lo->addStretch();
+    lo->addWidget(bbox);
+
+    connect(this, SIGNAL(accepted()), SLOT(saveSettings()));
+}
+
+void SliceDialog::saveSettings()
+{
+    QSettings settings;
+    settings.setValue("slice-threshold", _threshold->value());
+    if (_mode == SLICE_GRID) {
+        settings.setValue("grid-cell-w", _cellW->value());
+        settings.setValue("grid-cell-h", _cellH->value());
+        settings.setValue("grid-spacing", _spacing->value());
+        settings.setValue("grid-margin", _margin->value());
+        settings.setValue("grid-skip", _skipEmpty->isChecked());
+    } else
+        settings.setValue("slice-merge", _merge->value());
+}
+
+int SliceDialog::threshold() const
+{
+    return _threshold->value();
+}
+
+int SliceDialog::mergeDistance() const
+{
+    return _merge ? _merge->value() : 0;
+}
+
+/*
+ * Set the cell size, spacing & margin of a grid.  The cols & rows are left
+ * for CellGrid::fit().
+ */
+void SliceDialog::grid(CellGrid& grid) const
+{
+    grid.cellW   = _cellW ? _cellW->value() : 0;
+    grid.cellH   = _cellH ? _cellH->value() : 0;
+    grid.spacing = _spacing ? _spacing->value() : 0;
+    grid.margin  = _margin ? _margin->value() : 0;
+    grid.cols = grid.rows = 0;
+}
+
+bool SliceDialog::skipEmpty() const
+{
+    return _skipEmpty && _skipEmpty->isChecked();
+}
@@ -0,0 +1,40 @@
+#ifndef SLICEDIALOG_H
+#define SLICEDIALOG_H
+
+#include <QDialog>
+
+class QCheckBox;
+class QSpinBox;
+struct CellGrid;
+
+enum SliceMode {
+    SLICE_SPRITES,      // Regions around connected opaque pixels.
+    SLICE_GRID          // Regions for uniform cells.
+};
+
+class SliceDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    SliceDialog(int mode, QWidget* parent = nullptr);
+    int threshold() const;
+    int mergeDistance() const;
+    void grid(CellGrid& grid) const;
+    bool skipEmpty() const;
+
+private slots:
+    void saveSettings();
+
+private:
+    int _mode;
+    QSpinBox* _threshold;
+    QSpinBox* _merge;
+    QSpinBox* _cellW;
+    QSpinBox* _cellH;
+    QSpinBox* _spacing;
+    QSpinBox* _margin;
+    QCheckBox* _skipEmpty;
+};
+
+#endif  // SLICEDIALOG_H
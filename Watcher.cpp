@@ -0,0 +1,104 @@
+//============================================================================
+//
+// File Watcher
+//
+//============================================================================
+
+
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include "Watcher.h"
+
+FileWatcher::FileWatcher(ChangeFunc func, void* user, int debounceMs)
+    : _func(func), _user(user)
+{
+    _watcher = new QFileSystemWatcher;
+    QObject::connect(_watcher, &QFileSystemWatcher::fileChanged,
+                     [this](const QString& path) { fileChanged(path); });
+    QObject::connect(_watcher, &QFileSystemWatcher::directoryChanged,
+                     [this](const QString& path) { dirChanged(path); });
+
+    _timer = new QTimer;
+    _timer->setSingleShot(true);
+    _timer->setInterval(debounceMs);
+    QObject::connect(_timer, &QTimer::timeout, [this]() { flush(); });
+}
+
+FileWatcher::~FileWatcher()
+{
+    delete _timer;
+    delete _watcher;
+}
+
+/*
+ * Replace the watched paths.  Paths which do not exist are ignored.
+ */
+void FileWatcher::setPaths(const QStringList& files, const QStringList& dirs)
+{
+    clear();
+
+    QStringList paths;
+    QSet<QString> unique;
+    for (const QString& fn : files + dirs) {
+        QString path(QFileInfo(fn).absoluteFilePath());
+        if (! unique.contains(path)) {
+            unique.insert(path);
+            paths << path;
+        }
+    }
+    if (! paths.isEmpty())
+        _watcher->addPaths(paths);
+}
+
+void FileWatcher::clear()
+{
+    QStringList paths = _watcher->files() + _watcher->directories();
+    if (! paths.isEmpty())
+        _watcher->removePaths(paths);
+    _changedFiles.clear();
+    _changedDirs.clear();
+    _timer->stop();
+}
+
+int FileWatcher::fileCount() const
+{
+    return _watcher->files().size();
+}
+
+int FileWatcher::directoryCount() const
+{
+    return _watcher->directories().size();
+}
+
+void FileWatcher::fileChanged(const QString& path)
+{
+    // A file replaced by rename drops out of the watch list; add it back.
+    if (QFileInfo::exists(path) && ! _watcher->files().contains(path))
+        _watcher->addPath(path);
+
+    _changedFiles.insert(path);
+    _timer->start();
+}
+
+void FileWatcher::dirChanged(const QString& path)
+{
+    _changedDirs.insert(path);
+    _timer->start();
+}
+
+void FileWatcher::flush()
+{
+    QStringList files = _changedFiles.values();
+    QStringList dirs = _changedDirs.values();
+    _changedFiles.clear();
+    _changedDirs.clear();
+
+    // Files which were replaced may only be re-created after the event.
+    for (const QString& fn : files) {
+        if (QFileInfo::exists(fn) && ! _watcher->files().contains(fn))
+            _watcher->addPath(fn);
+    }
+
+    _func(files, dirs, _user);
+}
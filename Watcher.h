@@ -0,0 +1,52 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+//============================================================================
+//
+// File Watcher
+//
+//============================================================================
+
+
+#include <QSet>
+#include <QStringList>
+
+class QFileSystemWatcher;
+class QTimer;
+
+/*
+ * Watches image files & directories and reports the changed paths once
+ * no further changes have arrived for the debounce interval.  Files which
+ * are replaced (as most editors do when saving) remain watched.
+ */
+class FileWatcher
+{
+public:
+    typedef void (*ChangeFunc)(const QStringList& files,
+                               const QStringList& dirs, void* user);
+
+    FileWatcher(ChangeFunc func, void* user, int debounceMs = 100);
+    ~FileWatcher();
+
+    void setPaths(const QStringList& files, const QStringList& dirs);
+    void clear();
+    int fileCount() const;
+    int directoryCount() const;
+
+private:
+    void fileChanged(const QString& path);
+    void dirChanged(const QString& path);
+    void flush();
+
+    QFileSystemWatcher* _watcher;
+    QTimer* _timer;
+    ChangeFunc _func;
+    void* _user;
+    QSet<QString> _changedFiles;
+    QSet<QString> _changedDirs;
+
+    // Disabled copy constructor and operator=
+    FileWatcher(const FileWatcher&);
+    FileWatcher& operator=(const FileWatcher&);
+};
+
+#endif  // WATCHER_H
@@ -0,0 +1,325 @@
+/*
+    Binary Image Atlas Loader
+    Version 1.0
+
+    Loads the .atlb files written by the atlas-bin export of Atlush.  The
+    file is used in place: atlb_open() checks the header and the bounds of
+    each table in constant time, and the accessors return pointers into the
+    data.  Nothing is parsed or allocated.
+
+    All fields are 32-bit little endian integers and every table starts on
+    a 4 byte boundary, so the structures are read directly on little endian
+    machines (atlb_open fails on others).  Name fields are offsets into the
+    string table, in which each name is NUL terminated.
+
+    File layout:
+
+        AtlbHeader
+        AtlbPage    [pageCount]
+        AtlbImage   [imageCount]
+        AtlbRegion  [regionCount]       Grouped by image.
+        int32_t     [hashBuckets]       Region name hash seeds (optional).
+        uint32_t    [regionCount]       Region index of each hash slot.
+        char        [stringBytes]
+
+    Region names are found with a minimal perfect hash when hashBuckets is
+    non-zero (names are unique).  See atlb_find().
+
+    Define ATLB_NO_FILE to leave out atlb_mapFile() & atlb_close().
+*/
+
+#ifndef ATL_BIN_H
+#define ATL_BIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ATLB_VERSION    1
+
+typedef struct {
+    char     magic[4];          /* "ATLB" */
+    uint32_t version;
+    uint32_t fileSize;
+    uint32_t pageCount;
+    uint32_t imageCount;
+    uint32_t regionCount;
+    uint32_t hashBuckets;       /* Zero if region names are not hashed. */
+    uint32_t stringBytes;
+    uint32_t pageOffset;
+    uint32_t imageOffset;
+    uint32_t regionOffset;
+    uint32_t hashOffset;
+    uint32_t stringOffset;
+    uint32_t reserved[3];
+} AtlbHeader;
+
+typedef struct {
+    uint32_t name;              /* Texture file. */
+    uint32_t width, height;
+    uint32_t reserved;
+} AtlbPage;
+
+typedef struct {
+    uint32_t name;              /* Source image file. */
+    uint32_t page;
+    int32_t  x, y, w, h;        /* Position on the page. */
+    uint32_t firstRegion;
+    uint32_t regionCount;
+} AtlbImage;
+
+typedef struct {
+    uint32_t name;
+    uint32_t image;
+    int32_t  x, y, w, h;        /* Position on the page. */
+    int32_t  hotx, hoty;        /* Hotspot relative to x, y. */
+} AtlbRegion;
+
+typedef struct {
+    const AtlbHeader* header;
+    const AtlbPage*   pages;
+    const AtlbImage*  images;
+    const AtlbRegion* regions;
+    const int32_t*    seeds;
+    const uint32_t*   slots;
+    const char*       strings;
+    void*  mapping;             /* Set by atlb_mapFile. */
+    size_t mapSize;
+} AtlbAtlas;
+
+enum AtlbResult {
+    ATLB_OK,
+    ATLB_ERR_FILE,              /* File cannot be opened or mapped. */
+    ATLB_ERR_FORMAT,            /* Not an atlas, or tables out of bounds. */
+    ATLB_ERR_VERSION,
+    ATLB_ERR_ENDIAN             /* Host is not little endian. */
+};
+
+static inline int atlb_tableFits(uint32_t offset, uint64_t count,
+                                 uint32_t itemSize, size_t size)
+{
+    /* Counts are below 2^33 & items are small, so this cannot overflow. */
+    return (offset & 3) == 0 &&
+           (uint64_t) offset + count * itemSize <= size;
+}
+
+/*
+ * Use an atlas held in memory.  The data must stay valid while the atlas
+ * is used and be aligned to 4 bytes.
+ *
+ * Return ATLB_OK or an error from AtlbResult.
+ */
+static inline int atlb_open(AtlbAtlas* atl, const void* data, size_t size)
+{
+    const uint32_t one = 1;
+    const char* base = (const char*) data;
+    const AtlbHeader* hdr = (const AtlbHeader*) data;
+
+    memset(atl, 0, sizeof(AtlbAtlas));
+    if (*(const char*) &one != 1)
+        return ATLB_ERR_ENDIAN;
+    if (size < sizeof(AtlbHeader) || ((uintptr_t) data & 3) ||
+        memcmp(hdr->magic, "ATLB", 4) != 0)
+        return ATLB_ERR_FORMAT;
+    if (hdr->version != ATLB_VERSION)
+        return ATLB_ERR_VERSION;
+    if (hdr->fileSize > size ||
+        ! atlb_tableFits(hdr->pageOffset, hdr->pageCount,
+                         sizeof(AtlbPage), hdr->fileSize) ||
+        ! atlb_tableFits(hdr->imageOffset, hdr->imageCount,
+                         sizeof(AtlbImage), hdr->fileSize) ||
+        ! atlb_tableFits(hdr->regionOffset, hdr->regionCount,
+                         sizeof(AtlbRegion), hdr->fileSize) ||
+        ! atlb_tableFits(hdr->hashOffset,
+                         hdr->hashBuckets ? (uint64_t) hdr->hashBuckets +
+                                            hdr->regionCount : 0,
+                         4, hdr->fileSize) ||
+        ! atlb_tableFits(hdr->stringOffset, hdr->stringBytes, 1,
+                         hdr->fileSize) ||
+        hdr->stringBytes == 0 ||
+        base[hdr->stringOffset + hdr->stringBytes - 1] != '\0')
+        return ATLB_ERR_FORMAT;
+
+    atl->header  = hdr;
+    atl->pages   = (const AtlbPage*)   (base + hdr->pageOffset);
+    atl->images  = (const AtlbImage*)  (base + hdr->imageOffset);
+    atl->regions = (const AtlbRegion*) (base + hdr->regionOffset);
+    if (hdr->hashBuckets) {
+        atl->seeds = (const int32_t*) (base + hdr->hashOffset);
+        atl->slots = (const uint32_t*) (atl->seeds + hdr->hashBuckets);
+    }
+    atl->strings = base + hdr->stringOffset;
+    return ATLB_OK;
+}
+
+/*
+ * Return a name from the string table, or "" if the offset is invalid.
+ */
+static inline const char* atlb_name(const AtlbAtlas* atl, uint32_t offset)
+{
+    return (offset < atl->header->stringBytes) ? atl->strings + offset : "";
+}
+
+/*
+ * Return page, image or region i, or NULL if i is out of range.
+ */
+static inline const AtlbPage* atlb_page(const AtlbAtlas* atl, uint32_t i)
+{
+    return (i < atl->header->pageCount) ? atl->pages + i : NULL;
+}
+
+static inline const AtlbImage* atlb_image(const AtlbAtlas* atl, uint32_t i)
+{
+    return (i < atl->header->imageCount) ? atl->images + i : NULL;
+}
+
+static inline const AtlbRegion* atlb_region(const AtlbAtlas* atl, uint32_t i)
+{
+    return (i < atl->header->regionCount) ? atl->regions + i : NULL;
+}
+
+/*
+ * Return the regions of an image and set count to the number of them.
+ */
+static inline const AtlbRegion* atlb_imageRegions(const AtlbAtlas* atl,
+                                                  uint32_t i, uint32_t* count)
+{
+    const AtlbImage* img = atlb_image(atl, i);
+    *count = 0;
+    if (! img || img->firstRegion > atl->header->regionCount ||
+        img->regionCount > atl->header->regionCount - img->firstRegion)
+        return NULL;
+    *count = img->regionCount;
+    return atl->regions + img->firstRegion;
+}
+
+/*
+ * The hash function of the Atlush frame hash (FrameHash.cpp).
+ */
+static inline uint32_t atlb_hash(const char* name, size_t len, uint32_t seed)
+{
+    const unsigned char* cp = (const unsigned char*) name;
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        h ^= cp[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/*
+ * Return the region with the given name, or NULL if there is none.  This
+ * is one hash lookup & one string compare if the names are hashed, or a
+ * linear search if not.
+ */
+static inline const AtlbRegion* atlb_find(const AtlbAtlas* atl,
+                                          const char* name)
+{
+    const AtlbHeader* hdr = atl->header;
+    const AtlbRegion* reg;
+    size_t len = strlen(name);
+    uint32_t i;
+
+    if (hdr->regionCount == 0)
+        return NULL;
+
+    if (hdr->hashBuckets) {
+        int32_t seed = atl->seeds[atlb_hash(name, len, 0) % hdr->hashBuckets];
+        if (seed < 0)
+            i = (uint32_t) (-(int64_t) seed - 1);
+        else
+            i = atlb_hash(name, len, (uint32_t) seed) % hdr->regionCount;
+        if (i >= hdr->regionCount)
+            return NULL;
+        reg = atlb_region(atl, atl->slots[i]);
+        return (reg && strcmp(atlb_name(atl, reg->name), name) == 0) ? reg
+                                                                     : NULL;
+    }
+
+    for (i = 0; i < hdr->regionCount; ++i) {
+        reg = atl->regions + i;
+        if (strcmp(atlb_name(atl, reg->name), name) == 0)
+            return reg;
+    }
+    return NULL;
+}
+
+#ifndef ATLB_NO_FILE
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Map an atlas file into memory and open it.  Call atlb_close() when done.
+ *
+ * Return ATLB_OK or an error from AtlbResult.
+ */
+static inline int atlb_mapFile(AtlbAtlas* atl, const char* path)
+{
+    void* data = NULL;
+    size_t size = 0;
+    int result;
+#ifdef _WIN32
+    LARGE_INTEGER fsize;
+    HANDLE map = NULL;
+    HANDLE fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh != INVALID_HANDLE_VALUE) {
+        if (GetFileSizeEx(fh, &fsize) && fsize.QuadPart > 0) {
+            size = (size_t) fsize.QuadPart;
+            map = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+        }
+        if (map) {
+            data = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(map);
+        }
+        CloseHandle(fh);
+    }
+#else
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = (size_t) st.st_size;
+            data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+                data = NULL;
+        }
+        close(fd);
+    }
+#endif
+    memset(atl, 0, sizeof(AtlbAtlas));
+    if (! data)
+        return ATLB_ERR_FILE;
+
+    result = atlb_open(atl, data, size);
+    atl->mapping = data;
+    atl->mapSize = size;
+    return result;
+}
+
+static inline void atlb_close(AtlbAtlas* atl)
+{
+    if (atl->mapping) {
+#ifdef _WIN32
+        UnmapViewOfFile(atl->mapping);
+#else
+        munmap(atl->mapping, atl->mapSize);
+#endif
+    }
+    memset(atl, 0, sizeof(AtlbAtlas));
+}
+#endif
+
+#endif  /* ATL_BIN_H */
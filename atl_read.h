@@ -21,6 +21,7 @@ struct AtlRegion {
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static int atl_isRelativePath(const char* path)
 {
@@ -56,131 +57,390 @@ static int atl_path(const char* path)
     return 0;
 }
 
+#define ATL_NAME_MAX    999
+#define ATL_READ_BLOCK  (64 * 1024)
+
+// Parse results.
+#define ATL_FAIL    0
+#define ATL_OK      1
+#define ATL_MORE    2       // Item continues past the end of the input.
+
 /*
- * Read items from an image-atlas file.
- *
- * Return zero on error.  In this case errorLine is set to either the line
- * number where parsing failed or -1 on a file open or read error.
+ * Incremental reader state.  Text is passed in with atl_readerFeed() in
+ * pieces of any size (e.g. as it arrives from a pipe) and each item is
+ * reported as soon as it is complete.
  */
-int atl_read(const char* path, int* errorLine,
-             void (*element)(int, const AtlRegion* reg, void*), void* user)
+typedef struct AtlReader {
+    void (*element)(int, const AtlRegion* reg, void*);
+    void* user;
+    const char* path;       // Project file, or NULL if there is none.
+    char* imagePath;        // Project directory + image name.
+    char* pending;          // Input not yet parsed.
+    size_t pendingLen;
+    size_t pendingAvail;
+    int pathLen;
+    int nested;
+    int lineCount;          // Lines parsed, or the line of an error.
+    int failed;
+    char name[ATL_NAME_MAX + 1];
+} AtlReader;
+
+static const char* atl_skipSpace(const char* cp, const char* end, int* lines)
 {
-    int done = 0;
-    FILE* fp = fopen(path, "r");
-    if (! fp) {
-        *errorLine = -1;
-        return 0;
+    while (cp != end) {
+        switch (*cp) {
+            case '\n':
+                ++*lines;
+                // Fall through...
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\v':
+            case '\f':
+                ++cp;
+                break;
+            default:
+                return cp;
+        }
+    }
+    return cp;
+}
+
+// Parse an integer as scanf("%d") does.
+static int atl_int(const char** pp, const char* end, int eof, int* lines,
+                   int* val)
+{
+    const char* cp = atl_skipSpace(*pp, end, lines);
+    const char* digits;
+    unsigned int n = 0;
+    int neg = 0;
+
+    if (cp != end && (*cp == '-' || *cp == '+')) {
+        neg = (*cp == '-');
+        ++cp;
     }
+    digits = cp;
+    while (cp != end && *cp >= '0' && *cp <= '9')
+        n = n * 10 + (unsigned int) (*cp++ - '0');
+    if (cp == end && ! eof)
+        return ATL_MORE;
+    if (cp == digits)
+        return ATL_FAIL;
 
-    {
+    *val = neg ? -(int) n : (int) n;
+    *pp = cp;
+    return ATL_OK;
+}
+
+static int atl_literal(const char** pp, const char* end, int eof,
+                       const char* lit)
+{
+    const char* cp = *pp;
+    for (; *lit; ++lit, ++cp) {
+        if (cp == end)
+            return eof ? ATL_FAIL : ATL_MORE;
+        if (*cp != *lit)
+            return ATL_FAIL;
+    }
+    *pp = cp;
+    return ATL_OK;
+}
+
+#define ATL_TRY(expr)   if ((st = (expr)) != ATL_OK) return st
+
+/*
+ * Parse '"name" x,y,w,h[,hotx,hoty]' (or with the name in braces) and
+ * report it as an image or region.
+ */
+static int atl_item(AtlReader* rd, const char** pp, const char* end, int eof,
+                    int* lines)
+{
     AtlRegion reg;
-    const size_t bufSize = 1000;
-    const char* itemPattern;
-    char* imagePath = NULL;
-    char* buf = (char*) malloc(bufSize);
-    int nested = 0;
-    int lineCount = 0;
-    int pathLen = atl_path(path);
-    char nextCh;
-    int ch;
-
-    reg.name = buf;
-
-    // Parse Boron string!/coord!/block! values.
-    while (fread(buf, 1, 1, fp) == 1) {
-next_buf0:
-      switch (buf[0]) {
-        case '"':
-            itemPattern = "%999[^\"]\" %d,%d,%d,%d%c";
-get_item:
-            if (fscanf(fp, itemPattern,
-                       buf, &reg.x, &reg.y, &reg.w, &reg.h, &nextCh) != 6)
-                goto fail;
-            if (nextCh == ',') {
-                if (fscanf(fp, "%d,%d", &reg.hotx, &reg.hoty) != 2)
-                    goto fail;
-                nextCh = 0;
-            } else
-                reg.hotx = reg.hoty = 0;
-            //printf("KR %s %d,%d,%d,%d\n", buf, reg.x, reg.y, reg.w, reg.h);
-
-            if (nested) {
-                reg.projPath = NULL;
-                reg.name = buf;
-                element(ATL_REGION, &reg, user);
-            } else {
-                if (atl_isRelativePath(buf)) {
-                    if (! imagePath) {
-                        imagePath = (char*) malloc(bufSize + pathLen);
-                        memcpy(imagePath, path, pathLen);
-                    }
-                    strcpy(imagePath + pathLen, buf);
-                    reg.projPath = imagePath;
-                } else
-                    reg.projPath = buf;
-
-                reg.name = buf;
-                element(ATL_IMAGE, &reg, user);
-            }
+    const char* cp = *pp;
+    const char* name;
+    char term = (*cp == '"') ? '"' : '}';
+    int len, st;
+
+    name = ++cp;
+    while (cp != end && *cp != term) {
+        if (*cp == '\n')
+            ++*lines;
+        ++cp;
+    }
+    if (cp == end)
+        return eof ? ATL_FAIL : ATL_MORE;
+    len = (int) (cp - name);
+    if (len < 1 || len > ATL_NAME_MAX)
+        return ATL_FAIL;
+    ++cp;
+
+    ATL_TRY(atl_int(&cp, end, eof, lines, &reg.x));
+    ATL_TRY(atl_literal(&cp, end, eof, ","));
+    ATL_TRY(atl_int(&cp, end, eof, lines, &reg.y));
+    ATL_TRY(atl_literal(&cp, end, eof, ","));
+    ATL_TRY(atl_int(&cp, end, eof, lines, &reg.w));
+    ATL_TRY(atl_literal(&cp, end, eof, ","));
+    ATL_TRY(atl_int(&cp, end, eof, lines, &reg.h));
 
-            if (nextCh) {
-                buf[0] = nextCh;
-                goto next_buf0;
+    reg.hotx = reg.hoty = 0;
+    if (cp == end) {
+        if (! eof)
+            return ATL_MORE;
+    } else if (*cp == ',') {
+        ++cp;
+        ATL_TRY(atl_int(&cp, end, eof, lines, &reg.hotx));
+        ATL_TRY(atl_literal(&cp, end, eof, ","));
+        ATL_TRY(atl_int(&cp, end, eof, lines, &reg.hoty));
+    }
+    *pp = cp;
+
+    memcpy(rd->name, name, len);
+    rd->name[len] = '\0';
+    reg.name = rd->name;
+
+    if (rd->nested) {
+        reg.projPath = NULL;
+        rd->element(ATL_REGION, &reg, rd->user);
+    } else {
+        if (rd->pathLen && atl_isRelativePath(rd->name)) {
+            if (! rd->imagePath) {
+                rd->imagePath = (char*) malloc(ATL_NAME_MAX + 1 + rd->pathLen);
+                memcpy(rd->imagePath, rd->path, rd->pathLen);
             }
-            break;
+            strcpy(rd->imagePath + rd->pathLen, rd->name);
+            reg.projPath = rd->imagePath;
+        } else
+            reg.projPath = rd->name;
+        rd->element(ATL_IMAGE, &reg, rd->user);
+    }
+    return ATL_OK;
+}
 
-        case '[':
-            ++nested;
-            element(ATL_GROUP_BEGIN, NULL, user);
-            break;
+// Parse 'image-atlas <version> <w>,<h>'.
+static int atl_document(AtlReader* rd, const char** pp, const char* end,
+                        int eof, int* lines)
+{
+    AtlRegion reg;
+    const char* cp = *pp;
+    int st;
 
-        case ']':
-            --nested;
-            element(ATL_GROUP_END, NULL, user);
-            break;
+    ATL_TRY(atl_literal(&cp, end, eof, "image-atlas"));
+    ATL_TRY(atl_int(&cp, end, eof, lines, &reg.x));
+    ATL_TRY(atl_int(&cp, end, eof, lines, &reg.w));
+    ATL_TRY(atl_literal(&cp, end, eof, ","));
+    ATL_TRY(atl_int(&cp, end, eof, lines, &reg.h));
+    if (reg.x != 1)
+        return ATL_FAIL;        // Invalid version.
+    *pp = cp;
+
+    reg.projPath = rd->path;
+    reg.name = NULL;
+    reg.y = 0;
+    rd->element(ATL_DOCUMENT, &reg, rd->user);
+    return ATL_OK;
+}
 
-        case 'i':
-            if (fscanf(fp, "mage-atlas %d %d,%d", &reg.x, &reg.w, &reg.h) != 3)
-                goto fail;
-            if (reg.x != 1)
-                goto fail;          // Invalid version.
+/*
+ * Parse the complete items of the pending input.  The bytes used are
+ * removed from the input.
+ */
+static int atl_parse(AtlReader* rd, int eof)
+{
+    const char* start = rd->pending;
+    const char* end = start + rd->pendingLen;
+    const char* cp = start;
+    const char* item;
+    int lines;
+    int st = ATL_OK;
 
-            reg.projPath = path;
-            reg.name = NULL;
-            reg.y = 0;
-            element(ATL_DOCUMENT, &reg, user);
-            break;
+    while (cp != end) {
+        item = cp;
+        lines = 0;
+        switch (*cp) {
+            case '"':
+            case '{':
+                st = atl_item(rd, &cp, end, eof, &lines);
+                break;
 
-        case '{':
-            itemPattern = "%999[^}]} %d,%d,%d,%d%c";
-            goto get_item;
+            case '[':
+                ++cp;
+                ++rd->nested;
+                rd->element(ATL_GROUP_BEGIN, NULL, rd->user);
+                break;
 
-        case ';':
-            while ((ch = fgetc(fp)) != EOF) {
-                if (ch == '\n')
-                    break;
-            }
-            break;
+            case ']':
+                ++cp;
+                --rd->nested;
+                rd->element(ATL_GROUP_END, NULL, rd->user);
+                break;
 
-        case ' ':
-        case '\t':
-            break;
+            case 'i':
+                st = atl_document(rd, &cp, end, eof, &lines);
+                break;
+
+            case ';':
+                while (cp != end && *cp != '\n')
+                    ++cp;
+                if (cp == end && ! eof)
+                    st = ATL_MORE;
+                break;
+
+            case ' ':
+            case '\t':
+            case '\r':             // Text from pipes may have CR-LF lines.
+                ++cp;
+                break;
+
+            case '\n':
+                ++cp;
+                ++lines;
+                break;
+
+            default:
+                st = ATL_FAIL;
+                break;
+        }
 
-        case '\n':
-            ++lineCount;
+        if (st != ATL_OK) {
+            if (st == ATL_FAIL)
+                rd->lineCount += lines;
+            else
+                cp = item;          // Parse again when more input arrives.
             break;
+        }
+        rd->lineCount += lines;
+    }
+
+    rd->pendingLen = (size_t) (end - cp);
+    if (rd->pendingLen && cp != start)
+        memmove(rd->pending, cp, rd->pendingLen);
+    return st;
+}
+
+#undef ATL_TRY
+
+/*
+ * \param path  Project file used to locate relative image names, or NULL.
+ */
+void atl_readerInit(AtlReader* rd, const char* path,
+                    void (*element)(int, const AtlRegion* reg, void*),
+                    void* user)
+{
+    rd->element = element;
+    rd->user = user;
+    rd->path = path;
+    rd->imagePath = NULL;
+    rd->pending = NULL;
+    rd->pendingLen = rd->pendingAvail = 0;
+    rd->pathLen = path ? atl_path(path) : 0;
+    rd->nested = 0;
+    rd->lineCount = 0;
+    rd->failed = 0;
+}
+
+void atl_readerFree(AtlReader* rd)
+{
+    free(rd->imagePath);
+    free(rd->pending);
+    rd->imagePath = rd->pending = NULL;
+}
+
+/*
+ * Return space for at least len more bytes of input.  Once it is filled
+ * pass the byte count to atl_readerParse().
+ */
+char* atl_readerBuffer(AtlReader* rd, size_t len)
+{
+    if (rd->pendingLen + len > rd->pendingAvail) {
+        size_t avail = rd->pendingAvail ? rd->pendingAvail * 2 : len;
+        while (avail < rd->pendingLen + len)
+            avail *= 2;
+        rd->pending = (char*) realloc(rd->pending, avail);
+        rd->pendingAvail = avail;
+    }
+    return rd->pending + rd->pendingLen;
+}
+
+/*
+ * Parse len bytes added to the atl_readerBuffer().
+ *
+ * Return zero on error, in which case lineCount is the line where parsing
+ * failed.
+ */
+int atl_readerParse(AtlReader* rd, size_t len)
+{
+    if (rd->failed)
+        return 0;
+    rd->pendingLen += len;
+    if (atl_parse(rd, 0) == ATL_FAIL)
+        rd->failed = 1;
+    return ! rd->failed;
+}
+
+/*
+ * Parse a piece of the input.
+ *
+ * Return zero on error, in which case lineCount is the line where parsing
+ * failed.
+ */
+int atl_readerFeed(AtlReader* rd, const char* data, size_t len)
+{
+    if (rd->failed)
+        return 0;
+    memcpy(atl_readerBuffer(rd, len), data, len);
+    return atl_readerParse(rd, len);
+}
+
+/*
+ * Parse the end of the input, which need not end with a newline.
+ *
+ * Return zero on error, in which case lineCount is the line where parsing
+ * failed.
+ */
+int atl_readerFinish(AtlReader* rd)
+{
+    if (rd->failed)
+        return 0;
+    if (atl_parse(rd, 1) != ATL_OK)
+        rd->failed = 1;
+    return ! rd->failed;
+}
 
-        default:
-            goto fail;
-      }
+/*
+ * Read items from an image-atlas file.
+ *
+ * Return zero on error.  In this case errorLine is set to either the line
+ * number where parsing failed or -1 on a file open or read error.
+ */
+int atl_read(const char* path, int* errorLine,
+             void (*element)(int, const AtlRegion*, void*), void* user)
+{
+    AtlReader rd;
+    size_t len;
+    int done = 1;
+    FILE* fp = fopen(path, "r");
+    if (! fp) {
+        *errorLine = -1;
+        return 0;
     }
-    done = 1;
 
-fail:
-    *errorLine = lineCount;
-    free(imagePath);
-    free(buf);
+    atl_readerInit(&rd, path, element, user);
+    while (done) {
+        len = fread(atl_readerBuffer(&rd, ATL_READ_BLOCK), 1, ATL_READ_BLOCK,
+                    fp);
+        if (! len)
+            break;
+        done = atl_readerParse(&rd, len);
+    }
+    if (done) {
+        if (ferror(fp)) {
+            rd.lineCount = -1;
+            done = 0;
+        } else
+            done = atl_readerFinish(&rd);
     }
+    *errorLine = rd.lineCount;
+    atl_readerFree(&rd);
 
     fclose(fp);
     return done;
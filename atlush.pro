@@ -5,10 +5,12 @@ CONFIG += qt debug
 QT += widgets
 RESOURCES = icons.qrc
 
-INCLUDEPATH = support
+include(libatlush.pri)
 
-HEADERS = AWindow.h ItemValues.h CanvasDialog.h ExtractDialog.h \
-	IOWidget.h support/RecentFiles.h support/undo.h
+HEADERS += AWindow.h ItemValues.h CanvasDialog.h ExtractDialog.h \
+	IOWidget.h Journal.h NameIndex.h RegionLayer.h Residency.h \
+	SliceDialog.h support/RecentFiles.h support/undo.h
 
-SOURCES = AWindow.cpp packImages.cpp CanvasDialog.cpp ExtractDialog.cpp \
-	IOWidget.cpp support/RecentFiles.cpp support/undo.c
+SOURCES += AWindow.cpp packImages.cpp CanvasDialog.cpp ExtractDialog.cpp \
+	IOWidget.cpp Journal.cpp NameIndex.cpp RegionLayer.cpp Residency.cpp \
+	SliceDialog.cpp support/RecentFiles.cpp support/undo.c
@@ -0,0 +1,108 @@
+/*
+  Checks that atlb_open() rejects malformed atlas headers.  This needs only
+  a C99 compiler:
+
+    cc -std=c99 -I.. atlb_test.c -o atlb_test && ./atlb_test
+*/
+
+#define ATLB_NO_FILE
+#include <stdio.h>
+#include "atl_bin.h"
+
+#define FILE_WORDS  64
+
+static uint32_t data[FILE_WORDS];
+static int failures = 0;
+
+/*
+ * Build a valid atlas with one page, one image & one hashed region.
+ */
+static AtlbHeader* validAtlas(void)
+{
+    AtlbHeader* hdr = (AtlbHeader*) data;
+    AtlbPage* page;
+    AtlbImage* img;
+    AtlbRegion* reg;
+    uint32_t* hash;
+    char* str;
+
+    memset(data, 0, sizeof(data));
+    memcpy(hdr->magic, "ATLB", 4);
+    hdr->version      = ATLB_VERSION;
+    hdr->fileSize     = sizeof(data);
+    hdr->pageCount    = 1;
+    hdr->imageCount   = 1;
+    hdr->regionCount  = 1;
+    hdr->hashBuckets  = 1;
+    hdr->stringBytes  = 8;
+    hdr->pageOffset   = sizeof(AtlbHeader);
+    hdr->imageOffset  = hdr->pageOffset + sizeof(AtlbPage);
+    hdr->regionOffset = hdr->imageOffset + sizeof(AtlbImage);
+    hdr->hashOffset   = hdr->regionOffset + sizeof(AtlbRegion);
+    hdr->stringOffset = hdr->hashOffset + 8;
+
+    page = (AtlbPage*) ((char*) data + hdr->pageOffset);
+    page->width = page->height = 64;
+
+    img = (AtlbImage*) ((char*) data + hdr->imageOffset);
+    img->w = img->h = 16;
+    img->regionCount = 1;
+
+    reg = (AtlbRegion*) ((char*) data + hdr->regionOffset);
+    reg->name = 1;
+    reg->w = reg->h = 8;
+
+    hash = (uint32_t*) ((char*) data + hdr->hashOffset);
+    hash[0] = (uint32_t) -1;    /* Single name bucket, slot 0. */
+    hash[1] = 0;
+
+    str = (char*) data + hdr->stringOffset;
+    memcpy(str, "\0frame", 7);
+    return hdr;
+}
+
+static void expect(const char* what, int result, int want)
+{
+    if (result != want) {
+        printf("FAIL %s: result %d, expected %d\n", what, result, want);
+        ++failures;
+    }
+}
+
+int main(void)
+{
+    AtlbAtlas atl;
+    AtlbHeader* hdr;
+
+    validAtlas();
+    expect("valid", atlb_open(&atl, data, sizeof(data)), ATLB_OK);
+    if (atl.header && ! atlb_find(&atl, "frame")) {
+        printf("FAIL valid: frame not found\n");
+        ++failures;
+    }
+
+    /* hashBuckets + regionCount wraps to zero in 32 bits. */
+    hdr = validAtlas();
+    hdr->hashBuckets = 0xffffffff;
+    expect("hash wrap", atlb_open(&atl, data, sizeof(data)), ATLB_ERR_FORMAT);
+
+    hdr = validAtlas();
+    hdr->regionCount = 0x10000000;
+    expect("region overflow", atlb_open(&atl, data, sizeof(data)),
+           ATLB_ERR_FORMAT);
+
+    hdr = validAtlas();
+    hdr->stringOffset = 0xfffffff0;
+    expect("string offset", atlb_open(&atl, data, sizeof(data)),
+           ATLB_ERR_FORMAT);
+
+    validAtlas();
+    expect("truncated", atlb_open(&atl, data, 100), ATLB_ERR_FORMAT);
+
+    hdr = validAtlas();
+    hdr->magic[0] = 'X';
+    expect("magic", atlb_open(&atl, data, sizeof(data)), ATLB_ERR_FORMAT);
+
+    printf("%s\n", failures ? "atlb_test failed" : "atlb_test passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,454 @@
+//============================================================================
+//
+// Atlush Benchmarks
+//
+// Times the project parser & writer, the packers, compositing, alpha
+// cropping and sprite finding on synthetic workloads and prints the results
+// as CSV or JSON.
+//
+//============================================================================
+
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImage>
+#include <QPainter>
+#include <QTemporaryDir>
+#include "AtlasModel.h"
+#include "ImageOps.h"
+#include "Packer.h"
+
+struct Result {
+    const char* bench;
+    QByteArray name;
+    int64_t count;          // Items processed per run.
+    double seconds;         // Best run.
+    double rate;
+    const char* unit;
+    double occupancy;       // Packers only; negative if not applicable.
+};
+
+static std::vector<Result> results;
+static bool quick = false;
+
+static void report(const char* bench, const QByteArray& name, int64_t count,
+                   double seconds, double rate, const char* unit,
+                   double occupancy = -1.0)
+{
+    Result res = { bench, name, count, seconds, rate, unit, occupancy };
+    results.push_back(res);
+    fprintf(stderr, "%-10s %-24s %9lld %10.4f s %12.1f %s\n",
+            bench, name.constData(), (long long) count, seconds, rate, unit);
+}
+
+// Deterministic xorshift generator so every run uses the same workload.
+struct Random {
+    uint32_t state;
+
+    Random(uint32_t seed) : state(seed) {}
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Log-uniform value in [lo, hi] (sprite sizes cluster small).
+    int logRange(int lo, int hi) {
+        double t = double(next() % 10000) / 10000.0;
+        return int(lo * pow(double(hi) / lo, t));
+    }
+};
+
+//----------------------------------------------------------------------------
+// Parser & writer
+
+#define REGIONS_PER_IMAGE   16
+
+static void makeProject(AtlasModel& model, int regions)
+{
+    Random rng(1234);
+    char name[64];
+    int images = (regions + REGIONS_PER_IMAGE - 1) / REGIONS_PER_IMAGE;
+
+    model.clear();
+    model.reserve(images, regions);
+    model.docW = model.docH = 4096;
+
+    for (int i = 0; i < images; ++i) {
+        sprintf(name, "sprites/set%03d/image%05d.png", i / 100, i);
+        int ix = int(rng.next() % 4096);
+        int iy = int(rng.next() % 4096);
+        model.addImage(0, model.intern(name), ix, iy, 512, 512);
+
+        for (int r = 0; r < REGIONS_PER_IMAGE && regions; ++r, --regions) {
+            sprintf(name, "image%05d_frame%02d", i, r);
+            int hot = (r & 1) ? int(rng.next() % 32) : 0;
+            model.addRegion(0, model.intern(name),
+                            ix + (r & 3) * 128, iy + (r >> 2) * 128,
+                            rng.logRange(8, 128), rng.logRange(8, 128),
+                            hot, hot);
+        }
+    }
+}
+
+static void benchProject(const QString& dir, int regions)
+{
+    AtlasModel model;
+    QElapsedTimer timer;
+    QByteArray name = QByteArray::number(regions) + " regions";
+    QByteArray path = (dir + "/bench.atl").toLocal8Bit();
+    int runs = (regions >= 100000) ? 1 : 3;
+    double best;
+
+    makeProject(model, regions);
+    int64_t items = model.imageCount() + model.regionCount();
+
+    best = 1e30;
+    for (int n = 0; n < runs; ++n) {
+        timer.start();
+        if (! model.save(path.constData())) {
+            fprintf(stderr, "Cannot write %s\n", path.constData());
+            return;
+        }
+        best = qMin(best, timer.nsecsElapsed() * 1e-9);
+    }
+    double mb = double(QFileInfo(path).size()) / (1024.0 * 1024.0);
+    report("save", name, items, best, mb / best, "MiB/s");
+
+    best = 1e30;
+    for (int n = 0; n < runs; ++n) {
+        AtlasModel loaded;
+        int errorLine;
+        timer.start();
+        if (! loaded.load(path.constData(), &errorLine)) {
+            fprintf(stderr, "Parse error on line %d\n", errorLine);
+            return;
+        }
+        best = qMin(best, timer.nsecsElapsed() * 1e-9);
+    }
+    report("atl_read", name, items, best, mb / best, "MiB/s");
+}
+
+//----------------------------------------------------------------------------
+// Packers
+
+struct Sprite {
+    int w, h;
+    int x, y;
+    bool packed;
+};
+
+static void makeSprites(std::vector<Sprite>& list, int count)
+{
+    Random rng(5678);
+    list.resize(count);
+    for (Sprite& sp : list) {
+        sp.w = rng.logRange(8, 256);
+        sp.h = rng.logRange(8, 256);
+        sp.x = sp.y = 0;
+        sp.packed = false;
+    }
+}
+
+static int canvasSide(const std::vector<Sprite>& list)
+{
+    double area = 0.0;
+    for (const Sprite& sp : list)
+        area += double(sp.w) * sp.h;
+    int side = int(sqrt(area * 1.25));
+    return (side + 255) & ~255;
+}
+
+static void placeSprite(int id, int x, int y, void* user)
+{
+    Sprite& sp = (*(std::vector<Sprite>*) user)[id];
+    sp.x = x;
+    sp.y = y;
+    sp.packed = true;
+}
+
+// Return the sprite area divided by the bounding box of the packed sprites.
+static double occupancy(const std::vector<Sprite>& list)
+{
+    double area = 0.0;
+    int right = 0;
+    int bottom = 0;
+    for (const Sprite& sp : list) {
+        if (! sp.packed)
+            continue;
+        area += double(sp.w) * sp.h;
+        right  = qMax(right, sp.x + sp.w);
+        bottom = qMax(bottom, sp.y + sp.h);
+    }
+    return (right && bottom) ? area / (double(right) * bottom) : 0.0;
+}
+
+static const char* algoName[] = {
+    "BinPack", "BinPackSort", "SkyLine", "SkyLineBF"
+};
+
+static void benchPack(int count)
+{
+    std::vector<Sprite> list;
+    QElapsedTimer timer;
+
+    makeSprites(list, count);
+    int side = canvasSide(list);
+
+    for (int algo = PA_BinPack; algo <= PA_SkyLineBF; ++algo) {
+        // BinPack is quadratic; skip the sizes which take minutes.
+        if (algo <= PA_BinPackSort && count > 10000)
+            continue;
+
+        for (Sprite& sp : list)
+            sp.packed = false;
+
+        RectPacker packer(algo);
+        for (size_t i = 0; i < list.size(); ++i)
+            packer.addInput(int(i), 0, 0, list[i].w, list[i].h);
+
+        timer.start();
+        int leftover = packer.pack(side, side, placeSprite, &list);
+        double sec = timer.nsecsElapsed() * 1e-9;
+
+        QByteArray name(algoName[algo]);
+        name += ' ';
+        name += QByteArray::number(count);
+        if (leftover)
+            name += " (" + QByteArray::number(leftover) + " left)";
+        report("pack", name, count, sec, count / sec, "rects/s",
+               occupancy(list));
+    }
+}
+
+//----------------------------------------------------------------------------
+// Compositing (as done by Export Image)
+
+static void benchComposite(int count)
+{
+    std::vector<Sprite> list;
+    std::vector<QImage> images;
+    QElapsedTimer timer;
+    Random rng(91011);
+
+    makeSprites(list, count);
+    int side = canvasSide(list);
+    {
+    RectPacker packer(PA_SkyLineBF);
+    for (size_t i = 0; i < list.size(); ++i)
+        packer.addInput(int(i), 0, 0, list[i].w, list[i].h);
+    packer.pack(side, side, placeSprite, &list);
+    }
+
+    int64_t pixels = 0;
+    images.reserve(count);
+    for (const Sprite& sp : list) {
+        QImage img(sp.w, sp.h, QImage::Format_ARGB32_Premultiplied);
+        img.fill(QColor(rng.next() & 255, rng.next() & 255, 128, 200));
+        images.push_back(img);
+        pixels += int64_t(sp.w) * sp.h;
+    }
+
+    QImage canvas(side, side, QImage::Format_ARGB32_Premultiplied);
+    double best = 1e30;
+    for (int n = 0; n < 3; ++n) {
+        timer.start();
+        canvas.fill(0);
+        QPainter ip(&canvas);
+        for (size_t i = 0; i < list.size(); ++i) {
+            if (list[i].packed)
+                ip.drawImage(list[i].x, list[i].y, images[i]);
+        }
+        ip.end();
+        best = qMin(best, timer.nsecsElapsed() * 1e-9);
+    }
+    report("composite", QByteArray::number(count) + " sprites", count, best,
+           double(pixels) / best * 1e-6, "Mpixel/s");
+}
+
+//----------------------------------------------------------------------------
+// Alpha cropping
+
+static void benchCrop(int margin)
+{
+    const int side = 256;
+    const int count = quick ? 50 : 200;
+    QImage img(side, side, QImage::Format_ARGB32);
+    QElapsedTimer timer;
+
+    img.fill(Qt::transparent);
+    if (margin * 2 < side) {
+        QPainter ip(&img);
+        ip.fillRect(margin, margin, side - margin * 2, side - margin * 2,
+                    QColor(255, 0, 0, 255));
+    }
+
+    QRect rect;
+    timer.start();
+    for (int n = 0; n < count; ++n)
+        cropAlpha(img, rect);
+    double sec = timer.nsecsElapsed() * 1e-9;
+
+    QByteArray name = (margin * 2 < side)
+                    ? "margin " + QByteArray::number(margin)
+                    : QByteArray("empty");
+    report("cropAlpha", name, count, sec,
+           double(side) * side * count / sec * 1e-6, "Mpixel/s");
+}
+
+//----------------------------------------------------------------------------
+// Sprite finding (as done by Auto Slice)
+
+/*
+ * Time findBlobs on a sprite sheet of ellipses in 64 pixel cells, each with
+ * a few specks around it which are joined to it by larger merge distances.
+ */
+static void benchBlobs(int merge)
+{
+    const int side = quick ? 2048 : 4096;
+    const int cell = 64;
+    QImage img(side, side, QImage::Format_ARGB32);
+    QElapsedTimer timer;
+    Random rng(1213);
+
+    img.fill(Qt::transparent);
+    {
+    QPainter ip(&img);
+    ip.setPen(Qt::NoPen);
+    ip.setBrush(QColor(200, 80, 40, 255));
+    for (int y = 0; y < side; y += cell) {
+        for (int x = 0; x < side; x += cell) {
+            int w = 8 + rng.next() % 40;
+            int h = 8 + rng.next() % 40;
+            ip.drawEllipse(x + 4, y + 4, w, h);
+            for (int n = rng.next() % 4; n > 0; --n)
+                ip.drawRect(x + 4 + rng.next() % 56, y + 4 + rng.next() % 56,
+                            1, 1);
+        }
+    }
+    }
+
+    std::vector<QRect> blobs;
+    double best = 1e30;
+    for (int n = 0; n < 3; ++n) {
+        timer.start();
+        findBlobs(img, 0, merge, blobs);
+        best = qMin(best, timer.nsecsElapsed() * 1e-9);
+    }
+    report("findBlobs", "merge " + QByteArray::number(merge),
+           int64_t(blobs.size()), best, double(side) * side / best * 1e-6,
+           "Mpixel/s");
+}
+
+//----------------------------------------------------------------------------
+
+static void printCSV(FILE* fp)
+{
+    fprintf(fp, "benchmark,case,count,seconds,rate,unit,occupancy\n");
+    for (const Result& r : results) {
+        fprintf(fp, "%s,\"%s\",%lld,%.6f,%.3f,%s,", r.bench,
+                r.name.constData(), (long long) r.count, r.seconds, r.rate,
+                r.unit);
+        if (r.occupancy >= 0.0)
+            fprintf(fp, "%.4f", r.occupancy);
+        fputc('\n', fp);
+    }
+}
+
+static void printJSON(FILE* fp)
+{
+    fprintf(fp, "[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        fprintf(fp, "  {\"benchmark\":\"%s\",\"case\":\"%s\",\"count\":%lld,"
+                    "\"seconds\":%.6f,\"rate\":%.3f,\"unit\":\"%s\"",
+                r.bench, r.name.constData(), (long long) r.count, r.seconds,
+                r.rate, r.unit);
+        if (r.occupancy >= 0.0)
+            fprintf(fp, ",\"occupancy\":%.4f", r.occupancy);
+        fprintf(fp, "}%s\n", (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(fp, "]\n");
+}
+
+static void usage()
+{
+    printf("Usage: atlbench [-h] [-j] [-q] [-o <file>]\n\n"
+           "Options:\n"
+           "  -h         Print this help and exit.\n"
+           "  -j         Output JSON rather than CSV.\n"
+           "  -o <file>  Write results to file rather than stdout.\n"
+           "  -q         Quick run with smaller workloads.\n\n"
+           "Progress is printed to stderr.\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* outFile = NULL;
+    bool json = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-j") == 0)
+            json = true;
+        else if (strcmp(arg, "-q") == 0)
+            quick = true;
+        else if (strcmp(arg, "-o") == 0 && i + 1 < argc)
+            outFile = argv[++i];
+        else {
+            usage();
+            return (strcmp(arg, "-h") == 0) ? 0 : 1;
+        }
+    }
+
+    QTemporaryDir tmp;
+    if (! tmp.isValid()) {
+        fprintf(stderr, "Cannot create temporary directory\n");
+        return 1;
+    }
+
+    int maxRegions = quick ? 100000 : 1000000;
+    for (int n = 1000; n <= maxRegions; n *= 10)
+        benchProject(tmp.path(), n);
+
+    benchPack(1000);
+    benchPack(10000);
+    if (! quick)
+        benchPack(50000);
+
+    benchComposite(1000);
+    if (! quick)
+        benchComposite(5000);
+
+    benchCrop(0);
+    benchCrop(16);
+    benchCrop(64);
+    benchCrop(120);
+    benchCrop(128);     // Fully transparent.
+
+    benchBlobs(0);
+    benchBlobs(4);
+    benchBlobs(32);
+
+    FILE* fp = stdout;
+    if (outFile) {
+        fp = fopen(outFile, "w");
+        if (! fp) {
+            fprintf(stderr, "Cannot open %s\n", outFile);
+            return 1;
+        }
+    }
+    if (json)
+        printJSON(fp);
+    else
+        printCSV(fp);
+    if (fp != stdout)
+        fclose(fp);
+    return 0;
+}
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = atlbench
+OBJECTS_DIR = obj
+DESTDIR = ..
+
+CONFIG += qt console release
+CONFIG -= app_bundle
+QT = core gui
+
+include(../libatlush.pri)
+
+SOURCES += atlbench.cpp
@@ -0,0 +1,211 @@
+//============================================================================
+//
+// Atlush Runner Daemon
+//
+//============================================================================
+
+
+#include <stdio.h>
+#include <QDir>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include "Daemon.h"
+#include "Profiler.h"
+
+#define CONNECT_TIMEOUT 500     // Milliseconds
+
+// Client environment variables which are passed with each request.
+static const char* forwardEnv[] = { "ATLUSH_BUILD_CACHE", NULL };
+
+/*
+ * Escape backslashes & newlines so that a request value fits on one line.
+ */
+static QByteArray escapeValue(const QByteArray& val)
+{
+    QByteArray out;
+    out.reserve(val.size());
+    for (char c : val) {
+        if (c == '\\')
+            out += "\\\\";
+        else if (c == '\n')
+            out += "\\n";
+        else
+            out += c;
+    }
+    return out;
+}
+
+static QByteArray unescapeValue(const QByteArray& val)
+{
+    QByteArray out;
+    out.reserve(val.size());
+    for (int i = 0; i < val.size(); ++i) {
+        char c = val[i];
+        if (c == '\\' && i + 1 < val.size()) {
+            c = val[++i];
+            if (c == 'n')
+                c = '\n';
+        }
+        out += c;
+    }
+    return out;
+}
+
+RunDaemon::RunDaemon()
+{
+    _server = new QLocalServer;
+    QObject::connect(_server, &QLocalServer::newConnection,
+                     [this]() { accept(); });
+}
+
+RunDaemon::~RunDaemon()
+{
+    delete _server;
+}
+
+bool RunDaemon::listen(const QString& name, RunOutput& out)
+{
+    // Only remove the socket of a daemon which is no longer running.
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(CONNECT_TIMEOUT)) {
+        out.error("atlrun: A daemon is already listening on %s\n",
+                  name.toLocal8Bit().constData());
+        return false;
+    }
+    QLocalServer::removeServer(name);
+
+    _server->setSocketOptions(QLocalServer::UserAccessOption);
+    if (! _server->listen(name)) {
+        out.error("atlrun: Cannot listen on %s (%s)\n",
+                  name.toLocal8Bit().constData(),
+                  _server->errorString().toLocal8Bit().constData());
+        return false;
+    }
+    out.print("Listening on %s\n",
+              _server->fullServerName().toLocal8Bit().constData());
+    return true;
+}
+
+void RunDaemon::accept()
+{
+    while (QLocalSocket* sock = _server->nextPendingConnection()) {
+        QObject::connect(sock, &QLocalSocket::readyRead,
+                         [this, sock]() { readRequest(sock); });
+        QObject::connect(sock, &QLocalSocket::disconnected, [this, sock]() {
+            _pending.remove(sock);
+            sock->deleteLater();
+        });
+    }
+}
+
+void RunDaemon::readRequest(QLocalSocket* sock)
+{
+    QByteArray& req = _pending[sock];
+    req += sock->readAll();
+    if (! req.endsWith("\n\n"))
+        return;     // Incomplete.
+
+    QByteArray reply = handle(req);
+    _pending.remove(sock);
+    sock->write(reply);
+    sock->disconnectFromServer();
+}
+
+/*
+ * Run one request and return the reply.
+ */
+QByteArray RunDaemon::handle(const QByteArray& request)
+{
+    RunOutput out(true);
+    QList<QByteArray> args;
+    QHash<QByteArray, QByteArray> env;
+    QString cwd;
+
+    for (const QByteArray& line : request.split('\n')) {
+        if (line.startsWith("cwd ")) {
+            cwd = QString::fromLocal8Bit(unescapeValue(line.mid(4)));
+        } else if (line.startsWith("arg ")) {
+            args << unescapeValue(line.mid(4));
+        } else if (line.startsWith("env ")) {
+            int eq = line.indexOf('=');
+            if (eq > 4)
+                env.insert(line.mid(4, eq - 4),
+                           unescapeValue(line.mid(eq + 1)));
+        }
+    }
+
+    // Requests run one at a time, so the working directory can be switched
+    // to that of the client.  This is done before parsing so that project
+    // globs & manifests are found relative to the client.
+    QString prevDir = QDir::currentPath();
+    RunOptions opt;
+    opt.cacheDir = env.value("ATLUSH_BUILD_CACHE");
+    int status;
+    if (cwd.isEmpty() || ! QDir::setCurrent(cwd)) {
+        out.error("atlrun: Cannot change to client directory %s\n",
+                  cwd.toLocal8Bit().constData());
+        status = 1;
+    } else if ((status = parseRunOptions(args, opt, out)) < 0) {
+        if (opt.command == "watch" || opt.command == "serve") {
+            out.error("atlrun: %s is not available from the daemon\n",
+                      opt.command.constData());
+            status = 1;
+        } else {
+            Profiler& prof = Profiler::instance();
+            prof.clear();
+            prof.setTraceFile(QString::fromLocal8Bit(opt.trace));
+            status = runCommand(opt, out, &_resident);
+            prof.writeTrace();
+        }
+    }
+    QDir::setCurrent(prevDir);
+
+    QByteArray reply(out.text());
+    reply += "s " + QByteArray::number(status) + '\n';
+    return reply;
+}
+
+/*
+ * Send a command to a daemon and print its output.  Return false if no
+ * daemon is listening.
+ */
+bool daemonRequest(const QString& name, const QList<QByteArray>& args,
+                   int* status)
+{
+    QLocalSocket sock;
+    sock.connectToServer(name);
+    if (! sock.waitForConnected(CONNECT_TIMEOUT))
+        return false;
+
+    QByteArray req("cwd ");
+    req += escapeValue(QDir::currentPath().toLocal8Bit());
+    req += '\n';
+    for (const char** name = forwardEnv; *name; ++name) {
+        req += "env ";
+        req += *name;
+        req += '=' + escapeValue(qgetenv(*name)) + '\n';
+    }
+    for (const QByteArray& arg : args)
+        req += "arg " + escapeValue(arg) + '\n';
+    req += '\n';
+    sock.write(req);
+
+    QByteArray reply;
+    while (sock.state() == QLocalSocket::ConnectedState) {
+        sock.waitForReadyRead(-1);
+        reply += sock.readAll();
+    }
+    reply += sock.readAll();
+
+    *status = 1;
+    for (const QByteArray& line : reply.split('\n')) {
+        if (line.startsWith("o "))
+            printf("%s\n", line.constData() + 2);
+        else if (line.startsWith("e "))
+            fprintf(stderr, "%s\n", line.constData() + 2);
+        else if (line.startsWith("s "))
+            *status = line.mid(2).toInt();
+    }
+    return true;
+}
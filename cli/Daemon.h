@@ -0,0 +1,57 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+//============================================================================
+//
+// Atlush Runner Daemon
+//
+//============================================================================
+
+
+#include <QHash>
+#include <QString>
+#include "Runner.h"
+
+class QLocalServer;
+class QLocalSocket;
+
+#define DEFAULT_SOCKET  "atlush-daemon"
+
+/*
+ * Serves runner commands on a local socket (a Unix domain socket, or a
+ * named pipe on Windows).  Decoded images, parsed projects, pack results
+ * and exports stay resident between requests so that repeated builds of
+ * the same projects only redo work for files which changed.
+ *
+ * A request is a "cwd <dir>" line, an "env <name>=<value>" line for each
+ * client environment variable the runner uses, an "arg <value>" line per
+ * argument, and an empty line.  Backslashes & newlines in values are
+ * escaped as "\\" & "\n".  The reply is the command output as lines
+ * starting with "o " (stdout) or "e " (stderr) followed by
+ * "s <exit status>".
+ */
+class RunDaemon
+{
+public:
+    RunDaemon();
+    ~RunDaemon();
+
+    bool listen(const QString& name, RunOutput& out);
+
+private:
+    void accept();
+    void readRequest(QLocalSocket*);
+    QByteArray handle(const QByteArray& request);
+
+    QLocalServer* _server;
+    QHash<QLocalSocket*, QByteArray> _pending;
+    ResidentState _resident;
+
+    // Disabled copy constructor and operator=
+    RunDaemon(const RunDaemon&);
+    RunDaemon& operator=(const RunDaemon&);
+};
+
+extern bool daemonRequest(const QString& name, const QList<QByteArray>& args,
+                          int* status);
+
+#endif  // DAEMON_H
@@ -0,0 +1,875 @@
+//============================================================================
+//
+// Atlush Headless Runner
+//
+// Applies editor operations to a project file without the GUI.
+//
+//============================================================================
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThreadPool>
+#include "libatlush.h"
+#include "atl_bin.h"
+#include "Runner.h"
+
+const char* runUsage =
+    "Usage: atlrun <command> [options] <project.atl> ...\n\n"
+    "Projects may be given as a list, as wildcard patterns (e.g. \"*.atl\"),\n"
+    "or as @<file> to read a manifest with one project per line.  Several\n"
+    "projects are built at once and a summary is printed at the end.\n\n"
+    "Commands:\n"
+    "  info     Print the number of images & regions.\n"
+    "  pack     Pack the images.\n"
+    "  export   Write an image of all the project images, or the\n"
+    "           frames in a data format (-f).\n"
+    "  crop     Remove transparent edges from the images.\n"
+    "  save     Write the project (to -o or in place).\n"
+    "  verify   Check a hash-bin or atlas-bin file (given instead of\n"
+    "           a project).\n"
+    "  watch    Pack (and export with -e) whenever an image, image\n"
+    "           directory or the project changes.\n"
+    "  serve    Run a daemon which handles the other commands.\n\n"
+    "Options:\n"
+    "  -a <algo>      Pack algorithm (binpack, binpack-sort, skyline,\n"
+    "                 skyline-bf).  The default is skyline-bf.\n"
+    "  -c <dir>       Build cache directory for pack & export.  The\n"
+    "                 ATLUSH_BUILD_CACHE variable sets the default.\n"
+    "  -d <dir>       Directory for cropped images.\n"
+    "  -e <image>     Image to export after pack & watch.  With\n"
+    "                 export -f, the image named in the data.\n"
+    "  -f <format>    Data format for export (json-hash, json-array,\n"
+    "                 c-header, lua, hash-c, hash-bin, atlas-bin).\n"
+    "  -h             Print this help and exit.\n"
+    "  -i <dir>       Add new images from directory (pack & watch).\n"
+    "                 Images whose files are removed are dropped.\n"
+    "                 May be used more than once.\n"
+    "  -j <count>     Number of projects built at once.  The default\n"
+    "                 is the number of processor threads.\n"
+    "  -o <file>      Output project or image.  Pack & crop replace\n"
+    "                 the input project by default.  With several\n"
+    "                 projects a '*' in -o, -e or -d is replaced by\n"
+    "                 the project name.\n"
+    "  -p <pixels>    Padding between packed images.\n"
+    "  -s <w>x<h>     Canvas size for pack (default is the document\n"
+    "                 size or 1024x2048).\n"
+    "  -S <name>      Daemon socket.  Commands are sent to a running\n"
+    "                 daemon if there is one.  The ATLUSH_DAEMON variable\n"
+    "                 sets the default.\n"
+    "  --trace <file> Write Chrome trace events to file.\n";
+
+static const char* algoNames[] = {
+    "binpack", "binpack-sort", "skyline", "skyline-bf", NULL
+};
+
+RunOptions::RunOptions()
+    : algo(PA_SkyLineBF), pad(0), w(0), h(0), format(-1), jobs(0)
+{
+    cacheDir = qgetenv("ATLUSH_BUILD_CACHE");
+    socket   = qgetenv("ATLUSH_DAEMON");
+}
+
+void RunOutput::append(char stream, const char* fmt, va_list args)
+{
+    char small[512];
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(small, sizeof(small), fmt, args);
+    QByteArray large;
+    char* buf = small;
+    if (len >= int(sizeof(small))) {
+        large.resize(len + 1);
+        buf = large.data();
+        vsnprintf(buf, len + 1, fmt, copy);
+    }
+    va_end(copy);
+
+    if (! _buffered) {
+        FILE* fp = (stream == 'e') ? stderr : stdout;
+        fputs(buf, fp);
+        fflush(fp);
+        return;
+    }
+
+    // Each line is sent with its stream code.
+    for (const char* cp = buf; *cp; ) {
+        const char* end = strchr(cp, '\n');
+        int len = end ? int(end - cp) : int(strlen(cp));
+        _text += stream;
+        _text += ' ';
+        _text.append(cp, len);
+        _text += '\n';
+        cp += end ? len + 1 : len;
+    }
+}
+
+/*
+ * Send buffered output on to another RunOutput.
+ */
+void RunOutput::replay(RunOutput& to) const
+{
+    for (const QByteArray& line : _text.split('\n')) {
+        if (line.startsWith("o "))
+            to.print("%s\n", line.constData() + 2);
+        else if (line.startsWith("e "))
+            to.error("%s\n", line.constData() + 2);
+    }
+}
+
+void RunOutput::print(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    append('o', fmt, args);
+    va_end(args);
+}
+
+void RunOutput::error(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    append('e', fmt, args);
+    va_end(args);
+}
+
+static int parseAlgorithm(const char* name)
+{
+    for (int i = 0; algoNames[i]; ++i) {
+        if (strcmp(name, algoNames[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static bool hasWildcard(const QString& str)
+{
+    return str.contains('*') || str.contains('?') || str.contains('[');
+}
+
+/*
+ * Return name relative to the directory base (without a "./" prefix).
+ */
+static QString relativeTo(const QString& base, const QString& name)
+{
+    if (base.isEmpty() || base == "." || QDir::isAbsolutePath(name))
+        return name;
+    return base + '/' + name;
+}
+
+/*
+ * Add a project argument to the list.  Wildcards are only expanded in the
+ * file name part of the path.  Manifest entries are relative to the
+ * manifest file.
+ */
+static bool addProjects(QList<QByteArray>& list, const QByteArray& arg,
+                        const QString& base, RunOutput& out)
+{
+    if (arg.startsWith('@')) {
+        QString path = relativeTo(base, QString::fromLocal8Bit(arg.mid(1)));
+        QFile file(path);
+        if (! file.open(QIODevice::ReadOnly)) {
+            out.error("atlrun: Cannot read manifest %s\n",
+                      path.toLocal8Bit().constData());
+            return false;
+        }
+        QString mdir = QFileInfo(path).path();
+        while (! file.atEnd()) {
+            QByteArray line = file.readLine().trimmed();
+            if (line.isEmpty() || line[0] == '#')
+                continue;
+            if (! addProjects(list, line, mdir, out))
+                return false;
+        }
+        return true;
+    }
+
+    QString path = relativeTo(base, QString::fromLocal8Bit(arg));
+    QFileInfo info(path);
+    if (! hasWildcard(info.fileName()) || info.exists()) {
+        list << path.toLocal8Bit();
+        return true;
+    }
+
+    const QStringList names = info.dir().entryList(
+            QStringList(info.fileName()), QDir::Files, QDir::Name);
+    if (names.isEmpty()) {
+        out.error("atlrun: No projects match %s\n",
+                  path.toLocal8Bit().constData());
+        return false;
+    }
+    for (const QString& fn : names)
+        list << relativeTo(info.path(), fn).toLocal8Bit();
+    return true;
+}
+
+/*
+ * Return -1 if the command should be run, or the exit status.
+ */
+int parseRunOptions(const QList<QByteArray>& args, RunOptions& opt,
+                    RunOutput& out)
+{
+    for (int i = 0; i < args.size(); ++i) {
+        const char* arg = args[i].constData();
+        bool hasValue = (i + 1 < args.size());
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            out.print("%s", runUsage);
+            return 0;
+        } else if (strcmp(arg, "-a") == 0 && hasValue) {
+            opt.algo = parseAlgorithm(args[++i].constData());
+            if (opt.algo < 0) {
+                out.error("atlrun: Invalid algorithm %s\n",
+                          args[i].constData());
+                return 1;
+            }
+        } else if (strcmp(arg, "-c") == 0 && hasValue) {
+            opt.cacheDir = args[++i];
+        } else if (strcmp(arg, "-d") == 0 && hasValue) {
+            opt.cropDir = args[++i];
+        } else if (strcmp(arg, "-e") == 0 && hasValue) {
+            opt.exportFile = args[++i];
+        } else if (strcmp(arg, "-f") == 0 && hasValue) {
+            opt.format = dataFormatByName(args[++i].constData());
+            if (opt.format < 0) {
+                out.error("atlrun: Invalid data format %s\n",
+                          args[i].constData());
+                return 1;
+            }
+        } else if (strcmp(arg, "-i") == 0 && hasValue) {
+            opt.imageDirs << QString::fromLocal8Bit(args[++i]);
+        } else if (strcmp(arg, "-j") == 0 && hasValue) {
+            opt.jobs = atoi(args[++i].constData());
+        } else if (strcmp(arg, "-o") == 0 && hasValue) {
+            opt.outFile = args[++i];
+        } else if (strcmp(arg, "-p") == 0 && hasValue) {
+            opt.pad = atoi(args[++i].constData());
+        } else if (strcmp(arg, "-s") == 0 && hasValue) {
+            if (sscanf(args[++i].constData(), "%dx%d", &opt.w, &opt.h) != 2 ||
+                opt.w < 1 || opt.h < 1) {
+                out.error("atlrun: Invalid size %s\n", args[i].constData());
+                return 1;
+            }
+        } else if (strcmp(arg, "-S") == 0 && hasValue) {
+            opt.socket = args[++i];
+        } else if (strcmp(arg, "--trace") == 0 && hasValue) {
+            opt.trace = args[++i];
+        } else if (arg[0] == '-') {
+            out.error("%s", runUsage);
+            return 1;
+        } else if (opt.command.isEmpty()) {
+            opt.command = args[i];
+        } else if (! addProjects(opt.projects, args[i], QString(), out)) {
+            return 1;
+        }
+    }
+    if (opt.command.isEmpty() ||
+        (opt.projects.isEmpty() && opt.command != "serve")) {
+        out.error("%s", runUsage);
+        return 1;
+    }
+    if (opt.projects.size() > 1) {
+        if (opt.command == "watch") {
+            out.error("atlrun: watch takes a single project\n");
+            return 1;
+        }
+        if ((! opt.outFile.isEmpty() && ! opt.outFile.contains('*')) ||
+            (! opt.exportFile.isEmpty() && ! opt.exportFile.contains('*'))) {
+            out.error("atlrun: -o & -e need a '*' for several projects\n");
+            return 1;
+        }
+    }
+    if (! opt.projects.isEmpty())
+        opt.project = opt.projects[0];
+    return -1;
+}
+
+static void fileStamp(const QString& path, qint64& mtime, qint64& size)
+{
+    QFileInfo info(path);
+    mtime = info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1;
+    size  = info.size();
+}
+
+static void appendStamp(QByteArray& key, const QString& path)
+{
+    qint64 stamp[2];
+    fileStamp(path, stamp[0], stamp[1]);
+    key.append((const char*) stamp, sizeof(stamp));
+}
+
+static bool saveModel(const AtlasModel& model, const char* path,
+                      RunOutput& out)
+{
+    PROFILE(prof, "Save");
+    if (! model.save(path)) {
+        out.error("atlrun: Cannot write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Load a project, or copy it from the resident state if the file has not
+ * changed since it was last read.
+ */
+static bool loadModel(AtlasModel& model, const char* path, RunOutput& out,
+                      ResidentState* resident)
+{
+    PROFILE(prof, "Load");
+    QString key;
+    qint64 mtime, size;
+    if (resident) {
+        key = QFileInfo(QString::fromLocal8Bit(path)).absoluteFilePath();
+        fileStamp(key, mtime, size);
+        auto it = resident->models.constFind(key);
+        if (it != resident->models.constEnd() &&
+            it->mtime == mtime && it->size == size) {
+            model = it->model;
+            return true;
+        }
+    }
+
+    int errorLine;
+    if (! model.load(path, &errorLine)) {
+        if (errorLine > 0)
+            out.error("atlrun: %s:%d: Parse error\n", path, errorLine);
+        else
+            out.error("atlrun: Cannot read %s\n", path);
+        return false;
+    }
+    prof.addItems(model.imageCount() + model.regionCount());
+
+    if (resident) {
+        ResidentState::Model& rm = resident->models[key];
+        rm.mtime = mtime;
+        rm.size  = size;
+        rm.model = model;
+    }
+    return true;
+}
+
+static bool exportModel(const AtlasModel& model, const QDir& dir,
+                        const char* path, RunOutput& out,
+                        ResidentState* resident)
+{
+    PROFILE(prof, "Export");
+    QString fn(QString::fromLocal8Bit(path));
+    QString apath;
+    QByteArray key;
+
+    if (resident) {
+        // Skip the export if the same images are at the same positions and
+        // the image written last time is still there.
+        int count = model.imageCount();
+        for (int i = 0; i < count; ++i) {
+            const QByteArray& name = model.imageName(i);
+            int pos[2] = { model.imageX[i], model.imageY[i] };
+            key.append((const char*) pos, sizeof(pos));
+            key.append(name);
+            appendStamp(key, dir.filePath(QString::fromUtf8(name)));
+        }
+        apath = QFileInfo(fn).absoluteFilePath();
+        auto it = resident->exports.constFind(apath);
+        if (it != resident->exports.constEnd() && it->key == key) {
+            qint64 mtime, size;
+            fileStamp(apath, mtime, size);
+            if (it->mtime == mtime && it->size == size)
+                return true;
+        }
+    }
+
+    int missing;
+    QImage img = compositeModel(model, dir, &missing);
+    if (missing)
+        out.error("atlrun: %d images could not be read\n", missing);
+
+    // The file is replaced rather than rewritten as it may be a hard link
+    // into the build cache.
+    QSaveFile file(fn);
+    if (img.isNull() || ! file.open(QIODevice::WriteOnly) ||
+        ! img.save(&file, QFileInfo(fn).suffix().toLatin1().constData()) ||
+        ! file.commit()) {
+        out.error("atlrun: Cannot write %s\n", path);
+        return false;
+    }
+
+    if (resident) {
+        ResidentState::Export& ex = resident->exports[apath];
+        ex.key = key;
+        fileStamp(apath, ex.mtime, ex.size);
+    }
+    return true;
+}
+
+/*
+ * Add the project text and the content of every image to the cache key.
+ */
+static void hashInputs(BuildCache* cache, const AtlasModel& model,
+                       const QDir& dir, const char* project)
+{
+    PROFILE(prof, "Hash");
+    QFile file(QString::fromLocal8Bit(project));
+    if (file.open(QIODevice::ReadOnly))
+        cache->addData(file.readAll());
+
+    int count = model.imageCount();
+    for (int i = 0; i < count; ++i)
+        cache->addFile(dir.filePath(QString::fromUtf8(model.imageName(i))));
+    prof.addItems(count);
+}
+
+/*
+ * Return the key of a resident pack result.  This covers the project and
+ * every image it holds once the image directories have been merged in.
+ */
+static QByteArray packKey(const RunOptions& opt, const AtlasModel& model,
+                          const QDir& dir)
+{
+    QByteArray key;
+    int settings[4] = { opt.algo, opt.pad, opt.w, opt.h };
+    key.append((const char*) settings, sizeof(settings));
+    appendStamp(key, QString::fromLocal8Bit(opt.project));
+
+    int count = model.imageCount();
+    for (int i = 0; i < count; ++i) {
+        QString name(QString::fromUtf8(model.imageName(i)));
+        key.append(model.imageName(i));
+        appendStamp(key, dir.filePath(name));
+    }
+    return key;
+}
+
+/*
+ * Load the project, update it from the image directories, pack it, save
+ * it, and export the atlas image.  Unchanged images are not decoded again
+ * by the export as they are held in the ImageCache.
+ *
+ * Return zero, or the exit status if there was an error.
+ */
+int runPack(PackJob& job, AtlasModel& model, RunOutput& out)
+{
+    const RunOptions& opt = *job.opt;
+    const char* project = opt.project.constData();
+    const char* exportFile =
+        opt.exportFile.isEmpty() ? NULL : opt.exportFile.constData();
+
+    if (! loadModel(model, project, out, job.resident))
+        return 1;
+
+    // Relative image paths are relative to the project file.
+    QDir dir = QFileInfo(QString::fromLocal8Bit(project)).dir();
+    int status = 0;
+
+    if (! opt.imageDirs.isEmpty()) {
+        removeMissingImages(model, dir);
+        for (const QString& idir : opt.imageDirs)
+            addDirectoryImages(model, dir, idir);
+    }
+
+    // Images edited since the project was written may have a new size.
+    qint64 projectTime = QFileInfo(QString::fromLocal8Bit(project))
+                                .lastModified().toMSecsSinceEpoch();
+    bool resized = updateImageSizes(model, dir, projectTime) > 0;
+
+    QString apath;
+    QByteArray rkey;
+    ResidentState::Pack* rpack = NULL;
+    if (job.resident) {
+        apath = QFileInfo(QString::fromLocal8Bit(project)).absoluteFilePath();
+        rkey = packKey(opt, model, dir);
+        rpack = &job.resident->packs[apath];
+    }
+
+    QStringList outputs;
+    if (job.cache) {
+        outputs << QString::fromLocal8Bit(job.outFile);
+        if (exportFile)
+            outputs << QString::fromLocal8Bit(exportFile);
+
+        job.cache->begin("pack");
+        job.cache->addInt(opt.algo);
+        job.cache->addInt(opt.pad);
+        job.cache->addInt(opt.w);
+        job.cache->addInt(opt.h);
+        job.cache->addData(opt.exportFile);
+        hashInputs(job.cache, model, dir, project);
+        if (job.cache->fetch(outputs, &status)) {
+            out.print("atlrun: Up to date (%s)\n",
+                      job.cache->key().left(12).toLatin1().constData());
+            return status;
+        }
+    }
+
+    int w = opt.w;
+    int h = opt.h;
+    if (! w) {
+        w = model.docW ? model.docW : 1024;
+        h = model.docH ? model.docH : 2048;
+    }
+    int leftover;
+    std::vector<int> prevX(model.imageX);
+    std::vector<int> prevY(model.imageY);
+    if (rpack && rpack->key == rkey) {
+        model = rpack->model;
+        leftover = rpack->leftover;
+    } else {
+        PROFILE(prof, "Pack");
+        leftover = packModel(model, opt.algo, w, h, opt.pad);
+        prof.addItems(model.imageCount());
+        if (rpack) {
+            rpack->key = rkey;
+            rpack->model = model;
+            rpack->leftover = leftover;
+        }
+    }
+    if (leftover) {
+        out.error("atlrun: %d images did not fit\n", leftover);
+        status = 2;
+    }
+
+    // Rewriting an unchanged project would only invalidate its stamps.
+    bool unchanged = (job.outFile == opt.project && opt.imageDirs.isEmpty() &&
+                      ! resized &&
+                      model.imageX == prevX && model.imageY == prevY);
+    if (! unchanged) {
+        if (! saveModel(model, job.outFile, out))
+            return 1;
+        job.writtenTime = QFileInfo(QString::fromLocal8Bit(job.outFile))
+                                .lastModified().toMSecsSinceEpoch();
+        if (rpack && job.outFile == opt.project) {
+            // The packed project is the input of the next request.
+            rpack->key = packKey(opt, model, dir);
+            ResidentState::Model& rm = job.resident->models[apath];
+            fileStamp(apath, rm.mtime, rm.size);
+            rm.model = model;
+        }
+    }
+
+    if (exportFile &&
+        ! exportModel(model, dir, exportFile, out, job.resident))
+        return 1;
+    if (job.cache && ! job.cache->store(outputs, status))
+        out.error("atlrun: Cannot store outputs in build cache %s\n",
+                  job.cache->directory().toLocal8Bit().constData());
+    return status;
+}
+
+/*
+ * Check an atlas-bin file with the runtime loader.
+ */
+static int verifyAtlasBin(const char* path, RunOutput& out)
+{
+    AtlbAtlas atl;
+    int err = atlb_mapFile(&atl, path);
+    if (err != ATLB_OK) {
+        atlb_close(&atl);
+        out.error("atlrun: %s: Invalid atlas (error %d)\n", path, err);
+        return 1;
+    }
+
+    const AtlbHeader* hdr = atl.header;
+    uint32_t regions = 0;
+    uint32_t count;
+    for (uint32_t i = 0; i < hdr->imageCount; ++i) {
+        const AtlbImage* img = atlb_image(&atl, i);
+        if (img->page >= hdr->pageCount || img->firstRegion != regions ||
+            ! atlb_imageRegions(&atl, i, &count)) {
+            out.error("atlrun: %s: Image %u is invalid\n", path, i);
+            atlb_close(&atl);
+            return 1;
+        }
+        regions += count;
+    }
+
+    int status = 0;
+    for (uint32_t r = 0; r < hdr->regionCount; ++r) {
+        const AtlbRegion* reg = atlb_region(&atl, r);
+        if (hdr->hashBuckets &&
+            atlb_find(&atl, atlb_name(&atl, reg->name)) != reg) {
+            out.error("atlrun: %s: Region %s is not found by hash\n", path,
+                      atlb_name(&atl, reg->name));
+            status = 1;
+            break;
+        }
+    }
+    if (! status && regions != hdr->regionCount) {
+        out.error("atlrun: %s: Images do not hold every region\n", path);
+        status = 1;
+    }
+    if (! status)
+        out.print("%s: %u images, %u regions%s\n", path, hdr->imageCount,
+                  hdr->regionCount, hdr->hashBuckets ? ", no collisions" : "");
+    atlb_close(&atl);
+    return status;
+}
+
+/*
+ * Run any command except watch & serve.
+ */
+int runCommand(const RunOptions& opt, RunOutput& out, ResidentState* resident)
+{
+    const char* command = opt.command.constData();
+    const char* project = opt.project.constData();
+    const char* outFile = opt.outFile.isEmpty() ? NULL
+                                                : opt.outFile.constData();
+    int status = 0;
+
+    if (opt.projects.size() > 1)
+        return runBatch(opt, out, resident);
+
+    if (strcmp(command, "verify") == 0) {
+        QFile file(QString::fromLocal8Bit(project));
+        QString error;
+        if (! file.open(QIODevice::ReadOnly)) {
+            out.error("atlrun: Cannot read %s\n", project);
+            return 1;
+        }
+        QByteArray data = file.readAll();
+        if (data.startsWith("ATLB"))
+            return verifyAtlasBin(project, out);
+        if (! verifyFrameHashFile(data, &error)) {
+            out.error("atlrun: %s: %s\n", project,
+                      error.toLocal8Bit().constData());
+            return 1;
+        }
+        out.print("%s: No collisions\n", project);
+        return 0;
+    }
+
+    BuildCache buildCache(QString::fromLocal8Bit(opt.cacheDir));
+    BuildCache* cache = opt.cacheDir.isEmpty() ? NULL : &buildCache;
+
+    AtlasModel model;
+    if (strcmp(command, "pack") == 0) {
+        PackJob job;
+        job.opt = &opt;
+        job.outFile = outFile ? outFile : project;
+        job.cache = cache;
+        job.resident = resident;
+        job.watcher = NULL;
+        job.writtenTime = 0;
+        return runPack(job, model, out);
+    }
+
+    if (! loadModel(model, project, out, resident))
+        return 1;
+
+    // Relative image paths are relative to the project file.
+    QDir dir = QFileInfo(QString::fromLocal8Bit(project)).dir();
+
+    if (strcmp(command, "info") == 0) {
+        out.print("%s: %d images, %d regions, document %dx%d\n", project,
+                  model.imageCount(), model.regionCount(),
+                  model.docW, model.docH);
+    } else if (strcmp(command, "export") == 0) {
+        if (! outFile) {
+            out.error("atlrun: export requires -o <image>\n");
+            return 1;
+        }
+        QStringList outputs(QString::fromLocal8Bit(outFile));
+        QString image;
+        if (opt.format >= 0) {
+            image = opt.exportFile.isEmpty()
+                ? QFileInfo(outputs[0]).completeBaseName() + ".png"
+                : QString::fromLocal8Bit(opt.exportFile);
+        }
+        if (cache) {
+            cache->begin("export");
+            cache->addInt(opt.format);
+            cache->addData(image.toUtf8());
+            hashInputs(cache, model, dir, project);
+            if (cache->fetch(outputs, &status)) {
+                out.print("atlrun: Up to date (%s)\n",
+                          cache->key().left(12).toLatin1().constData());
+                return status;
+            }
+        }
+        bool ok;
+        if (opt.format >= 0) {
+            PROFILE(prof, "Export Data");
+            QString error;
+            ok = exportData(model, opt.format, outputs[0], image, &error);
+            if (! ok)
+                out.error("atlrun: %s\n", error.toLocal8Bit().constData());
+        } else
+            ok = exportModel(model, dir, outFile, out, resident);
+        if (! ok)
+            status = 1;
+        else if (cache)
+            cache->store(outputs, status);
+    } else if (strcmp(command, "crop") == 0) {
+        if (opt.cropDir.isEmpty()) {
+            out.error("atlrun: crop requires -d <dir>\n");
+            return 1;
+        }
+        QString failed;
+        int count;
+        {
+        PROFILE(prof, "Crop");
+        count = cropModel(model, dir, QString::fromLocal8Bit(opt.cropDir),
+                          &failed);
+        }
+        if (count < 0) {
+            out.error("atlrun: Cannot write %s\n",
+                      failed.toLocal8Bit().constData());
+            status = 1;
+        } else if (! saveModel(model, outFile ? outFile : project, out))
+            status = 1;
+    } else if (strcmp(command, "save") == 0) {
+        if (! saveModel(model, outFile ? outFile : project, out))
+            status = 1;
+    } else {
+        out.error("atlrun: Unknown command %s\n%s", command, runUsage);
+        status = 1;
+    }
+    return status;
+}
+
+struct BatchResult
+{
+    BatchResult() : out(true), status(0), ms(0.0) {}
+
+    RunOutput out;
+    int status;
+    double ms;
+};
+
+struct BatchJob
+{
+    const RunOptions* opt;
+    ResidentState* resident;
+    QMutex residentMutex;
+    std::vector<BatchResult> results;
+};
+
+static QByteArray outputFor(const QByteArray& pattern,
+                            const QByteArray& project)
+{
+    QByteArray name = QFileInfo(QString::fromLocal8Bit(project))
+                          .completeBaseName().toLocal8Bit();
+    return QByteArray(pattern).replace('*', name);
+}
+
+static QString absolutePath(const QByteArray& path)
+{
+    return QFileInfo(QString::fromLocal8Bit(path)).absoluteFilePath();
+}
+
+/*
+ * Move the resident entries of one project between states.  Each batch
+ * worker uses its own state so that the daemon's hashes are only touched
+ * while the mutex is held.
+ */
+static void moveResident(ResidentState& from, ResidentState& to,
+                         const QString& project, const QString& image)
+{
+    if (from.models.contains(project))
+        to.models.insert(project, from.models.take(project));
+    if (from.packs.contains(project))
+        to.packs.insert(project, from.packs.take(project));
+    if (! image.isEmpty() && from.exports.contains(image))
+        to.exports.insert(image, from.exports.take(image));
+}
+
+static void runBatchProject(int i, void* user)
+{
+    BatchJob& batch = *(BatchJob*) user;
+    BatchResult& res = batch.results[i];
+
+    RunOptions opt(*batch.opt);
+    opt.project = opt.projects[i];
+    opt.projects = QList<QByteArray>() << opt.project;
+    opt.outFile = outputFor(opt.outFile, opt.project);
+    opt.exportFile = outputFor(opt.exportFile, opt.project);
+    opt.cropDir = outputFor(opt.cropDir, opt.project);
+
+    ResidentState local;
+    QString project, image;
+    if (batch.resident) {
+        project = absolutePath(opt.project);
+        if (opt.command == "pack" && ! opt.exportFile.isEmpty())
+            image = absolutePath(opt.exportFile);
+        else if (opt.command == "export" && ! opt.outFile.isEmpty())
+            image = absolutePath(opt.outFile);
+
+        QMutexLocker lock(&batch.residentMutex);
+        moveResident(*batch.resident, local, project, image);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    res.status = runCommand(opt, res.out, batch.resident ? &local : NULL);
+    res.ms = double(timer.nsecsElapsed()) / 1000000.0;
+
+    if (batch.resident) {
+        QMutexLocker lock(&batch.residentMutex);
+        moveResident(local, *batch.resident, project, image);
+    }
+}
+
+/*
+ * Run a command on several projects at once and print a summary.  Each
+ * project is built by one thread of the global pool and its image decoding
+ * & encoding is spread over any threads which are idle.
+ *
+ * Return 1 if any project failed, 2 if images did not fit in any of them,
+ * or zero.
+ */
+int runBatch(const RunOptions& opt, RunOutput& out, ResidentState* resident)
+{
+    QThreadPool* pool = QThreadPool::globalInstance();
+    int count = opt.projects.size();
+    int poolThreads = pool->maxThreadCount();
+    int threads = opt.jobs ? opt.jobs : poolThreads;
+    if (threads > poolThreads)
+        pool->setMaxThreadCount(threads);
+
+    BatchJob batch;
+    batch.opt = &opt;
+    batch.resident = resident;
+    batch.results.resize(count);
+
+    QElapsedTimer timer;
+    timer.start();
+    {
+    PROFILE(prof, "Batch");
+    parallelFor(count, runBatchProject, &batch, threads);
+    prof.addItems(count);
+    }
+    // Restore the pool size so that a resident daemon does not carry the
+    // raised count into later requests.
+    if (threads > poolThreads)
+        pool->setMaxThreadCount(poolThreads);
+    double ms = double(timer.nsecsElapsed()) / 1000000.0;
+
+    // Output is held until the end so that projects are not interleaved.
+    int failed = 0;
+    int overfull = 0;
+    for (int i = 0; i < count; ++i) {
+        const BatchResult& res = batch.results[i];
+        res.out.replay(out);
+        if (res.status == 1)
+            ++failed;
+        else if (res.status)
+            ++overfull;
+    }
+
+    out.print("\n%-40s %8s %12s\n", "Project", "Status", "Time");
+    for (int i = 0; i < count; ++i) {
+        const BatchResult& res = batch.results[i];
+        const char* status = (res.status == 0) ? "ok" :
+                             (res.status == 1) ? "failed" : "overfull";
+        out.print("%-40s %8s %9.1f ms\n", opt.projects[i].constData(),
+                  status, res.ms);
+    }
+    out.print("%d projects (%d failed, %d overfull) in %.1f ms with %d "
+              "threads\n", count, failed, overfull, ms, qMin(threads, count));
+
+    return failed ? 1 : (overfull ? 2 : 0);
+}
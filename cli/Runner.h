@@ -0,0 +1,106 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+//============================================================================
+//
+// Atlush Headless Runner
+//
+//============================================================================
+
+
+#include <stdarg.h>
+#include <QByteArray>
+#include <QHash>
+#include <QStringList>
+#include "AtlasModel.h"
+
+class BuildCache;
+class FileWatcher;
+
+struct RunOptions
+{
+    RunOptions();
+
+    QByteArray command;
+    QByteArray project;         // First of projects.
+    QList<QByteArray> projects; // Expanded from globs & manifests.
+    QByteArray outFile;         // Empty if not set.
+    QByteArray cropDir;
+    QByteArray exportFile;
+    QByteArray cacheDir;
+    QByteArray socket;          // Daemon socket name.
+    QByteArray trace;
+    QStringList imageDirs;
+    int algo, pad, w, h;
+    int format;                 // DataFormat for export, or -1 for image.
+    int jobs;                   // Projects built at once (0 = all threads).
+};
+
+/*
+ * Destination of runner messages.  Messages go to stdout & stderr unless
+ * the output is buffered (for sending to a daemon client).
+ */
+class RunOutput
+{
+public:
+    RunOutput(bool buffered = false) : _buffered(buffered) {}
+
+    void print(const char* fmt, ...);
+    void error(const char* fmt, ...);
+    const QByteArray& text() const { return _text; }
+    void replay(RunOutput& to) const;
+
+private:
+    void append(char stream, const char* fmt, va_list args);
+
+    QByteArray _text;       // Lines starting with 'o' (stdout) or 'e'.
+    bool _buffered;
+};
+
+/*
+ * Projects, pack results & exports kept between daemon requests.  Each is
+ * reused only while the modification times of its inputs are unchanged.
+ */
+struct ResidentState
+{
+    struct Model {
+        qint64 mtime, size;
+        AtlasModel model;
+    };
+    struct Pack {
+        QByteArray key;         // Project & directory stamps and settings.
+        AtlasModel model;
+        int leftover;
+    };
+    struct Export {
+        QByteArray key;         // Image positions & file stamps.
+        qint64 mtime, size;     // Of the written image.
+    };
+
+    QHash<QString, Model> models;
+    QHash<QString, Pack> packs;
+    QHash<QString, Export> exports;
+};
+
+struct PackJob
+{
+    const RunOptions* opt;
+    const char* outFile;        // Project to write.
+    BuildCache* cache;          // May be NULL.
+    ResidentState* resident;    // May be NULL.
+
+    // Watch mode
+    FileWatcher* watcher;
+    qint64 writtenTime;         // Modification time of our last write.
+};
+
+extern const char* runUsage;
+
+int parseRunOptions(const QList<QByteArray>& args, RunOptions& opt,
+                    RunOutput& out);
+int runCommand(const RunOptions& opt, RunOutput& out,
+               ResidentState* resident = NULL);
+int runBatch(const RunOptions& opt, RunOutput& out,
+             ResidentState* resident = NULL);
+int runPack(PackJob& job, AtlasModel& model, RunOutput& out);
+
+#endif  // RUNNER_H
@@ -0,0 +1,121 @@
+//============================================================================
+//
+// Atlush Headless Runner
+//
+// Applies editor operations to a project file without the GUI.
+//
+//============================================================================
+
+
+#include <stdio.h>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFileInfo>
+#include "libatlush.h"
+#include "Daemon.h"
+#include "Runner.h"
+
+/*
+ * Watch the project, its images and the image directories.
+ */
+static void updateWatch(PackJob& job, const AtlasModel& model)
+{
+    QString project(QString::fromLocal8Bit(job.opt->project));
+    QDir dir = QFileInfo(project).dir();
+    QStringList files;
+    QStringList dirs;
+
+    files << project;
+    int count = model.imageCount();
+    for (int i = 0; i < count; ++i)
+        files << dir.filePath(QString::fromUtf8(model.imageName(i)));
+
+    for (const QString& idir : job.opt->imageDirs)
+        dirs << dir.filePath(idir);
+
+    job.watcher->setPaths(files, dirs);
+}
+
+static void watchChanged(const QStringList& files, const QStringList& dirs,
+                         void* user)
+{
+    PackJob& job = *(PackJob*) user;
+    QString project(QFileInfo(QString::fromLocal8Bit(job.opt->project))
+                        .absoluteFilePath());
+
+    // Ignore the event caused by writing the project ourselves.
+    if (dirs.isEmpty() && files.size() == 1 && files[0] == project &&
+        QFileInfo(project).lastModified().toMSecsSinceEpoch() ==
+            job.writtenTime)
+        return;
+
+    RunOutput out;
+    int64_t start = Profiler::instance().now();
+    AtlasModel model;
+    if (runPack(job, model, out) != 1)
+        updateWatch(job, model);
+    double ms = double(Profiler::instance().now() - start) / 1000.0;
+    out.print("%s: %d changed, %d images packed in %.1f ms\n",
+              QTime::currentTime().toString().toLocal8Bit().constData(),
+              int(files.size() + dirs.size()), model.imageCount(), ms);
+}
+
+static int watch(QCoreApplication& app, const RunOptions& opt)
+{
+    RunOutput out;
+    PackJob job;
+    job.opt = &opt;
+    job.outFile = opt.outFile.isEmpty() ? opt.project.constData()
+                                        : opt.outFile.constData();
+    job.cache = NULL;
+    job.resident = NULL;
+    job.watcher = NULL;
+    job.writtenTime = 0;
+
+    AtlasModel model;
+    int status = runPack(job, model, out);
+    if (status == 1)
+        return status;
+
+    FileWatcher watcher(watchChanged, &job);
+    job.watcher = &watcher;
+    updateWatch(job, model);
+    out.print("Watching %d files & %d directories\n",
+              watcher.fileCount(), watcher.directoryCount());
+    return app.exec();
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    QList<QByteArray> args;
+    for (int i = 1; i < argc; ++i)
+        args << QByteArray(argv[i]);
+
+    RunOutput out;
+    RunOptions opt;
+    int status = parseRunOptions(args, opt, out);
+    if (status >= 0)
+        return status;
+
+    QString socket(QString::fromLocal8Bit(opt.socket));
+    if (opt.command == "serve") {
+        RunDaemon daemon;
+        if (! daemon.listen(socket.isEmpty() ? DEFAULT_SOCKET : socket, out))
+            return 1;
+        return app.exec();
+    }
+
+    // Hand the command to a daemon if one is running.
+    if (! socket.isEmpty() && opt.command != "watch" &&
+        daemonRequest(socket, args, &status))
+        return status;
+
+    Profiler::instance().setTraceFile(QString::fromLocal8Bit(opt.trace));
+    if (opt.command == "watch")
+        status = watch(app, opt);
+    else
+        status = runCommand(opt, out);
+    Profiler::instance().writeTrace();
+    return status;
+}
@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = atlrun
+OBJECTS_DIR = obj
+DESTDIR = ..
+
+CONFIG += qt console release
+CONFIG -= app_bundle
+QT = core gui network
+
+include(../libatlush.pri)
+
+HEADERS += Daemon.h Runner.h
+SOURCES += atlrun.cpp Daemon.cpp Runner.cpp
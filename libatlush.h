@@ -0,0 +1,40 @@
+#ifndef LIBATLUSH_H
+#define LIBATLUSH_H
+//============================================================================
+//
+// Atlush Core Library
+//
+// The parts of Atlush which do not depend on QtWidgets.  Programs link with
+// the atlush_core library and include this header.
+//
+//   AtlasModel.h   Project data, .atl reader & writer.
+//   AtlasOps.h     Pack, composite & crop operations on a model.
+//   BuildCache.h   Content addressed store of build outputs.
+//   DataExport.h   JSON, C header & Lua frame exporters.
+//   FrameHash.h    Minimal perfect hash of frame names.
+//   Packer.h       Rectangle packers.
+//   ImageOps.h     Image kernels (alpha cropping).
+//   ImageCache.h   Decoded image cache.
+//   Parallel.h     Nestable parallel loops on the global thread pool.
+//   PixelCache.h   Memory mapped .atlcache files.
+//   Profiler.h     Scoped timers & Chrome trace output.
+//   Watcher.h      Debounced file & directory change notification.
+//
+//============================================================================
+
+
+#include "Atlush.h"
+#include "AtlasModel.h"
+#include "AtlasOps.h"
+#include "BuildCache.h"
+#include "DataExport.h"
+#include "FrameHash.h"
+#include "ImageCache.h"
+#include "ImageOps.h"
+#include "Packer.h"
+#include "Parallel.h"
+#include "PixelCache.h"
+#include "Profiler.h"
+#include "Watcher.h"
+
+#endif  // LIBATLUSH_H
@@ -0,0 +1,16 @@
+# Atlush core library sources (no QtWidgets dependency).
+# Included by the project files which build or link libatlush.
+
+CORE_DIR = $$PWD
+
+INCLUDEPATH += $$CORE_DIR $$CORE_DIR/support
+
+CORE_HEADERS = libatlush.h Atlush.h AtlasModel.h AtlasOps.h BuildCache.h \
+	DataExport.h FrameHash.h ImageCache.h ImageOps.h Packer.h Parallel.h \
+	PixelCache.h Profiler.h Watcher.h atl_bin.h atl_read.h
+CORE_SOURCES = AtlasModel.cpp AtlasOps.cpp BuildCache.cpp DataExport.cpp \
+	FrameHash.cpp ImageCache.cpp ImageOps.cpp Packer.cpp Parallel.cpp \
+	PixelCache.cpp Profiler.cpp Watcher.cpp
+
+for(f, CORE_HEADERS): HEADERS += $$CORE_DIR/$$f
+for(f, CORE_SOURCES): SOURCES += $$CORE_DIR/$$f
@@ -0,0 +1,8 @@
+TEMPLATE = lib
+TARGET = atlush_core
+OBJECTS_DIR = obj_core
+
+CONFIG += qt staticlib release
+QT = core gui
+
+include(libatlush.pri)
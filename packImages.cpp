@@ -3,130 +3,35 @@
 #include <QMessageBox>
 #include <QSpinBox>
 #include "AWindow.h"
+#include "AtlasOps.h"
 #include "ItemValues.h"
-#include "binpack2d.h"
 #include "ExtractDialog.h"
+#include "Packer.h"
+#include "Profiler.h"
 
-#define STB_RECT_PACK_IMPLEMENTATION
-#define STBRP_STATIC
-#include "stb_rect_pack.h"
-
-enum PackAlgorithm {
-    PA_BinPack,
-    PA_BinPackSort,
-    PA_SkyLine,
-    PA_SkyLineBF
-};
-
-using namespace BinPack2D;
-
-typedef QGraphicsItem* APData;
-typedef Content<APData>::Vector::iterator ABinPackIter;
-
-struct GraphicsItemPackerBP {
-    ContentAccumulator<APData> input;
-    ContentAccumulator<APData> output;
-    ContentAccumulator<APData> leftover;
-
-    void addInput(QGraphicsItem* gi, const ItemValues& val)
-    {
-        input += Content<APData>(gi, Coord(val.x, val.y),
-                                      Size(val.w, val.h), false);
-    }
-
-    int pack(int w, int h, bool sort)
-    {
-        CanvasArray<APData> canvases =
-            UniformCanvasArrayBuilder<APData>(w, h, 1).Build();
-        if (sort)
-            input.Sort();
-        canvases.Place(input, leftover);
-        canvases.CollectContent(output);
-        return leftover.Get().size();
-    }
-};
-
-struct GraphicsItemPackerSL {
-    std::vector<stbrp_rect> input;
-    stbrp_context ctx;
-
-    void addInput(int id, int w, int h)
-    {
-        stbrp_rect rect;
-        rect.id = id;
-        rect.w = w;
-        rect.h = h;
-        rect.was_packed = 0;
-
-        input.push_back(rect);
-    }
-
-    int pack(int w, int h, bool bestFit)
-    {
-        stbrp_node* nodes = new stbrp_node[w];
-        if (! nodes)
-            return 0;
-
-        stbrp_init_target(&ctx, w, h, nodes, w);
-        stbrp_setup_heuristic(&ctx,
-                        bestFit ? STBRP_HEURISTIC_Skyline_BF_sortHeight
-                                : STBRP_HEURISTIC_Skyline_BL_sortHeight);
-        int allPacked = stbrp_pack_rects(&ctx, input.data(), input.size());
-
-        delete[] nodes;
-        return allPacked;
-    }
-};
-
+/*
+ * Packs scene items using a RectPacker.  The rectangle ids are indices into
+ * the item list.
+ */
 struct GraphicsItemPacker {
+    GraphicsItemPacker(int algo) : packer(algo) {}
+
     QList<QGraphicsItem *> list;
-    GraphicsItemPackerBP* bp;
-    GraphicsItemPackerSL* sl;
-    int packAlgo;
-
-    void init(int algo) {
-        packAlgo = algo;
-        if (packAlgo >= PA_SkyLine) {
-            bp = NULL;
-            sl = new GraphicsItemPackerSL;
-        } else {
-            bp = new GraphicsItemPackerBP;
-            sl = NULL;
-        }
-    }
+    RectPacker packer;
+    void (*posFunc)(QGraphicsItem*, int, int, void*);
+    void* user;
 
-    size_t inputCount() const {
-        return bp ? bp->input.Get().size() : sl->input.size();
+    static void placeItem(int id, int x, int y, void* data) {
+        GraphicsItemPacker* pk = (GraphicsItemPacker*) data;
+        pk->posFunc(pk->list[id], x, y, pk->user);
     }
 
     int packItems(int w, int h,
-                  void (*posFunc)(QGraphicsItem*, int, int, void*),
-                  void* user) {
-        int leftover;
-        if (bp) {
-            leftover = bp->pack(w, h, (packAlgo == PA_BinPackSort));
-
-            // Update scene.
-            ABinPackIter it;
-            for (it = bp->output.Get().begin();
-                 it != bp->output.Get().end(); it++) {
-                const Content<APData>& con = *it;
-                posFunc(con.content, con.coord.x, con.coord.y, user);
-            }
-
-            delete bp;
-        } else {
-            sl->pack(w, h, (packAlgo == PA_SkyLineBF));
-            leftover = 0;
-            for (const auto& it : sl->input) {
-                if (it.was_packed)
-                    posFunc(list[ it.id ], it.x, it.y, user);
-                else
-                    ++leftover;
-            }
-            delete sl;
-        }
-        return leftover;
+                  void (*func)(QGraphicsItem*, int, int, void*),
+                  void* data) {
+        posFunc = func;
+        user = data;
+        return packer.pack(w, h, placeItem, this);
     }
 };
 
@@ -136,49 +41,40 @@ static void warnIncomplete(QWidget* parent, int leftover)
             QString::number(leftover) + QString(" images did not fit."));
 }
 
-static void positionItem(QGraphicsItem* item, int x, int y, void*)
+void AWindow::packImages()
 {
-    item->setPos(x, y);
+    ItemList sel = _scene->selectedItems();
+    int leftover = packItems(sel.empty() ? NULL : &sel);
+    if (leftover)
+        warnIncomplete(this, leftover);
 }
 
-void AWindow::packImages()
+/*
+ * Pack images as a single undo step.
+ *
+ * \param from  Items to pack, or NULL for all images.
+ *
+ * Return the number of images which did not fit.
+ */
+int AWindow::packItems(const ItemList* from)
 {
-    GraphicsItemPacker pk;
+    AtlasModel model;
+    ItemList images;
+    std::vector<int> prevX, prevY;
     int w, h;
     int leftover;
 
-    pk.init(_packAlgo->currentIndex());
+    PROFILE(prof, "Pack");
 
     // Collect images.
     {
-    ItemValues val;
-    int pad = _packPad->value();
-
-    pk.list = _scene->selectedItems();
-    if (pk.list.empty())
-        pk.list = _scene->items(Qt::AscendingOrder);
-
-    QList<QGraphicsItem *>::iterator it = pk.list.begin();
-    while (it != pk.list.end()) {
-        QGraphicsItem* gi = *it;
-        if (gi->type() != GIT_PIXMAP) {
-            it = pk.list.erase(it);     // Eliminate for snapshot.
-            continue;
-        }
+    PROFILE(collect, "Collect");
+    captureModel(model, &images, from, false);
+    prevX = model.imageX;
+    prevY = model.imageY;
+    prof.addItems(model.imageCount());
 
-        itemValues(val, gi);
-        val.w += pad;
-        val.h += pad;
-
-        if (pk.bp)
-            pk.bp->addInput(gi, val);
-        else
-            pk.sl->addInput(it - pk.list.begin(), val.w, val.h);
-
-        ++it;
-    }
-
-    _undo.snapshot(pk.list);
+    _undo.snapshot(images);
     }
 
     // Pack 'em.
@@ -189,12 +85,20 @@ void AWindow::packImages()
         w = _docSize.width();
         h = _docSize.height();
     }
-    leftover = pk.packItems(w, h, positionItem, NULL);
-
+    {
+    PROFILE(place, "Place");
+    beginBulk();
+    leftover = packModel(model, _packAlgo->currentIndex(), w, h,
+                         _packPad->value());
+    for (int i = 0; i < model.imageCount(); ++i) {
+        if (model.imageX[i] != prevX[i] || model.imageY[i] != prevY[i])
+            images[i]->setPos(model.imageX[i], model.imageY[i]);
+    }
     _undo.commit();
+    endBulk("Pack");
+    }
 
-    if (leftover)
-        warnIncomplete(this, leftover);
+    return leftover;
 }
 
 struct ExtractRegionData {
@@ -214,7 +118,7 @@ static void copyRegion(QGraphicsItem* item, int x, int y, void* user)
         QRectF rect = item->boundingRect();
         QRect srcRect(pos.x(), pos.y(), rect.width(), rect.height());
         ed->ip.drawPixmap(QPoint(x, y),
-                          static_cast<QGraphicsPixmapItem*>(si)->pixmap(),
+                          static_cast<ResidentImage*>(si)->pixels(),
                           srcRect);
 
         if (ed->removeList.indexOf(si) < 0)
@@ -228,11 +132,11 @@ static void copyRegion(QGraphicsItem* item, int x, int y, void* user)
 
 void AWindow::extractRegionsOp(const QString& file, const QColor& color)
 {
-    GraphicsItemPacker pk;
+    GraphicsItemPacker pk(_packAlgo->currentIndex());
     int w, h;
     int leftover;
 
-    pk.init(_packAlgo->currentIndex());
+    requireRegionItems();
 
     // Collect regions.
     {
@@ -253,14 +157,11 @@ void AWindow::extractRegionsOp(const QString& file, const QColor& color)
         val.w += pad;
         val.h += pad;
 
-        if (pk.bp)
-            pk.bp->addInput(gi, val);
-        else
-            pk.sl->addInput(it - pk.list.begin(), val.w, val.h);
+        pk.packer.addInput(it - pk.list.begin(), val.x, val.y, val.w, val.h);
     }
     }
 
-    if (pk.inputCount() == 0) {
+    if (pk.packer.inputCount() == 0) {
         QMessageBox::warning(this, "Extract Incomplete",
                              "No Regions found; nothing to extract.");
         return;
@@ -280,8 +181,9 @@ void AWindow::extractRegionsOp(const QString& file, const QColor& color)
     QPixmap newPix(w, h);
     ExtractRegionData ed;
 
+    beginBulk();
     ed.pitem = makeImage(QPixmap(), 0, 0);
-    ed.pitem->setData(ID_NAME, file);
+    setItemName(ed.pitem, file);
 
     newPix.fill(color);
     ed.ip.begin(&newPix);
@@ -293,6 +195,7 @@ void AWindow::extractRegionsOp(const QString& file, const QColor& color)
 
     // Delete source images from scene.
     removeItems(ed.removeList.constData(), ed.removeList.size());
+    endBulk("Extract");
 
     if (! newPix.save(file)) {
         QString error("Could not save image to file ");
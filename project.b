@@ -1,14 +1,59 @@
+lib %atlush_core [
+    qt [gui]
+    include_from [%. %support]
+    sources [
+        %AtlasModel.cpp
+        %AtlasOps.cpp
+        %BuildCache.cpp
+        %DataExport.cpp
+        %FrameHash.cpp
+        %ImageCache.cpp
+        %ImageOps.cpp
+        %Packer.cpp
+        %Parallel.cpp
+        %PixelCache.cpp
+        %Profiler.cpp
+        %Watcher.cpp
+    ]
+]
+
 exe %atlush [
     qt [widgets]
     include_from %support
+    libs_from %. %atlush_core
     sources [
         %AWindow.cpp
         %packImages.cpp
         %CanvasDialog.cpp
         %ExtractDialog.cpp
         %IOWidget.cpp
+        %Journal.cpp
+        %NameIndex.cpp
+        %RegionLayer.cpp
+        %Residency.cpp
+        %SliceDialog.cpp
         %support/RecentFiles.cpp
         %support/undo.c
         %icons.qrc
     ]
 ]
+
+exe %atlrun [
+    qt [gui network]
+    include_from [%. %support %cli]
+    libs_from %. %atlush_core
+    sources [
+        %cli/atlrun.cpp
+        %cli/Daemon.cpp
+        %cli/Runner.cpp
+    ]
+]
+
+exe %atlbench [
+    qt [gui]
+    include_from [%. %support]
+    libs_from %. %atlush_core
+    sources [
+        %bench/atlbench.cpp
+    ]
+]
@@ -198,3 +198,34 @@ int undo_stepForward(UndoStack* us, const UndoValue** step)
         adv |= Undo_AdvancedToEnd;
     return adv;
 }
+
+/**
+ * Replace the undo history with a copy of previously saved stack values.
+ *
+ * \param data  Stack values including the terminator (used + 1 values).
+ * \param used  Number of values in use (the UndoStack used member).
+ * \param pos   History position (the UndoStack pos member).
+ *
+ * \return Non-zero if successful.
+ */
+int undo_restore(UndoStack* us, const UndoValue* data, uint32_t used,
+                 uint32_t pos)
+{
+    uint32_t count = used + 1;
+
+    if (pos > used)
+        return 0;
+
+    if (count > us->avail) {
+        UndoValue* mem = (UndoValue*) realloc(us->stack, count * UV_SIZE);
+        if (! mem)
+            return 0;
+        us->stack = mem;
+        us->avail = count;
+    }
+
+    memcpy(us->stack, data, count * UV_SIZE);
+    us->used = used;
+    us->pos = pos;
+    return 1;
+}
@@ -54,6 +54,8 @@ void undo_clear(UndoStack*);
 void undo_record(UndoStack*, uint16_t opcode, const UndoValue* data, int values);
 int  undo_stepBack(UndoStack*, const UndoValue** step);
 int  undo_stepForward(UndoStack*, const UndoValue** step);
+int  undo_restore(UndoStack*, const UndoValue* data, uint32_t used,
+                  uint32_t pos);
 
 #ifdef __cplusplus
 }